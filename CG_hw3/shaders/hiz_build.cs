@@ -0,0 +1,41 @@
+#version 430 core
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// mode 0: copy the depth buffer into level 0.
+// mode 1: reduce the previous level (farthest depth of each 2x2, or 3x3 at odd edges).
+uniform int mode;
+uniform sampler2D depthTex;
+layout (r32f, binding = 0) readonly uniform image2D srcLevel;
+layout (r32f, binding = 1) writeonly uniform image2D dstLevel;
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(dstLevel);
+    if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+        return;
+
+    if (mode == 0) {
+        imageStore(dstLevel, dst, vec4(texelFetch(depthTex, dst, 0).r));
+        return;
+    }
+
+    ivec2 srcSize = imageSize(srcLevel);
+    ivec2 src = dst * 2;
+    // The last column/row of an odd-sized level also covers the leftover texel.
+    ivec2 extent = ivec2(2);
+    if (dst.x == dstSize.x - 1 && (srcSize.x & 1) != 0)
+        extent.x = 3;
+    if (dst.y == dstSize.y - 1 && (srcSize.y & 1) != 0)
+        extent.y = 3;
+
+    float farthest = 0.0;
+    for (int y = 0; y < extent.y; ++y) {
+        for (int x = 0; x < extent.x; ++x) {
+            ivec2 p = min(src + ivec2(x, y), srcSize - 1);
+            farthest = max(farthest, imageLoad(srcLevel, p).r);
+        }
+    }
+    imageStore(dstLevel, dst, vec4(farthest));
+}
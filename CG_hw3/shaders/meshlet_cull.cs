@@ -0,0 +1,145 @@
+#version 430 core
+
+layout (local_size_x = 64) in;
+
+// Bounds of one chunk (meshlet), in object space.
+struct Chunk
+{
+    vec4 sphere;    // xyz: center, w: radius.
+    vec4 cone;      // xyz: axis, w: cutoff (1 = no back-face test).
+};
+
+// Layout defined by glMultiDrawElementsIndirect.
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int  baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Bounds
+{
+    vec4 objectSphere;
+    Chunk chunks[];
+};
+
+layout (std430, binding = 1) writeonly buffer Commands
+{
+    DrawCommand commands[];
+};
+
+layout (std430, binding = 2) buffer Stats
+{
+    uint numVisible;
+    uint numFrustumCulled;
+    uint numOccluded;
+    uint numRecovered;
+};
+
+// 1 for chunks rejected by the Hi-Z test in pass 0, re-tested in pass 1.
+layout (std430, binding = 3) buffer OcclusionFlags
+{
+    uint occluded[];
+};
+
+// Object-space frustum planes and camera position.
+uniform vec4 frustumPlanes[6];
+uniform vec3 cameraPos;
+uniform uint numChunks;
+// Object to clip space, for projecting bounds onto the Hi-Z pyramid.
+uniform mat4 MVP;
+// Pass 0: frustum, cone and Hi-Z (previous frame) tests.
+// Pass 1: re-test the pass-0 occluded chunks against this frame's Hi-Z.
+uniform int pass;
+uniform bool useHiZ;
+uniform sampler2D hiZ;
+uniform int hiZMaxLevel;
+
+bool IsSphereVisible(vec4 sphere)
+{
+    for (int i = 0; i < 6; ++i) {
+        if (dot(frustumPlanes[i].xyz, sphere.xyz) + frustumPlanes[i].w < -sphere.w)
+            return false;
+    }
+    return true;
+}
+
+bool IsConeBackFacing(vec4 sphere, vec4 cone)
+{
+    vec3 v = sphere.xyz - cameraPos;
+    return dot(v, cone.xyz) >= cone.w * length(v) + sphere.w;
+}
+
+// Project the bounding box of the sphere and compare its nearest depth with the
+// farthest depth stored in the pyramid texels it covers.
+bool IsOccluded(vec4 sphere)
+{
+    vec3 ndcMin = vec3(1.0e30);
+    vec3 ndcMax = vec3(-1.0e30);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                                   (i & 2) != 0 ? 1.0 : -1.0,
+                                                   (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = MVP * vec4(corner, 1.0);
+        // Crosses the near plane: cannot be occluded.
+        if (clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+    float nearestDepth = ndcMin.z * 0.5 + 0.5;
+
+    // Choose the level where the rectangle covers at most 2x2 texels.
+    vec2 sizePx = (uvMax - uvMin) * vec2(textureSize(hiZ, 0));
+    int level = clamp(int(ceil(log2(max(max(sizePx.x, sizePx.y), 1.0)))), 0, hiZMaxLevel);
+    // Texel j of a level covers level-0 pixels [j << level, (j + 1) << level), the last one also
+    // the leftover column/row of odd-sized levels (hiz_build.cs), so go through level-0 pixels.
+    ivec2 baseSize = textureSize(hiZ, 0);
+    ivec2 levelSize = textureSize(hiZ, level);
+    ivec2 p0 = min(clamp(ivec2(uvMin * vec2(baseSize)), ivec2(0), baseSize - 1) >> level, levelSize - 1);
+    ivec2 p1 = min(clamp(ivec2(uvMax * vec2(baseSize)), ivec2(0), baseSize - 1) >> level, levelSize - 1);
+    float farthest = max(max(texelFetch(hiZ, p0, level).r, texelFetch(hiZ, ivec2(p1.x, p0.y), level).r),
+                         max(texelFetch(hiZ, ivec2(p0.x, p1.y), level).r, texelFetch(hiZ, p1, level).r));
+    return nearestDepth > farthest;
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= numChunks)
+        return;
+
+    Chunk chunk = chunks[id];
+    if (pass == 1) {
+        // Only chunks the previous-frame pyramid rejected; the others were drawn already.
+        bool recovered = occluded[id] != 0u && !IsOccluded(chunk.sphere);
+        commands[id].instanceCount = recovered ? 1u : 0u;
+        if (recovered) {
+            atomicAdd(numRecovered, 1u);
+            atomicAdd(numVisible, 1u);
+        }
+        return;
+    }
+
+    bool visible = IsSphereVisible(objectSphere)
+        && IsSphereVisible(chunk.sphere)
+        && !IsConeBackFacing(chunk.sphere, chunk.cone);
+    occluded[id] = 0u;
+    if (!visible) {
+        atomicAdd(numFrustumCulled, 1u);
+    }
+    else if (useHiZ && IsOccluded(chunk.sphere)) {
+        visible = false;
+        occluded[id] = 1u;
+        atomicAdd(numOccluded, 1u);
+    }
+
+    commands[id].instanceCount = visible ? 1u : 0u;
+    if (visible)
+        atomicAdd(numVisible, 1u);
+}
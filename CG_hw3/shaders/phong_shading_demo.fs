@@ -21,6 +21,13 @@ uniform vec3 Ks;
 uniform float Ns;
 uniform sampler2D mapKd;
 uniform bool hasMapKd;
+// Packed diffuse maps (TextureArray): used instead of mapKd when mapKdLayer >= 0.
+uniform sampler2DArray mapKdArray;
+uniform int mapKdLayer;
+// Skybox prefiltered with GGX: mip level = roughness * specularEnvMaxLod.
+uniform samplerCube specularEnvMap;
+uniform bool hasSpecularEnvMap;
+uniform float specularEnvMaxLod;
 // Light data.
 uniform vec3 ambientLight;
 uniform vec3 dirLightDir;
@@ -32,6 +39,13 @@ uniform vec3 spotLightIntensity;
 uniform vec3 spotLightDir;
 uniform float spotLightCutoffDeg;
 uniform float spotLightTotalWidthDeg;
+// Ambient light from the skybox, as 9 SH coefficients (see SphericalHarmonics).
+layout (std140) uniform SHLighting
+{
+    vec4 shCoeffs[9];   // rgb: irradiance / PI.
+    mat4 shRotation;    // View space to skybox space.
+    vec4 shParams;      // x: 1 if the coefficients are valid.
+};
 
 out vec4 FragColor;
 
@@ -54,6 +68,19 @@ vec3 Specular(vec3 Ks, vec3 I, vec3 L, vec3 N, vec3 E, float ShininessStrength)
     return Ks * I * pow(max(0, dot(N, H)), ShininessStrength);
 }
 
+vec3 SHIrradiance(vec3 n)
+{
+    return shCoeffs[0].rgb * 0.282095
+         + shCoeffs[1].rgb * 0.488603 * n.y
+         + shCoeffs[2].rgb * 0.488603 * n.z
+         + shCoeffs[3].rgb * 0.488603 * n.x
+         + shCoeffs[4].rgb * 1.092548 * n.x * n.y
+         + shCoeffs[5].rgb * 1.092548 * n.y * n.z
+         + shCoeffs[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+         + shCoeffs[7].rgb * 1.092548 * n.x * n.z
+         + shCoeffs[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
 void main()
 {
     // --------------------------------------------------------
@@ -68,13 +95,17 @@ void main()
     // if hasMapKd => texColor = texture2D(mapKd, iTexCoord).rgb.
     // else texColor = Kd.
     vec3 texColor;
-    if (hasMapKd)
+    if (hasMapKd && mapKdLayer >= 0)
+        texColor = texture(mapKdArray, vec3(iTexCoord, float(mapKdLayer))).rgb;
+    else if (hasMapKd)
          texColor = texture2D(mapKd, iTexCoord).rgb;
     else
         texColor = Kd;
     // -------------------------------------------------------------
     // Ambient light.
     vec3 ambient = Ka * ambientLight;
+    if (shParams.x > 0.5)
+        ambient = Ka * max(SHIrradiance(normalize((shRotation * vec4(N, 0.0)).xyz)), 0.0);
     // -------------------------------------------------------------
     // Compute fragment linghting in "view space"
     // v: view space
@@ -119,6 +150,16 @@ void main()
     specular = Specular(Ks, SpotLightRadiance, vSpotLightToPos, N, E, Ns);
     vec3 spotLight = diffuse + specular;
 
-    vec3 LightColor = ambient + dirLight + pointLight + spotLight;
+    // -------------------------------------------------------------
+    // Glossy reflection of the skybox: one prefiltered lookup.
+    vec3 envSpecular = vec3(0.0);
+    if (hasSpecularEnvMap) {
+        // Blinn-Phong exponent to GGX roughness.
+        float roughness = sqrt(2.0 / (Ns + 2.0));
+        vec3 R = (shRotation * vec4(reflect(-E, N), 0.0)).xyz;
+        envSpecular = Ks * textureLod(specularEnvMap, R, roughness * specularEnvMaxLod).rgb;
+    }
+
+    vec3 LightColor = ambient + dirLight + pointLight + spotLight + envSpecular;
     FragColor = vec4(LightColor, 1.0);
 }
\ No newline at end of file
@@ -3,6 +3,11 @@
 layout (location = 0) in vec3 Position;
 layout (location = 1) in vec3 Normal;
 layout (location = 2) in vec2 TexCoord;
+// xyz tangent, w sign of the bitangent (TriangleMesh::GenerateTangents).
+layout (location = 3) in vec4 Tangent;
+// Per-instance data (constant identity when not drawn instanced).
+layout (location = 4) in mat4 instanceWorldMatrix;
+layout (location = 8) in mat3 instanceNormalMatrix;
 
 // Transformation matrix.
 uniform mat4 worldMatrix;
@@ -20,17 +25,21 @@ uniform mat4 MVP;
 out vec3 iPosWorld;
 out vec3 iNormalWorld;
 out vec2 iTexCoord;
+out vec4 iTangentWorld;
 
 void main()
 {
     // --------------------------------------------------------
     // Add your implementation.
     // --------------------------------------------------------
-    gl_Position = MVP * vec4(Position, 1.0);
+    vec4 positionInstance = instanceWorldMatrix * vec4(Position, 1.0);
+    gl_Position = MVP * positionInstance;
     // Pass vertex attributes.
-    vec4 positionTmp = viewMatrix * worldMatrix * vec4(Position, 1.0);
+    vec4 positionTmp = viewMatrix * worldMatrix * positionInstance;
     iPosWorld = positionTmp.xyz / positionTmp.w;
 
-    iNormalWorld = (normalMatrix * vec4(Normal, 0.0)).xyz;
+    iNormalWorld = (normalMatrix * vec4(instanceNormalMatrix * Normal, 0.0)).xyz;
     iTexCoord = TexCoord;
+    // A tangent lies in the surface, so it follows the positions (not the normal matrices).
+    iTangentWorld = vec4((viewMatrix * worldMatrix * instanceWorldMatrix * vec4(Tangent.xyz, 0.0)).xyz, Tangent.w);
 }
\ No newline at end of file
@@ -1,15 +1,98 @@
 #version 330 core
 
 in vec2 iTexCoord;
+in vec4 iClipPos;
 
 // Material properties.
 uniform sampler2D mapKd;
+// Fullscreen mode: clip space to skybox directions.
+uniform bool fullscreen;
+uniform mat4 invViewProj;
+// Cube map resampled from mapKd on the CPU (no seam, no pole pinching).
+uniform bool useCubeMap;
+uniform samplerCube cubeMap;
+// Virtual texture (tiled panorama, fullscreen mode): the indirection table holds per page
+// and level the page cache slot (x, y) and the level of the page actually resident there.
+uniform bool useVirtualTexture;
+// Feedback pass: write the page each pixel needs instead of its color.
+uniform bool virtualFeedback;
+uniform sampler2D vtIndirection;
+uniform sampler2D vtPageCache;
+// Level 0 pages across and down, number of levels, lod bias.
+uniform vec4 vtParams;
+// Page size and border in texels, page cache size in texels.
+uniform vec3 vtCacheParams;
 
 out vec4 FragColor;
 
+const float PI = 3.14159265358979;
+
+
+// Same mapping as the sphere: u = phi / 2PI with phi measured from +x towards +z,
+// v = 0 at the top, sampled at (u, 1 - v).
+vec2 PanoramaUV(vec3 dir, out vec2 dx, out vec2 dy)
+{
+    dir = normalize(dir);
+    float phi = atan(dir.z, dir.x);
+    float theta = asin(clamp(dir.y, -1.0, 1.0));
+    vec2 uv = vec2(phi / (2.0 * PI), 0.5 + theta / PI);
+    // atan wraps at phi = PI; take the derivatives from a copy that wraps elsewhere
+    // so the seam does not drop to the smallest mip.
+    vec2 uvSeam = vec2(fract(uv.x + 0.5) - 0.5, uv.y);
+    dx = dFdx(uv);
+    dy = dFdy(uv);
+    vec2 dxSeam = dFdx(uvSeam), dySeam = dFdy(uvSeam);
+    dx.x = abs(dx.x) < abs(dxSeam.x) ? dx.x : dxSeam.x;
+    dy.x = abs(dy.x) < abs(dySeam.x) ? dy.x : dySeam.x;
+    return uv;
+}
+
+vec4 SamplePanorama(vec3 dir)
+{
+    vec2 dx, dy;
+    vec2 uv = PanoramaUV(dir, dx, dy);
+    return textureGrad(mapKd, uv, dx, dy);
+}
+
+// Mip level of the virtual texture for these derivatives, and the page it falls in.
+int VirtualLevel(vec2 uv, vec2 dx, vec2 dy, out ivec2 page)
+{
+    vec2 size = vtParams.xy * (vtCacheParams.x - 2.0 * vtCacheParams.y);
+    float lod = log2(max(length(dx * size), length(dy * size))) + vtParams.w;
+    int level = int(clamp(floor(lod), 0.0, vtParams.z - 1.0));
+    vec2 pages = max(vec2(1.0), floor(vtParams.xy / exp2(float(level))));
+    page = ivec2(min(floor(vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0)) * pages), pages - 1.0));
+    return level;
+}
+
+vec4 SampleVirtual(vec3 dir)
+{
+    vec2 dx, dy;
+    vec2 uv = PanoramaUV(dir, dx, dy);
+    ivec2 page;
+    int level = VirtualLevel(uv, dx, dy, page);
+    if (virtualFeedback)
+        return vec4(vec3(page, level), 255.0) / 255.0;
+    // The page (or the coarser one standing in for it) and the position inside it.
+    vec3 entry = floor(texelFetch(vtIndirection, page, level).xyz * 255.0 + 0.5);
+    vec2 residentPages = max(vec2(1.0), floor(vtParams.xy / exp2(entry.z)));
+    vec2 local = fract(vec2(uv.x, clamp(uv.y, 0.0, 0.99999)) * residentPages);
+    float content = vtCacheParams.x - 2.0 * vtCacheParams.y;
+    vec2 texel = entry.xy * vtCacheParams.x + vtCacheParams.y + local * content;
+    return textureLod(vtPageCache, texel / vtCacheParams.z, 0.0);
+}
 
 void main()
 {
+    if (fullscreen) {
+        vec4 farPoint = invViewProj * vec4(iClipPos.xy / iClipPos.w, 1.0, 1.0);
+        vec3 dir = farPoint.xyz / farPoint.w;
+        if (useVirtualTexture)
+            FragColor = SampleVirtual(dir);
+        else
+            FragColor = useCubeMap ? texture(cubeMap, dir) : SamplePanorama(dir);
+        return;
+    }
     // We create the uv coordinate from the top, so don't need to inverse.
     FragColor = texture2D(mapKd, vec2(iTexCoord.x, 1.0 - iTexCoord.y));
-}
+}
\ No newline at end of file
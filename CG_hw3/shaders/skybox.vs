@@ -4,13 +4,23 @@ layout (location = 0) in vec3 Position;
 layout (location = 1) in vec2 TexCoord;
 
 out vec2 iTexCoord;
+out vec4 iClipPos;
 
 uniform mat4 MVP;
+// Fullscreen mode: Position is already in clip space.
+uniform bool fullscreen;
 
 
 void main()
 {
+    if (fullscreen) {
+        gl_Position = vec4(Position, 1.0);
+        iClipPos = gl_Position;
+        iTexCoord = vec2(0.0);
+        return;
+    }
     gl_Position = MVP * vec4(Position, 1.0);
+    iClipPos = gl_Position;
     
     // Pass 
     iTexCoord = TexCoord;
@@ -0,0 +1,55 @@
+#include "assetloader.h"
+#include "modelloader.h"
+#include "texturemanager.h"
+
+// Suspend (a frame at a time) until texture has been uploaded or has failed.
+static Task<void> WaitUntilResident(ImageTexture* texture)
+{
+	while (!texture->IsResident() && !texture->IsFailed())
+		co_await ResumeOnMainThread();
+}
+
+Task<TriangleMesh*> LoadMesh(const std::string filePath, const int maxOccluderTriangles, const bool normalized)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	TriangleMesh* mesh = ModelLoader::NewMesh();
+	std::shared_ptr<ModelLoader::TexturePrefetch> prefetch = std::make_shared<ModelLoader::TexturePrefetch>();
+	prefetch->released = false;
+
+	co_await ResumeOnPool();
+	const bool succeeded = ModelLoader::BuildMesh(mesh, filePath, normalized, maxOccluderTriangles, prefetch);
+
+	co_await ResumeOnMainThread();
+	if (!succeeded) {
+		std::cerr << "[ERROR] Failed to load model: " << filePath << std::endl;
+		ModelLoader::ReleasePrefetched(*prefetch);
+		delete mesh;
+		co_return nullptr;
+	}
+	ModelLoader::FinishMesh(mesh);
+	ModelLoader::ReleasePrefetched(*prefetch);
+	// Every texture is requested by now and streams concurrently: waiting on each in turn
+	// takes as long as the slowest.
+	for (auto&& subMesh : mesh->GetsubMeshes()) {
+		if (subMesh.material != nullptr && subMesh.material->GetMapKd() != nullptr)
+			co_await WaitUntilResident(subMesh.material->GetMapKd());
+	}
+	mesh->MarkUsed();
+	auto endTime = std::chrono::high_resolution_clock::now();
+	std::cout << "Loaded " << filePath << " with its textures: "
+			  << std::chrono::duration<float, std::milli>(endTime - startTime).count() << " ms" << std::endl;
+	co_return mesh;
+}
+
+Task<ImageTexture*> LoadTexture(const std::string filePath, const TextureCompression compression)
+{
+	ImageTexture* texture = TextureManager::Instance().Acquire(filePath, true, compression);
+	if (texture == nullptr)
+		co_return nullptr;
+	co_await WaitUntilResident(texture);
+	if (texture->IsFailed()) {
+		TextureManager::Instance().Release(texture);
+		co_return nullptr;
+	}
+	co_return texture;
+}
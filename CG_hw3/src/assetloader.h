@@ -0,0 +1,25 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "headers.h"
+#include "asynctask.h"
+#include "trianglemesh.h"
+#include "imagetexture.h"
+
+// Asset loading coroutines: co_await them from a coroutine started on the GL thread (see
+// Task). The file and CPU work runs on the thread pool and the GL work back on the GL thread,
+// so a frame is never blocked; a chain of loads reads top to bottom.
+
+// A model, loaded by the steps of ModelLoader: the OBJ is parsed on the pool, each texture
+// requested as soon as its MTL library is read, then on the GL thread the buffers are
+// created. Completes once every texture is resident, so the model never shows the
+// placeholders. nullptr if the file cannot be read; owned by the caller.
+Task<TriangleMesh*> LoadMesh(const std::string filePath, const int maxOccluderTriangles,
+							const bool normalized = true);
+
+// A shared texture (TextureManager), once resident; nullptr if it cannot be loaded. The caller
+// releases it.
+Task<ImageTexture*> LoadTexture(const std::string filePath,
+								const TextureCompression compression = TEXTURE_UNCOMPRESSED);
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef ASYNC_TASK_H
+#define ASYNC_TASK_H
+
+#include "threadpool.h"
+#include <coroutine>
+#include <optional>
+#include <exception>
+
+// TaskPromiseBase Declarations.
+// What every Task promise shares: lazy start, and at the end, a jump to the awaiting coroutine
+// (or, for a detached task, freeing the frame).
+class TaskPromiseBase
+{
+public:
+	// TaskPromiseBase Public Methods.
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+			TaskPromiseBase& promise = handle.promise();
+			if (promise.continuation)
+				return promise.continuation;
+			if (promise.detached)
+				handle.destroy();
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	// Nothing here throws on purpose; treat it like a crash.
+	void unhandled_exception() { std::terminate(); }
+
+	// TaskPromiseBase Public Data.
+	std::coroutine_handle<> continuation;
+	bool detached = false;
+};
+
+// Task Declarations.
+// Result of a C++20 coroutine. Lazy: the body runs when the task is awaited (or detached).
+// The awaiting coroutine resumes with the result on the thread that finished the task;
+// co_await ResumeOnPool() / ResumeOnMainThread() move a coroutine between the workers and
+// the GL thread. Coroutine parameters are copied into the frame: pass strings by value, as a
+// reference would dangle after the first suspension.
+template <typename T>
+class Task
+{
+public:
+	// Task Public Methods.
+	struct promise_type : TaskPromiseBase
+	{
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_value(T result) { value = std::move(result); }
+
+		std::optional<T> value;
+	};
+
+	Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task() {
+		if (handle)
+			handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+		handle.promise().continuation = awaiter;
+		return handle;
+	}
+	T await_resume() { return std::move(*handle.promise().value); }
+
+	// Start without awaiting; the frame frees itself when the body ends (the result is dropped).
+	void Detach() {
+		std::coroutine_handle<promise_type> started = handle;
+		handle = nullptr;
+		started.promise().detached = true;
+		started.resume();
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	// Task Private Data.
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class Task<void>
+{
+public:
+	// Task Public Methods.
+	struct promise_type : TaskPromiseBase
+	{
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_void() {}
+	};
+
+	Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task() {
+		if (handle)
+			handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+		handle.promise().continuation = awaiter;
+		return handle;
+	}
+	void await_resume() const noexcept {}
+
+	void Detach() {
+		std::coroutine_handle<promise_type> started = handle;
+		handle = nullptr;
+		started.promise().detached = true;
+		started.resume();
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	// Task Private Data.
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Awaitable: continue on a pool worker (right away when the pool has no workers).
+struct ResumeOnPool
+{
+	bool await_ready() const noexcept { return ThreadPool::Instance().GetNumThreads() == 1; }
+	void await_suspend(std::coroutine_handle<> handle) const {
+		ThreadPool::Instance().Async([handle]() { handle.resume(); });
+	}
+	void await_resume() const noexcept {}
+};
+
+// Awaitable: continue on the GL thread, in its next ThreadPool::RunMainThreadTasks (once a
+// frame), so awaiting it in a loop polls once per frame.
+struct ResumeOnMainThread
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle) const {
+		ThreadPool::Instance().RunOnMainThread([handle]() { handle.resume(); });
+	}
+	void await_resume() const noexcept {}
+};
+
+#endif
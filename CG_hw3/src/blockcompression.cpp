@@ -0,0 +1,792 @@
+#include "blockcompression.h"
+#include "threadpool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+// DDS file layout (little endian), with the DX10 extension for BC7.
+struct DDSPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t rBitMask;
+	uint32_t gBitMask;
+	uint32_t bBitMask;
+	uint32_t aBitMask;
+};
+struct DDSHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	// [0] cache tag, [1] version, [2-3] source size, [4-5] source time; readers ignore these.
+	uint32_t reserved1[11];
+	DDSPixelFormat pixelFormat;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+struct DDSHeaderDX10
+{
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+static const uint32_t ddsMagic = 0x20534444;		// "DDS ".
+static const uint32_t ddsCacheTag = 0x48434342;	// "BCCH".
+static const uint32_t ddsCacheVersion = 1;
+
+static uint32_t MakeFourCC(const char* code)
+{
+	return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+// BC7 interpolation weights for 4-bit indices (out of 64).
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Texels are BGRA in a uint32; the encoders work on RGBA floats.
+static inline void UnpackRGBA(const uint32_t texel, float rgba[4])
+{
+	rgba[0] = (float)((texel >> 16) & 0xff);
+	rgba[1] = (float)((texel >> 8) & 0xff);
+	rgba[2] = (float)(texel & 0xff);
+	rgba[3] = (float)(texel >> 24);
+}
+
+static inline uint32_t PackBGRA(const int r, const int g, const int b, const int a)
+{
+	return (uint32_t)b | ((uint32_t)g << 8) | ((uint32_t)r << 16) | ((uint32_t)a << 24);
+}
+
+static inline float Clamp255(const float v)
+{
+	return std::min(255.0f, std::max(0.0f, v));
+}
+
+// Mean and dominant direction (power iteration on the covariance) of 16 points.
+static void PrincipalAxis(const float points[16][4], const int dims, float mean[4], float axis[4])
+{
+	for (int c = 0; c < 4; ++c)
+		mean[c] = 0.0f;
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < dims; ++c)
+			mean[c] += points[i][c] / 16.0f;
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; ++i) {
+		for (int a = 0; a < dims; ++a)
+			for (int b = 0; b < dims; ++b)
+				cov[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+	}
+	// Start from the widest channel range, which is close to the answer for most blocks.
+	for (int c = 0; c < 4; ++c)
+		axis[c] = c < dims ? 1.0f : 0.0f;
+	for (int iter = 0; iter < 8; ++iter) {
+		float next[4] = {};
+		float length = 0.0f;
+		for (int a = 0; a < dims; ++a) {
+			for (int b = 0; b < dims; ++b)
+				next[a] += cov[a][b] * axis[b];
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f)
+			break;
+		length = 1.0f / std::sqrt(length);
+		for (int a = 0; a < dims; ++a)
+			axis[a] = next[a] * length;
+	}
+}
+
+// End points of the principal axis over the block.
+static void AxisEndpoints(const float points[16][4], const int dims, float e0[4], float e1[4])
+{
+	float mean[4], axis[4];
+	PrincipalAxis(points, dims, mean, axis);
+	float tMin = 0.0f, tMax = 0.0f;
+	for (int i = 0; i < 16; ++i) {
+		float t = 0.0f;
+		for (int c = 0; c < dims; ++c)
+			t += (points[i][c] - mean[c]) * axis[c];
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+	for (int c = 0; c < 4; ++c) {
+		e0[c] = c < dims ? Clamp255(mean[c] + tMin * axis[c]) : 255.0f;
+		e1[c] = c < dims ? Clamp255(mean[c] + tMax * axis[c]) : 255.0f;
+	}
+}
+
+// Least-squares end points for fixed interpolation weights (weight of e1 per texel, in [0, 1]).
+// Returns false if the weights do not determine both end points.
+static bool FitEndpoints(const float points[16][4], const int dims, const float weights[16], float e0[4], float e1[4])
+{
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; ++i) {
+		const float b = weights[i];
+		const float a = 1.0f - b;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int c = 0; c < dims; ++c) {
+			ax[c] += a * points[i][c];
+			bx[c] += b * points[i][c];
+		}
+	}
+	const float det = aa * bb - ab * ab;
+	if (std::fabs(det) < 1e-6f)
+		return false;
+	for (int c = 0; c < dims; ++c) {
+		e0[c] = Clamp255((bb * ax[c] - ab * bx[c]) / det);
+		e1[c] = Clamp255((aa * bx[c] - ab * ax[c]) / det);
+	}
+	return true;
+}
+
+static inline uint16_t Pack565(const float rgb[4])
+{
+	const int r = (int)(rgb[0] * 31.0f / 255.0f + 0.5f);
+	const int g = (int)(rgb[1] * 63.0f / 255.0f + 0.5f);
+	const int b = (int)(rgb[2] * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void Unpack565(const uint16_t c, int rgb[3])
+{
+	const int r = (c >> 11) & 31;
+	const int g = (c >> 5) & 63;
+	const int b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Four-color BC1 palette of two 565 end points.
+static void BC1Palette(const uint16_t c0, const uint16_t c1, int palette[4][3])
+{
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+// Nearest palette entry per texel; returns the total squared error.
+static int BC1Indices(const float points[16][4], const uint16_t c0, const uint16_t c1, int indices[16])
+{
+	int palette[4][3];
+	BC1Palette(c0, c1, palette);
+	int total = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0, bestError = INT32_MAX;
+		for (int p = 0; p < 4; ++p) {
+			int error = 0;
+			for (int c = 0; c < 3; ++c) {
+				const int d = (int)points[i][c] - palette[p][c];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		indices[i] = best;
+		total += bestError;
+	}
+	return total;
+}
+
+// BC7 end point with a shared p-bit: 7-bit values plus the p-bit giving the lowest error.
+static void QuantizeBC7Endpoint(const float e[4], int q[4], int& pBit)
+{
+	int bestError = INT32_MAX;
+	for (int p = 0; p < 2; ++p) {
+		int error = 0;
+		int candidate[4];
+		for (int c = 0; c < 4; ++c) {
+			candidate[c] = std::min(127, std::max(0, (int)std::floor((e[c] - (float)p) * 0.5f + 0.5f)));
+			const int d = ((candidate[c] << 1) | p) - (int)(e[c] + 0.5f);
+			error += d * d;
+		}
+		if (error < bestError) {
+			bestError = error;
+			pBit = p;
+			for (int c = 0; c < 4; ++c)
+				q[c] = candidate[c];
+		}
+	}
+}
+
+static int BC7Indices(const float points[16][4], const int q0[4], const int p0, const int q1[4], const int p1, int indices[16])
+{
+	int palette[16][4];
+	for (int c = 0; c < 4; ++c) {
+		const int v0 = (q0[c] << 1) | p0;
+		const int v1 = (q1[c] << 1) | p1;
+		for (int i = 0; i < 16; ++i)
+			palette[i][c] = ((64 - bc7Weights4[i]) * v0 + bc7Weights4[i] * v1 + 32) >> 6;
+	}
+	int total = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0, bestError = INT32_MAX;
+		for (int p = 0; p < 16; ++p) {
+			int error = 0;
+			for (int c = 0; c < 4; ++c) {
+				const int d = (int)points[i][c] - palette[p][c];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		indices[i] = best;
+		total += bestError;
+	}
+	return total;
+}
+
+// Little-endian bit stream over a 16-byte block.
+struct BlockBits
+{
+	uint8_t* data;
+	int position;
+
+	void Write(const uint32_t value, const int numBits) {
+		for (int i = 0; i < numBits; ++i, ++position)
+			if ((value >> i) & 1)
+				data[position >> 3] |= (uint8_t)(1 << (position & 7));
+	}
+	uint32_t Read(const int numBits) {
+		uint32_t value = 0;
+		for (int i = 0; i < numBits; ++i, ++position)
+			value |= (uint32_t)((data[position >> 3] >> (position & 7)) & 1) << i;
+		return value;
+	}
+};
+
+BlockCompressedImage::BlockCompressedImage()
+{
+	format = BLOCK_BC1;
+	width = 0;
+	height = 0;
+	lastEncodeTimeMs = 0.0f;
+}
+
+BlockCompressedImage::~BlockCompressedImage()
+{
+	levels.clear();
+}
+
+const char* BlockCompressedImage::GetFormatName(const BlockFormat format)
+{
+	switch (format) {
+	case BLOCK_BC1:
+		return "BC1";
+	case BLOCK_BC3:
+		return "BC3";
+	default:
+		return "BC7";
+	}
+}
+
+size_t BlockCompressedImage::GetBlockRowBytes(const int level) const
+{
+	return (size_t)((GetLevelWidth(level) + 3) / 4) * GetBlockBytes(format);
+}
+
+size_t BlockCompressedImage::GetTotalBytes() const
+{
+	size_t total = 0;
+	for (auto&& level : levels)
+		total += level.size();
+	return total;
+}
+
+void BlockCompressedImage::Encode(const unsigned char* pixels, const int w, const int h, const int channels,
+								const size_t rowStride, const BlockFormat newFormat, const int maxLevels)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	format = newFormat;
+	width = w;
+	height = h;
+	levels.clear();
+
+	std::vector<uint32_t> texels((size_t)w * h);
+	for (int y = 0; y < h; ++y) {
+		const unsigned char* src = pixels + y * rowStride;
+		for (int x = 0; x < w; ++x, src += channels) {
+			const int b = src[0];
+			const int g = channels >= 3 ? src[1] : src[0];
+			const int r = channels >= 3 ? src[2] : src[0];
+			const int a = channels == 4 ? src[3] : 255;
+			texels[(size_t)y * w + x] = PackBGRA(r, g, b, a);
+		}
+	}
+
+	int levelWidth = w;
+	int levelHeight = h;
+	while (true) {
+		levels.emplace_back();
+		EncodeLevel(texels, levelWidth, levelHeight, levels.back());
+		if ((levelWidth == 1 && levelHeight == 1) || (int)levels.size() == maxLevels)
+			break;
+		// 2x2 box filter (edge texels repeat for odd sizes).
+		const int nextWidth = std::max(1, levelWidth / 2);
+		const int nextHeight = std::max(1, levelHeight / 2);
+		std::vector<uint32_t> next((size_t)nextWidth * nextHeight);
+		ThreadPool::Instance().ParallelFor(0, nextHeight, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y) {
+				const int y0 = std::min(2 * y, levelHeight - 1);
+				const int y1 = std::min(2 * y + 1, levelHeight - 1);
+				for (int x = 0; x < nextWidth; ++x) {
+					const int x0 = std::min(2 * x, levelWidth - 1);
+					const int x1 = std::min(2 * x + 1, levelWidth - 1);
+					const uint32_t t[4] = {
+						texels[(size_t)y0 * levelWidth + x0], texels[(size_t)y0 * levelWidth + x1],
+						texels[(size_t)y1 * levelWidth + x0], texels[(size_t)y1 * levelWidth + x1]
+					};
+					uint32_t result = 0;
+					for (int shift = 0; shift < 32; shift += 8) {
+						uint32_t sum = 2;
+						for (int i = 0; i < 4; ++i)
+							sum += (t[i] >> shift) & 0xff;
+						result |= (sum / 4) << shift;
+					}
+					next[(size_t)y * nextWidth + x] = result;
+				}
+			}
+		}, 16);
+		texels.swap(next);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	lastEncodeTimeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+void BlockCompressedImage::EncodeLevel(const std::vector<uint32_t>& texels, const int levelWidth, const int levelHeight,
+									std::vector<uint8_t>& blocks) const
+{
+	const int blocksX = (levelWidth + 3) / 4;
+	const int blocksY = (levelHeight + 3) / 4;
+	const int blockBytes = GetBlockBytes(format);
+	blocks.assign((size_t)blocksX * blocksY * blockBytes, 0);
+
+	ThreadPool::Instance().ParallelFor(0, blocksY, [&](int begin, int end) {
+		uint32_t block[16];
+		for (int by = begin; by < end; ++by) {
+			for (int bx = 0; bx < blocksX; ++bx) {
+				// Partial blocks at the right and top edges repeat the last texel.
+				for (int y = 0; y < 4; ++y) {
+					const int sy = std::min(by * 4 + y, levelHeight - 1);
+					for (int x = 0; x < 4; ++x) {
+						const int sx = std::min(bx * 4 + x, levelWidth - 1);
+						block[y * 4 + x] = texels[(size_t)sy * levelWidth + sx];
+					}
+				}
+				uint8_t* out = &blocks[((size_t)by * blocksX + bx) * blockBytes];
+				switch (format) {
+				case BLOCK_BC1:
+					EncodeBC1(block, out);
+					break;
+				case BLOCK_BC3:
+					EncodeAlpha(block, out);
+					EncodeBC1(block, out + 8);
+					break;
+				case BLOCK_BC7:
+					EncodeBC7(block, out);
+					break;
+				}
+			}
+		}
+	}, 4);
+}
+
+void BlockCompressedImage::EncodeBC1(const uint32_t texels[16], uint8_t* out)
+{
+	float points[16][4];
+	for (int i = 0; i < 16; ++i)
+		UnpackRGBA(texels[i], points[i]);
+
+	float e0[4], e1[4];
+	AxisEndpoints(points, 3, e0, e1);
+	uint16_t c0 = Pack565(e1);
+	uint16_t c1 = Pack565(e0);
+	int indices[16];
+	int error = BC1Indices(points, c0, c1, indices);
+
+	// One least-squares refinement of the end points for the chosen indices.
+	const float paletteWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float weights[16];
+	for (int i = 0; i < 16; ++i)
+		weights[i] = paletteWeights[indices[i]];
+	if (error > 0 && FitEndpoints(points, 3, weights, e0, e1)) {
+		const uint16_t r0 = Pack565(e0);
+		const uint16_t r1 = Pack565(e1);
+		int refined[16];
+		const int refinedError = BC1Indices(points, r0, r1, refined);
+		if (refinedError < error) {
+			c0 = r0;
+			c1 = r1;
+			error = refinedError;
+			std::memcpy(indices, refined, sizeof(indices));
+		}
+	}
+
+	// Four-color mode needs c0 > c1; swapping the end points swaps index pairs (0,1) and (2,3).
+	if (c0 < c1) {
+		std::swap(c0, c1);
+		for (int i = 0; i < 16; ++i)
+			indices[i] ^= 1;
+	}
+	else if (c0 == c1) {
+		for (int i = 0; i < 16; ++i)
+			indices[i] = 0;
+	}
+	out[0] = (uint8_t)(c0 & 0xff);
+	out[1] = (uint8_t)(c0 >> 8);
+	out[2] = (uint8_t)(c1 & 0xff);
+	out[3] = (uint8_t)(c1 >> 8);
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (uint32_t)indices[i] << (2 * i);
+	std::memcpy(out + 4, &bits, 4);
+}
+
+void BlockCompressedImage::EncodeAlpha(const uint32_t texels[16], uint8_t* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		const int a = (int)(texels[i] >> 24);
+		a0 = std::max(a0, a);
+		a1 = std::min(a1, a);
+	}
+	// Eight-value mode (a0 > a1); a constant block uses index 0 only.
+	int palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	for (int i = 2; i < 8; ++i)
+		palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; ++i) {
+		const int a = (int)(texels[i] >> 24);
+		int best = 0;
+		if (a0 != a1) {
+			for (int p = 1; p < 8; ++p)
+				if (std::abs(palette[p] - a) < std::abs(palette[best] - a))
+					best = p;
+		}
+		bits |= (uint64_t)best << (3 * i);
+	}
+	out[0] = (uint8_t)a0;
+	out[1] = (uint8_t)a1;
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+void BlockCompressedImage::EncodeBC7(const uint32_t texels[16], uint8_t* out)
+{
+	float points[16][4];
+	for (int i = 0; i < 16; ++i)
+		UnpackRGBA(texels[i], points[i]);
+
+	float e0[4], e1[4];
+	AxisEndpoints(points, 4, e0, e1);
+	int q0[4], q1[4], p0 = 0, p1 = 0;
+	QuantizeBC7Endpoint(e0, q0, p0);
+	QuantizeBC7Endpoint(e1, q1, p1);
+	int indices[16];
+	int error = BC7Indices(points, q0, p0, q1, p1, indices);
+
+	float weights[16];
+	for (int i = 0; i < 16; ++i)
+		weights[i] = (float)bc7Weights4[indices[i]] / 64.0f;
+	if (error > 0 && FitEndpoints(points, 4, weights, e0, e1)) {
+		int r0[4], r1[4], rp0 = 0, rp1 = 0;
+		QuantizeBC7Endpoint(e0, r0, rp0);
+		QuantizeBC7Endpoint(e1, r1, rp1);
+		int refined[16];
+		const int refinedError = BC7Indices(points, r0, rp0, r1, rp1, refined);
+		if (refinedError < error) {
+			std::memcpy(q0, r0, sizeof(q0));
+			std::memcpy(q1, r1, sizeof(q1));
+			p0 = rp0;
+			p1 = rp1;
+			std::memcpy(indices, refined, sizeof(indices));
+		}
+	}
+
+	// The first index is stored with 3 bits: its top bit must be 0. The weights are symmetric,
+	// so swapping the end points and mirroring the indices gives the same colors.
+	if (indices[0] & 8) {
+		for (int c = 0; c < 4; ++c)
+			std::swap(q0[c], q1[c]);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	std::memset(out, 0, 16);
+	BlockBits bits = { out, 0 };
+	bits.Write(1 << 6, 7);	// Mode 6.
+	for (int c = 0; c < 4; ++c) {
+		bits.Write((uint32_t)q0[c], 7);
+		bits.Write((uint32_t)q1[c], 7);
+	}
+	bits.Write((uint32_t)p0, 1);
+	bits.Write((uint32_t)p1, 1);
+	bits.Write((uint32_t)indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		bits.Write((uint32_t)indices[i], 4);
+}
+
+void BlockCompressedImage::DecodeBC1(const uint8_t* in, uint32_t texels[16], const bool forceFourColors)
+{
+	const uint16_t c0 = (uint16_t)(in[0] | (in[1] << 8));
+	const uint16_t c1 = (uint16_t)(in[2] | (in[3] << 8));
+	int palette[4][3];
+	BC1Palette(c0, c1, palette);
+	int alpha[4] = { 255, 255, 255, 255 };
+	if (!forceFourColors && c0 <= c1) {
+		// Three colors plus transparent black.
+		for (int c = 0; c < 3; ++c) {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+		alpha[3] = 0;
+	}
+	uint32_t bits;
+	std::memcpy(&bits, in + 4, 4);
+	for (int i = 0; i < 16; ++i) {
+		const int index = (bits >> (2 * i)) & 3;
+		texels[i] = PackBGRA(palette[index][0], palette[index][1], palette[index][2], alpha[index]);
+	}
+}
+
+void BlockCompressedImage::DecodeAlpha(const uint8_t* in, uint32_t texels[16])
+{
+	const int a0 = in[0];
+	const int a1 = in[1];
+	int palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	}
+	else {
+		for (int i = 2; i < 6; ++i)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; ++i)
+		bits |= (uint64_t)in[2 + i] << (8 * i);
+	for (int i = 0; i < 16; ++i) {
+		const int index = (int)((bits >> (3 * i)) & 7);
+		texels[i] = (texels[i] & 0x00ffffffu) | ((uint32_t)palette[index] << 24);
+	}
+}
+
+void BlockCompressedImage::DecodeBC7(const uint8_t* in, uint32_t texels[16])
+{
+	BlockBits bits = { const_cast<uint8_t*>(in), 0 };
+	if (bits.Read(7) != (1 << 6)) {
+		// Only mode 6 is ever written by the encoder.
+		for (int i = 0; i < 16; ++i)
+			texels[i] = 0;
+		return;
+	}
+	int q0[4], q1[4];
+	for (int c = 0; c < 4; ++c) {
+		q0[c] = (int)bits.Read(7);
+		q1[c] = (int)bits.Read(7);
+	}
+	const int p0 = (int)bits.Read(1);
+	const int p1 = (int)bits.Read(1);
+	for (int i = 0; i < 16; ++i) {
+		const int index = (int)bits.Read(i == 0 ? 3 : 4);
+		int value[4];
+		for (int c = 0; c < 4; ++c) {
+			const int v0 = (q0[c] << 1) | p0;
+			const int v1 = (q1[c] << 1) | p1;
+			value[c] = ((64 - bc7Weights4[index]) * v0 + bc7Weights4[index] * v1 + 32) >> 6;
+		}
+		texels[i] = PackBGRA(value[0], value[1], value[2], value[3]);
+	}
+}
+
+void BlockCompressedImage::DecodeLevel(const int level, std::vector<uint32_t>& texels) const
+{
+	DecodeBlocks(levels[level].data(), GetLevelWidth(level), GetLevelHeight(level), format, texels);
+}
+
+void BlockCompressedImage::DecodeBlocks(const uint8_t* blocks, const int levelWidth, const int levelHeight,
+										const BlockFormat format, std::vector<uint32_t>& texels)
+{
+	const int blocksX = (levelWidth + 3) / 4;
+	const int blocksY = (levelHeight + 3) / 4;
+	const int blockBytes = GetBlockBytes(format);
+	texels.resize((size_t)levelWidth * levelHeight);
+
+	ThreadPool::Instance().ParallelFor(0, blocksY, [&](int begin, int end) {
+		uint32_t block[16];
+		for (int by = begin; by < end; ++by) {
+			for (int bx = 0; bx < blocksX; ++bx) {
+				const uint8_t* in = &blocks[((size_t)by * blocksX + bx) * blockBytes];
+				switch (format) {
+				case BLOCK_BC1:
+					DecodeBC1(in, block, false);
+					break;
+				case BLOCK_BC3:
+					DecodeBC1(in + 8, block, true);
+					DecodeAlpha(in, block);
+					break;
+				case BLOCK_BC7:
+					DecodeBC7(in, block);
+					break;
+				}
+				for (int y = 0; y < 4 && by * 4 + y < levelHeight; ++y)
+					for (int x = 0; x < 4 && bx * 4 + x < levelWidth; ++x)
+						texels[(size_t)(by * 4 + y) * levelWidth + bx * 4 + x] = block[y * 4 + x];
+			}
+		}
+	}, 4);
+}
+
+float BlockCompressedImage::ComputePSNR(const unsigned char* pixels, const int channels, const size_t rowStride) const
+{
+	if (levels.empty())
+		return 0.0f;
+	std::vector<uint32_t> decoded;
+	DecodeLevel(0, decoded);
+
+	const int numCompared = channels == 4 ? 4 : 3;
+	double squaredError = 0.0;
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* src = pixels + y * rowStride;
+		for (int x = 0; x < width; ++x, src += channels) {
+			const uint32_t texel = decoded[(size_t)y * width + x];
+			for (int c = 0; c < numCompared; ++c) {
+				// Gray sources were expanded to BGR.
+				const int original = src[channels == 1 ? 0 : c];
+				const int d = original - (int)((texel >> (8 * c)) & 0xff);
+				squaredError += (double)(d * d);
+			}
+		}
+	}
+	const double mse = squaredError / ((double)width * height * numCompared);
+	if (mse <= 0.0)
+		return 100.0f;
+	return (float)(10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+bool BlockCompressedImage::LoadDDS(const std::string& ddsPath, const std::string& sourceFile, const BlockFormat expectedFormat)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(ddsPath, ec))
+		return false;
+	std::ifstream in(ddsPath, std::ios::binary);
+	uint32_t magic = 0;
+	DDSHeader header;
+	if (!in.read((char*)&magic, sizeof(magic)) || !in.read((char*)&header, sizeof(header)) || magic != ddsMagic)
+		return false;
+
+	const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(sourceFile, ec);
+	const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+	uint64_t cachedSize, cachedTime;
+	std::memcpy(&cachedSize, &header.reserved1[2], sizeof(cachedSize));
+	std::memcpy(&cachedTime, &header.reserved1[4], sizeof(cachedTime));
+	if (header.reserved1[0] != ddsCacheTag || header.reserved1[1] != ddsCacheVersion
+		|| cachedSize != sourceSize || (int64_t)cachedTime != sourceTime)
+		return false;
+
+	BlockFormat fileFormat;
+	if (header.pixelFormat.fourCC == MakeFourCC("DXT1"))
+		fileFormat = BLOCK_BC1;
+	else if (header.pixelFormat.fourCC == MakeFourCC("DXT5"))
+		fileFormat = BLOCK_BC3;
+	else if (header.pixelFormat.fourCC == MakeFourCC("DX10")) {
+		DDSHeaderDX10 dx10;
+		if (!in.read((char*)&dx10, sizeof(dx10)) || dx10.dxgiFormat != 98)	// DXGI_FORMAT_BC7_UNORM.
+			return false;
+		fileFormat = BLOCK_BC7;
+	}
+	else
+		return false;
+	if (fileFormat != expectedFormat)
+		return false;
+
+	format = fileFormat;
+	width = (int)header.width;
+	height = (int)header.height;
+	levels.assign(std::max(1u, header.mipMapCount), std::vector<uint8_t>());
+	for (int level = 0; level < (int)levels.size(); ++level) {
+		const size_t numBlockRows = (size_t)(GetLevelHeight(level) + 3) / 4;
+		levels[level].resize(numBlockRows * GetBlockRowBytes(level));
+		if (!in.read((char*)levels[level].data(), levels[level].size())) {
+			std::cerr << "[ERROR] Truncated texture cache: " << ddsPath << std::endl;
+			levels.clear();
+			return false;
+		}
+	}
+	lastEncodeTimeMs = 0.0f;
+	return true;
+}
+
+bool BlockCompressedImage::SaveDDS(const std::string& ddsPath, const std::string& sourceFile) const
+{
+	std::error_code ec;
+	DDSHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.size = sizeof(DDSHeader);
+	// CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE.
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+	header.height = (uint32_t)height;
+	header.width = (uint32_t)width;
+	header.pitchOrLinearSize = levels.empty() ? 0 : (uint32_t)levels[0].size();
+	header.mipMapCount = (uint32_t)levels.size();
+	const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(sourceFile, ec);
+	const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+	header.reserved1[0] = ddsCacheTag;
+	header.reserved1[1] = ddsCacheVersion;
+	std::memcpy(&header.reserved1[2], &sourceSize, sizeof(sourceSize));
+	std::memcpy(&header.reserved1[4], &sourceTime, sizeof(sourceTime));
+	header.pixelFormat.size = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags = 0x4;	// FOURCC.
+	header.pixelFormat.fourCC = MakeFourCC(format == BLOCK_BC1 ? "DXT1" : (format == BLOCK_BC3 ? "DXT5" : "DX10"));
+	header.caps = 0x1000 | 0x8 | 0x400000;	// TEXTURE | COMPLEX | MIPMAP.
+
+	std::ofstream out(ddsPath, std::ios::binary);
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write texture cache: " << ddsPath << std::endl;
+		return false;
+	}
+	out.write((const char*)&ddsMagic, sizeof(ddsMagic));
+	out.write((const char*)&header, sizeof(header));
+	if (format == BLOCK_BC7) {
+		// DXGI_FORMAT_BC7_UNORM, TEXTURE2D, one layer.
+		const DDSHeaderDX10 dx10 = { 98, 3, 0, 1, 0 };
+		out.write((const char*)&dx10, sizeof(dx10));
+	}
+	for (auto&& level : levels)
+		out.write((const char*)level.data(), level.size());
+	return (bool)out;
+}
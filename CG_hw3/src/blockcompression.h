@@ -0,0 +1,83 @@
+#ifndef BLOCKCOMPRESSION_H
+#define BLOCKCOMPRESSION_H
+
+// No GL or window-system headers: this module runs headless.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+// Block-compressed formats produced by the encoder (4x4 texel blocks).
+enum BlockFormat
+{
+	// 565 endpoints, 2-bit indices; 8 bytes per block, opaque.
+	BLOCK_BC1 = 0,
+	// BC1 color plus an interpolated 8-bit alpha block; 16 bytes per block.
+	BLOCK_BC3,
+	// BC7 mode 6 only (one RGBA subset, 7.7.7.7 + p-bit endpoints, 4-bit indices); 16 bytes per block.
+	BLOCK_BC7
+};
+
+// BlockCompressedImage Declarations.
+// A block-compressed mip chain encoded on the CPU, over the 4x4 blocks in parallel.
+// Levels are stored bottom row first (GL order), ready for glCompressedTexImage2D, and can be
+// cached as DDS files next to the source image.
+class BlockCompressedImage
+{
+public:
+	// BlockCompressedImage Public Methods.
+	BlockCompressedImage();
+	~BlockCompressedImage();
+
+	// Encode a BGR(A) 8-bit image, bottom row first, and its box-filtered mip chain
+	// (at most maxLevels levels; 0 for the full chain).
+	void Encode(const unsigned char* pixels, const int width, const int height, const int channels,
+				const size_t rowStride, const BlockFormat format, const int maxLevels = 0);
+	// Decode one level to BGRA texels (levelWidth * levelHeight).
+	void DecodeLevel(const int level, std::vector<uint32_t>& texels) const;
+	// Decode blocks stored like a level (rows of blocks, bottom first) to BGRA texels.
+	static void DecodeBlocks(const uint8_t* blocks, const int width, const int height, const BlockFormat format,
+							std::vector<uint32_t>& texels);
+	// PSNR of level 0 against the source over BGR (and A if the source has alpha), in dB.
+	float ComputePSNR(const unsigned char* pixels, const int channels, const size_t rowStride) const;
+
+	// DDS with the mip chain; the source file's size and time are kept to detect edits.
+	bool LoadDDS(const std::string& ddsPath, const std::string& sourceFile, const BlockFormat expectedFormat);
+	bool SaveDDS(const std::string& ddsPath, const std::string& sourceFile) const;
+
+	BlockFormat GetFormat() const { return format; }
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	int GetNumLevels() const { return (int)levels.size(); }
+	int GetLevelWidth(const int level) const { return std::max(1, width >> level); }
+	int GetLevelHeight(const int level) const { return std::max(1, height >> level); }
+	const std::vector<uint8_t>& GetLevel(const int level) const { return levels[level]; }
+	// Bytes of one row of blocks in a level.
+	size_t GetBlockRowBytes(const int level) const;
+	size_t GetTotalBytes() const;
+	float GetLastEncodeTimeMs() const { return lastEncodeTimeMs; }
+
+	static int GetBlockBytes(const BlockFormat format) { return format == BLOCK_BC1 ? 8 : 16; }
+	static const char* GetFormatName(const BlockFormat format);
+
+private:
+	// BlockCompressedImage Private Methods.
+	void EncodeLevel(const std::vector<uint32_t>& texels, const int levelWidth, const int levelHeight,
+					std::vector<uint8_t>& blocks) const;
+	// Block encoders/decoders; texels are BGRA, row-major within the block.
+	static void EncodeBC1(const uint32_t texels[16], uint8_t* out);
+	static void EncodeAlpha(const uint32_t texels[16], uint8_t* out);
+	static void EncodeBC7(const uint32_t texels[16], uint8_t* out);
+	static void DecodeBC1(const uint8_t* in, uint32_t texels[16], const bool forceFourColors);
+	static void DecodeAlpha(const uint8_t* in, uint32_t texels[16]);
+	static void DecodeBC7(const uint8_t* in, uint32_t texels[16]);
+
+	// BlockCompressedImage Private Data.
+	BlockFormat format;
+	int width;
+	int height;
+	std::vector<std::vector<uint8_t>> levels;
+	float lastEncodeTimeMs;
+};
+
+#endif
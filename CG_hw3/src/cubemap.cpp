@@ -0,0 +1,465 @@
+#include "cubemap.h"
+#include "threadpool.h"
+
+#include <mutex>
+#include <emmintrin.h>
+
+// Layout of the *.cubemap cache files.
+struct CubeMapCacheHeader
+{
+	char magic[4];			// "CUBE".
+	uint32_t version;
+	uint64_t sourceSize;	// The panorama the faces came from, to detect edits.
+	int64_t sourceTime;
+	int32_t faceSize;
+	int32_t numLevels;
+};
+static const uint32_t cubeMapCacheVersion = 1;
+
+static inline __m128 UnpackTexel(const uint32_t texel)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i p = _mm_cvtsi32_si128((int)texel);
+	p = _mm_unpacklo_epi8(p, zero);
+	p = _mm_unpacklo_epi16(p, zero);
+	return _mm_cvtepi32_ps(p);
+}
+
+static inline uint32_t PackTexel(const __m128 color)
+{
+	__m128i p = _mm_cvtps_epi32(color);
+	p = _mm_packs_epi32(p, p);
+	p = _mm_packus_epi16(p, p);
+	return (uint32_t)_mm_cvtsi128_si32(p);
+}
+
+CubeMap::CubeMap()
+{
+	textureObj = 0;
+	faceSize = 0;
+	numLevels = 0;
+	fromCache = false;
+	lastBuildTimeMs = 0.0f;
+}
+
+CubeMap::~CubeMap()
+{
+	glDeleteTextures(1, &textureObj);
+	levels.clear();
+}
+
+glm::vec3 CubeMap::FaceDirection(const int face, const float s, const float t)
+{
+	const float sc = 2.0f * s - 1.0f;
+	const float tc = 2.0f * t - 1.0f;
+	switch (face) {
+	case 0:  return glm::vec3( 1.0f, -tc, -sc);
+	case 1:  return glm::vec3(-1.0f, -tc,  sc);
+	case 2:  return glm::vec3( sc,  1.0f,  tc);
+	case 3:  return glm::vec3( sc, -1.0f, -tc);
+	case 4:  return glm::vec3( sc, -tc,  1.0f);
+	default: return glm::vec3(-sc, -tc, -1.0f);
+	}
+}
+
+glm::vec2 CubeMap::PanoramaUV(const glm::vec3& dir)
+{
+	const glm::vec3 d = glm::normalize(dir);
+	float u = std::atan2(d.z, d.x) / (2.0f * glm::pi<float>());
+	if (u < 0.0f)
+		u += 1.0f;
+	const float v = 0.5f + std::asin(std::min(1.0f, std::max(-1.0f, d.y))) / glm::pi<float>();
+	return glm::vec2(u, v);
+}
+
+bool CubeMap::CreateFromPanorama(const ImageTexture* panorama, const int size)
+{
+	return CreateFromPanorama(panorama->GetImage(), panorama->GetPath(), size);
+}
+
+bool CubeMap::CreateFromPanorama(const cv::Mat& image, const std::string& sourceFile, const int size)
+{
+	if (image.empty())
+		return false;
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	faceSize = size;
+	if (faceSize <= 0) {
+		faceSize = 1;
+		while (faceSize * 2 <= image.cols / 4)
+			faceSize *= 2;
+	}
+	numLevels = 1;
+	while ((faceSize >> numLevels) > 0)
+		numLevels++;
+
+	sourcePath = sourceFile;
+	const std::string cachePath = sourceFile + ".cubemap";
+	fromCache = LoadCache(cachePath, sourceFile);
+	if (!fromCache) {
+		Convert(image);
+		BuildMipChain();
+		SaveCache(cachePath, sourceFile);
+	}
+	Upload();
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	lastBuildTimeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+	std::cout << "Cube map " << faceSize << "x" << faceSize << " (" << numLevels << " levels) "
+			  << (fromCache ? "loaded from cache" : "converted") << " in " << lastBuildTimeMs << " ms" << std::endl;
+	return true;
+}
+
+bool CubeMap::CreatePrefilteredGGX(const CubeMap* source, const int size, const int numSamples,
+								const CubeMapProgressCallback& progress, const bool useCache)
+{
+	if (source == nullptr || source->levels.empty())
+		return false;
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	faceSize = std::max(1, size);
+	numLevels = 1;
+	while ((faceSize >> numLevels) > 0)
+		numLevels++;
+	sourcePath = source->GetSourcePath();
+
+	const std::string cachePath = sourcePath + ".specular" + std::to_string(numSamples);
+	fromCache = useCache && LoadCache(cachePath, sourcePath);
+	if (!fromCache) {
+		PrefilterGGX(source, numSamples, progress);
+		if (useCache)
+			SaveCache(cachePath, sourcePath);
+	}
+	Upload();
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	lastBuildTimeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+	std::cout << "Specular map " << faceSize << "x" << faceSize << " (" << numLevels << " roughness levels) "
+			  << (fromCache ? "loaded from cache" : "prefiltered") << " in " << lastBuildTimeMs << " ms" << std::endl;
+	return true;
+}
+
+void CubeMap::Convert(const cv::Mat& image)
+{
+	// Expand the panorama to BGRA so every tap below is a single 32-bit load.
+	const int width = image.cols;
+	const int height = image.rows;
+	const int channels = image.channels();
+	std::vector<uint32_t> source((size_t)width * height);
+	ThreadPool::Instance().ParallelFor(0, height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const unsigned char* src = image.ptr<unsigned char>(y);
+			uint32_t* dst = &source[(size_t)y * width];
+			for (int x = 0; x < width; ++x, src += channels) {
+				uint32_t b = src[0];
+				uint32_t g = channels >= 3 ? src[1] : src[0];
+				uint32_t r = channels >= 3 ? src[2] : src[0];
+				uint32_t a = channels == 4 ? src[3] : 255;
+				dst[x] = b | (g << 8) | (r << 16) | (a << 24);
+			}
+		}
+	}, 16);
+
+	// Level 0: every face split into tiles, each tile resampled on one worker.
+	const int tileSize = std::min(32, faceSize);
+	const int tilesPerRow = (faceSize + tileSize - 1) / tileSize;
+	const int tilesPerFace = tilesPerRow * tilesPerRow;
+	levels.assign(numLevels, std::vector<uint32_t>());
+	levels[0].resize((size_t)6 * faceSize * faceSize);
+	ThreadPool::Instance().ParallelFor(0, 6 * tilesPerFace, [&](int begin, int end) {
+		for (int tile = begin; tile < end; ++tile) {
+			const int face = tile / tilesPerFace;
+			const int tx = (tile % tilesPerFace) % tilesPerRow;
+			const int ty = (tile % tilesPerFace) / tilesPerRow;
+			uint32_t* faceData = &levels[0][(size_t)face * faceSize * faceSize];
+			for (int y = ty * tileSize; y < std::min(faceSize, (ty + 1) * tileSize); ++y) {
+				for (int x = tx * tileSize; x < std::min(faceSize, (tx + 1) * tileSize); ++x) {
+					glm::vec3 dir = FaceDirection(face, ((float)x + 0.5f) / faceSize, ((float)y + 0.5f) / faceSize);
+					glm::vec2 uv = PanoramaUV(dir);
+					// Bilinear tap: wrap around in u, clamp in v; the 4 channels share one register.
+					float px = uv.x * width - 0.5f;
+					float py = std::min((float)(height - 1), std::max(0.0f, uv.y * height - 0.5f));
+					int x0 = (int)std::floor(px);
+					int y0 = (int)py;
+					float fx = px - (float)x0;
+					float fy = py - (float)y0;
+					x0 = (x0 + width) % width;
+					int x1 = (x0 + 1) % width;
+					int y1 = std::min(y0 + 1, height - 1);
+					const uint32_t* row0 = &source[(size_t)y0 * width];
+					const uint32_t* row1 = &source[(size_t)y1 * width];
+					__m128 top = _mm_add_ps(UnpackTexel(row0[x0]),
+						_mm_mul_ps(_mm_set1_ps(fx), _mm_sub_ps(UnpackTexel(row0[x1]), UnpackTexel(row0[x0]))));
+					__m128 bottom = _mm_add_ps(UnpackTexel(row1[x0]),
+						_mm_mul_ps(_mm_set1_ps(fx), _mm_sub_ps(UnpackTexel(row1[x1]), UnpackTexel(row1[x0]))));
+					__m128 color = _mm_add_ps(top, _mm_mul_ps(_mm_set1_ps(fy), _mm_sub_ps(bottom, top)));
+					faceData[(size_t)y * faceSize + x] = PackTexel(color);
+				}
+			}
+		}
+	});
+}
+
+void CubeMap::BuildMipChain()
+{
+	// 2x2 box filter, level by level; the rows of all six faces are independent.
+	for (int level = 1; level < numLevels; ++level) {
+		const int srcSize = faceSize >> (level - 1);
+		const int dstSize = faceSize >> level;
+		const std::vector<uint32_t>& src = levels[level - 1];
+		std::vector<uint32_t>& dst = levels[level];
+		dst.resize((size_t)6 * dstSize * dstSize);
+		const __m128 quarter = _mm_set1_ps(0.25f);
+		ThreadPool::Instance().ParallelFor(0, 6 * dstSize, [&](int begin, int end) {
+			for (int row = begin; row < end; ++row) {
+				const int face = row / dstSize;
+				const int y = row % dstSize;
+				const uint32_t* s0 = &src[((size_t)face * srcSize + 2 * y) * srcSize];
+				const uint32_t* s1 = s0 + srcSize;
+				uint32_t* d = &dst[((size_t)face * dstSize + y) * dstSize];
+				for (int x = 0; x < dstSize; ++x) {
+					__m128 sum = _mm_add_ps(_mm_add_ps(UnpackTexel(s0[2 * x]), UnpackTexel(s0[2 * x + 1])),
+						_mm_add_ps(UnpackTexel(s1[2 * x]), UnpackTexel(s1[2 * x + 1])));
+					d[x] = PackTexel(_mm_mul_ps(sum, quarter));
+				}
+			}
+		}, 8);
+	}
+}
+
+void CubeMap::DirectionToFace(const glm::vec3& dir, int& face, float& s, float& t)
+{
+	const glm::vec3 a = glm::abs(dir);
+	float sc, tc, ma;
+	if (a.x >= a.y && a.x >= a.z) {
+		face = dir.x > 0.0f ? 0 : 1;
+		sc = dir.x > 0.0f ? -dir.z : dir.z;
+		tc = -dir.y;
+		ma = a.x;
+	}
+	else if (a.y >= a.z) {
+		face = dir.y > 0.0f ? 2 : 3;
+		sc = dir.x;
+		tc = dir.y > 0.0f ? dir.z : -dir.z;
+		ma = a.y;
+	}
+	else {
+		face = dir.z > 0.0f ? 4 : 5;
+		sc = dir.z > 0.0f ? dir.x : -dir.x;
+		tc = -dir.y;
+		ma = a.z;
+	}
+	s = 0.5f * (sc / ma + 1.0f);
+	t = 0.5f * (tc / ma + 1.0f);
+}
+
+// Bilinear lookup inside one face of one level (no filtering across face edges).
+static inline __m128 SampleFace(const uint32_t* faceData, const int size, const float s, const float t)
+{
+	const float px = std::min((float)(size - 1), std::max(0.0f, s * size - 0.5f));
+	const float py = std::min((float)(size - 1), std::max(0.0f, t * size - 0.5f));
+	const int x0 = (int)px;
+	const int y0 = (int)py;
+	const int x1 = std::min(x0 + 1, size - 1);
+	const int y1 = std::min(y0 + 1, size - 1);
+	const __m128 fx = _mm_set1_ps(px - (float)x0);
+	const __m128 fy = _mm_set1_ps(py - (float)y0);
+	const uint32_t* row0 = faceData + (size_t)y0 * size;
+	const uint32_t* row1 = faceData + (size_t)y1 * size;
+	const __m128 c00 = UnpackTexel(row0[x0]);
+	const __m128 c01 = UnpackTexel(row1[x0]);
+	const __m128 top = _mm_add_ps(c00, _mm_mul_ps(fx, _mm_sub_ps(UnpackTexel(row0[x1]), c00)));
+	const __m128 bottom = _mm_add_ps(c01, _mm_mul_ps(fx, _mm_sub_ps(UnpackTexel(row1[x1]), c01)));
+	return _mm_add_ps(top, _mm_mul_ps(fy, _mm_sub_ps(bottom, top)));
+}
+
+// One GGX sample, relative to the normal (z up).
+struct GGXSample
+{
+	glm::vec3 direction;	// L for V = N.
+	float weight;			// N.L
+	float lod;				// Source mip covering the sample's solid angle.
+};
+
+void CubeMap::PrefilterGGX(const CubeMap* source, const int numSamples, const CubeMapProgressCallback& progress)
+{
+	const float pi = glm::pi<float>();
+	const int srcSize = source->faceSize;
+	const int srcMaxLevel = source->numLevels - 1;
+	// Solid angle of a level-0 source texel.
+	const float texelSolidAngle = 4.0f * pi / (6.0f * srcSize * srcSize);
+
+	levels.assign(numLevels, std::vector<uint32_t>());
+	int totalRows = 0;
+	for (int level = 0; level < numLevels; ++level) {
+		const int levelSize = faceSize >> level;
+		levels[level].resize((size_t)6 * levelSize * levelSize);
+		totalRows += 6 * levelSize;
+	}
+	// Counted under the mutex, so the reports come in order.
+	int doneRows = 0;
+	std::mutex progressMutex;
+
+	for (int level = 0; level < numLevels; ++level) {
+		const int levelSize = faceSize >> level;
+		const float roughness = numLevels > 1 ? (float)level / (float)(numLevels - 1) : 0.0f;
+		const float alpha = roughness * roughness;
+		const float alpha2 = alpha * alpha;
+
+		// The same importance samples (Hammersley points) serve every texel of the level.
+		std::vector<GGXSample> samples;
+		const int levelSamples = level == 0 ? 1 : numSamples;
+		for (int i = 0; i < levelSamples; ++i) {
+			uint32_t bits = (uint32_t)i;
+			bits = (bits << 16) | (bits >> 16);
+			bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+			bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+			bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+			bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+			const float u = (float)i / (float)levelSamples;
+			const float v = (float)bits * 2.3283064365386963e-10f;
+			const float phi = 2.0f * pi * u;
+			const float cosTheta = level == 0 ? 1.0f : std::sqrt((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v));
+			const float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+			const glm::vec3 H = glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+			GGXSample sample;
+			sample.direction = 2.0f * H.z * H - glm::vec3(0.0f, 0.0f, 1.0f);
+			sample.weight = sample.direction.z;
+			if (sample.weight <= 0.0f)
+				continue;
+			// pdf(L) = D(H) / 4 for V = N; pick the mip whose texels match the sample's solid angle.
+			const float d = (cosTheta * cosTheta) * (alpha2 - 1.0f) + 1.0f;
+			const float D = alpha2 / (pi * d * d);
+			const float sampleSolidAngle = 1.0f / ((float)levelSamples * D * 0.25f + 1.0e-6f);
+			sample.lod = level == 0 ? 0.0f
+				: std::min((float)srcMaxLevel, std::max(0.0f, 0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f));
+			samples.push_back(sample);
+		}
+
+		ThreadPool::Instance().ParallelFor(0, 6 * levelSize, [&](int begin, int end) {
+			for (int row = begin; row < end; ++row) {
+				const int face = row / levelSize;
+				const int y = row % levelSize;
+				uint32_t* dst = &levels[level][((size_t)face * levelSize + y) * levelSize];
+				for (int x = 0; x < levelSize; ++x) {
+					const glm::vec3 N = glm::normalize(FaceDirection(face, ((float)x + 0.5f) / levelSize, ((float)y + 0.5f) / levelSize));
+					const glm::vec3 up = std::fabs(N.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+					const glm::vec3 T = glm::normalize(glm::cross(up, N));
+					const glm::vec3 B = glm::cross(N, T);
+					__m128 sum = _mm_setzero_ps();
+					float weightSum = 0.0f;
+					for (auto&& sample : samples) {
+						const glm::vec3 L = sample.direction.x * T + sample.direction.y * B + sample.direction.z * N;
+						int srcFace;
+						float s, t;
+						DirectionToFace(L, srcFace, s, t);
+						// Trilinear: blend the two source mips around the sample's lod.
+						const int lod0 = (int)sample.lod;
+						const int lod1 = std::min(lod0 + 1, srcMaxLevel);
+						const int size0 = srcSize >> lod0;
+						const int size1 = srcSize >> lod1;
+						const __m128 c0 = SampleFace(&source->levels[lod0][(size_t)srcFace * size0 * size0], size0, s, t);
+						const __m128 c1 = SampleFace(&source->levels[lod1][(size_t)srcFace * size1 * size1], size1, s, t);
+						const __m128 c = _mm_add_ps(c0, _mm_mul_ps(_mm_set1_ps(sample.lod - (float)lod0), _mm_sub_ps(c1, c0)));
+						sum = _mm_add_ps(sum, _mm_mul_ps(c, _mm_set1_ps(sample.weight)));
+						weightSum += sample.weight;
+					}
+					dst[x] = PackTexel(_mm_mul_ps(sum, _mm_set1_ps(weightSum > 0.0f ? 1.0f / weightSum : 0.0f)));
+				}
+				if (progress) {
+					std::lock_guard<std::mutex> lock(progressMutex);
+					const int done = ++doneRows;
+					// About a hundred reports in total.
+					if (done % std::max(1, totalRows / 100) == 0 || done == totalRows)
+						progress((float)done / (float)totalRows);
+				}
+			}
+		}, 2);
+	}
+}
+
+bool CubeMap::LoadCache(const std::string& cachePath, const std::string& sourceFile)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(cachePath, ec))
+		return false;
+	std::ifstream in(cachePath, std::ios::binary);
+	CubeMapCacheHeader header;
+	if (!in.read((char*)&header, sizeof(header)))
+		return false;
+	const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(sourceFile, ec);
+	const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+	if (std::string(header.magic, 4) != "CUBE" || header.version != cubeMapCacheVersion
+		|| header.sourceSize != sourceSize || header.sourceTime != sourceTime
+		|| header.faceSize != faceSize || header.numLevels != numLevels)
+		return false;
+
+	levels.assign(numLevels, std::vector<uint32_t>());
+	for (int level = 0; level < numLevels; ++level) {
+		const int levelSize = faceSize >> level;
+		levels[level].resize((size_t)6 * levelSize * levelSize);
+		if (!in.read((char*)levels[level].data(), levels[level].size() * sizeof(uint32_t))) {
+			std::cerr << "[ERROR] Truncated cube map cache: " << cachePath << std::endl;
+			levels.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+void CubeMap::SaveCache(const std::string& cachePath, const std::string& sourceFile) const
+{
+	std::error_code ec;
+	CubeMapCacheHeader header;
+	header.magic[0] = 'C'; header.magic[1] = 'U'; header.magic[2] = 'B'; header.magic[3] = 'E';
+	header.version = cubeMapCacheVersion;
+	header.sourceSize = (uint64_t)std::filesystem::file_size(sourceFile, ec);
+	header.sourceTime = (int64_t)std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+	header.faceSize = faceSize;
+	header.numLevels = numLevels;
+
+	std::ofstream out(cachePath, std::ios::binary);
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write cube map cache: " << cachePath << std::endl;
+		return;
+	}
+	out.write((const char*)&header, sizeof(header));
+	for (auto&& level : levels)
+		out.write((const char*)level.data(), level.size() * sizeof(uint32_t));
+}
+
+void CubeMap::Upload()
+{
+	if (textureObj == 0)
+		glGenTextures(1, &textureObj);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureObj);
+	for (int level = 0; level < numLevels; ++level) {
+		const int levelSize = faceSize >> level;
+		for (int face = 0; face < 6; ++face) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA8, levelSize, levelSize,
+				0, GL_BGRA, GL_UNSIGNED_BYTE, &levels[level][(size_t)face * levelSize * levelSize]);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+size_t CubeMap::GetCpuBytes() const
+{
+	size_t total = 0;
+	for (auto&& level : levels)
+		total += level.size() * sizeof(uint32_t);
+	return total;
+}
+
+void CubeMap::Bind(GLenum textureUnit)
+{
+	MarkUsed();
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureObj);
+}
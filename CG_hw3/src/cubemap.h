@@ -0,0 +1,72 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include "headers.h"
+#include "imagetexture.h"
+#include <functional>
+
+// Progress in [0, 1]; called from the worker threads, one call at a time.
+typedef std::function<void(float)> CubeMapProgressCallback;
+
+// CubeMap Declarations.
+// A cube map texture resampled on the CPU from an equirectangular panorama, with a full
+// mip chain. Faces are BGRA8 and follow the GL face order (+X, -X, +Y, -Y, +Z, -Z).
+// The converted faces are cached next to the panorama, so later launches only upload them.
+// Accounted by MemoryBudget; the faces stay in memory as the source of the prefiltered maps.
+class CubeMap : public BudgetedResource
+{
+public:
+	// CubeMap Public Methods.
+	CubeMap();
+	~CubeMap();
+
+	// faceSize = 0 picks a power of two near a quarter of the panorama width.
+	bool CreateFromPanorama(const ImageTexture* panorama, const int faceSize = 0);
+	// Same from a decoded panorama (bottom row first); the cache goes next to sourceFile.
+	bool CreateFromPanorama(const cv::Mat& image, const std::string& sourceFile, const int faceSize = 0);
+	// GGX-prefiltered copy of a cube map for specular reflections (split-sum, N = V = R):
+	// mip level i holds roughness i / (numLevels - 1). Cached next to the source panorama.
+	bool CreatePrefilteredGGX(const CubeMap* source, const int faceSize, const int numSamples,
+							const CubeMapProgressCallback& progress = nullptr, const bool useCache = true);
+	void Bind(GLenum textureUnit);
+
+	// Direction through texel coordinates (s, t) in [0, 1] of a face, as the GL lookup defines it.
+	static glm::vec3 FaceDirection(const int face, const float s, const float t);
+	// Texture coordinates of a direction in the panorama (same mapping as the skybox).
+	static glm::vec2 PanoramaUV(const glm::vec3& dir);
+	// Inverse of FaceDirection.
+	static void DirectionToFace(const glm::vec3& dir, int& face, float& s, float& t);
+
+	int GetFaceSize() const { return faceSize; }
+	int GetNumLevels() const { return numLevels; }
+	// Six faces of one level, each levelSize * levelSize BGRA texels, bottom row first.
+	const std::vector<uint32_t>& GetLevel(const int level) const { return levels[level]; }
+	bool IsFromCache() const { return fromCache; }
+	const std::string& GetSourcePath() const { return sourcePath; }
+	float GetLastBuildTimeMs() const { return lastBuildTimeMs; }
+
+	// BudgetedResource interface.
+	const char* GetResourceType() const { return "cube map"; }
+	size_t GetGpuBytes() const { return textureObj != 0 ? GetCpuBytes() : 0; }
+	size_t GetCpuBytes() const;
+
+private:
+	// CubeMap Private Methods.
+	void Convert(const cv::Mat& image);
+	void BuildMipChain();
+	void PrefilterGGX(const CubeMap* source, const int numSamples, const CubeMapProgressCallback& progress);
+	bool LoadCache(const std::string& cachePath, const std::string& sourceFile);
+	void SaveCache(const std::string& cachePath, const std::string& sourceFile) const;
+	void Upload();
+
+	// CubeMap Private Data.
+	GLuint textureObj;
+	int faceSize;
+	int numLevels;
+	std::vector<std::vector<uint32_t>> levels;
+	std::string sourcePath;
+	bool fromCache;
+	float lastBuildTimeMs;
+};
+
+#endif
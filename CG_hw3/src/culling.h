@@ -0,0 +1,48 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+// Frustum Declarations.
+// Six normalized planes (xyz: normal pointing inside, w: distance).
+struct Frustum
+{
+	// Extract the planes from a (model-)view-projection matrix.
+	// With an MVP the planes end up in the object space of that model.
+	Frustum() {}
+	Frustum(const glm::mat4x4& M) {
+		glm::vec4 row0 = glm::vec4(M[0][0], M[1][0], M[2][0], M[3][0]);
+		glm::vec4 row1 = glm::vec4(M[0][1], M[1][1], M[2][1], M[3][1]);
+		glm::vec4 row2 = glm::vec4(M[0][2], M[1][2], M[2][2], M[3][2]);
+		glm::vec4 row3 = glm::vec4(M[0][3], M[1][3], M[2][3], M[3][3]);
+		planes[0] = row3 + row0;	// Left.
+		planes[1] = row3 - row0;	// Right.
+		planes[2] = row3 + row1;	// Bottom.
+		planes[3] = row3 - row1;	// Top.
+		planes[4] = row3 + row2;	// Near.
+		planes[5] = row3 - row2;	// Far.
+		for (int i = 0; i < 6; ++i)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	bool IsSphereVisible(const glm::vec3& center, const float radius) const {
+		for (int i = 0; i < 6; ++i) {
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	glm::vec4 planes[6];
+};
+
+// Normal cone test: true if every triangle of the cluster faces away from the camera.
+// The cone apex is approximated by the bounding sphere, so the test stays conservative.
+inline bool IsConeBackFacing(const glm::vec3& center, const float radius,
+							const glm::vec3& coneAxis, const float coneCutoff, const glm::vec3& cameraPos)
+{
+	glm::vec3 v = center - cameraPos;
+	return glm::dot(v, coneAxis) >= coneCutoff * glm::length(v) + radius;
+}
+
+#endif
@@ -20,6 +20,7 @@
 #include <fstream>
 #include <sstream>
 #include <filesystem>
+#include <chrono>
 #include <windows.h>
 #include <commdlg.h>
 
@@ -0,0 +1,147 @@
+#include "hizbuffer.h"
+
+HiZBuffer::HiZBuffer()
+{
+	depthFboId = 0;
+	depthTexId = 0;
+	pyramidTexId = 0;
+	timerQueryId = 0;
+	timerPending = false;
+	pyramidWidth = 0;
+	pyramidHeight = 0;
+	numLevels = 0;
+	valid = false;
+	lastBuildTimeMs = 0.0f;
+}
+
+HiZBuffer::~HiZBuffer()
+{
+	ReleaseTextures();
+	glDeleteQueries(1, &timerQueryId);
+}
+
+void HiZBuffer::Build(HiZBuildShaderProg* shader, const int width, const int height)
+{
+	if (shader == nullptr || width <= 0 || height <= 0)
+		return;
+	if (width != pyramidWidth || height != pyramidHeight)
+		CreateTextures(width, height);
+
+	// Pick up the timing of the previous build without stalling.
+	if (timerQueryId == 0)
+		glGenQueries(1, &timerQueryId);
+	if (timerPending) {
+		GLint available = 0;
+		glGetQueryObjectiv(timerQueryId, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 elapsedNs = 0;
+			glGetQueryObjectui64v(timerQueryId, GL_QUERY_RESULT, &elapsedNs);
+			lastBuildTimeMs = (float)elapsedNs * 1.0e-6f;
+			timerPending = false;
+		}
+	}
+	const bool timing = !timerPending;
+	if (timing)
+		glBeginQuery(GL_TIME_ELAPSED, timerQueryId);
+
+	// The default framebuffer is multisampled and cannot be sampled; resolve its depth first.
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFboId);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	shader->Bind();
+	// Level 0: plain copy of the depth.
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexId);
+	glUniform1i(shader->GetLocDepthTex(), 0);
+	glUniform1i(shader->GetLocMode(), 0);
+	glBindImageTexture(1, pyramidTexId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	shader->Dispatch(width, height);
+	// Other levels: farthest depth of the level above.
+	glUniform1i(shader->GetLocMode(), 1);
+	for (int level = 1; level < numLevels; ++level) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(0, pyramidTexId, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramidTexId, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		shader->Dispatch(std::max(1, width >> level), std::max(1, height >> level));
+	}
+	shader->UnBind();
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The pyramid is read with texelFetch by the culling pass.
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	if (timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		timerPending = true;
+	}
+	valid = true;
+}
+
+void HiZBuffer::Bind(GLenum textureUnit)
+{
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_2D, pyramidTexId);
+}
+
+void HiZBuffer::CreateTextures(const int width, const int height)
+{
+	ReleaseTextures();
+	pyramidWidth = width;
+	pyramidHeight = height;
+	numLevels = 1;
+	while ((std::max(width, height) >> numLevels) > 0)
+		numLevels++;
+
+	// The blit target must match the depth format of the default framebuffer.
+	GLint depthBits = 24, stencilBits = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+	GLenum depthFormat = GL_DEPTH_COMPONENT24;
+	if (stencilBits > 0)
+		depthFormat = depthBits == 32 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8;
+	else if (depthBits == 32)
+		depthFormat = GL_DEPTH_COMPONENT32F;
+	else if (depthBits == 16)
+		depthFormat = GL_DEPTH_COMPONENT16;
+
+	glGenTextures(1, &depthTexId);
+	glBindTexture(GL_TEXTURE_2D, depthTexId);
+	glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+	glGenFramebuffers(1, &depthFboId);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthFboId);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, stencilBits > 0 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+		GL_TEXTURE_2D, depthTexId, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "[ERROR] Hi-Z depth framebuffer is incomplete" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenTextures(1, &pyramidTexId);
+	glBindTexture(GL_TEXTURE_2D, pyramidTexId);
+	glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	valid = false;
+}
+
+void HiZBuffer::ReleaseTextures()
+{
+	glDeleteFramebuffers(1, &depthFboId);
+	glDeleteTextures(1, &depthTexId);
+	glDeleteTextures(1, &pyramidTexId);
+	depthFboId = depthTexId = pyramidTexId = 0;
+	pyramidWidth = pyramidHeight = numLevels = 0;
+	valid = false;
+}
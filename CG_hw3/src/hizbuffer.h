@@ -0,0 +1,47 @@
+#ifndef HIZBUFFER_H
+#define HIZBUFFER_H
+
+#include "headers.h"
+#include "shaderprog.h"
+
+// HiZBuffer Declarations.
+// A max-depth pyramid built from the depth buffer of the default framebuffer.
+class HiZBuffer
+{
+public:
+	// HiZBuffer Public Methods.
+	HiZBuffer();
+	~HiZBuffer();
+
+	// Copy the current depth buffer and rebuild every pyramid level.
+	void Build(HiZBuildShaderProg* shader, const int width, const int height);
+	// Drop the pyramid (e.g. after a resize); the next culling pass skips the occlusion test.
+	void Invalidate() { valid = false; }
+
+	void Bind(GLenum textureUnit);
+	bool IsValid() const { return valid; }
+	int GetWidth() const { return pyramidWidth; }
+	int GetHeight() const { return pyramidHeight; }
+	int GetNumLevels() const { return numLevels; }
+	// GPU time of the most recent finished build, in milliseconds.
+	float GetLastBuildTimeMs() const { return lastBuildTimeMs; }
+
+private:
+	// HiZBuffer Private Methods.
+	void CreateTextures(const int width, const int height);
+	void ReleaseTextures();
+
+	// HiZBuffer Private Data.
+	GLuint depthFboId;
+	GLuint depthTexId;
+	GLuint pyramidTexId;
+	GLuint timerQueryId;
+	bool timerPending;
+	int pyramidWidth;
+	int pyramidHeight;
+	int numLevels;
+	bool valid;
+	float lastBuildTimeMs;
+};
+
+#endif
@@ -1,76 +1,432 @@
 #include "imagetexture.h"
+#include "texturestreamer.h"
+
+TextureCompression ImageTexture::materialCompression = TEXTURE_BC1_BC3;
+uint64_t ImageTexture::nextId = 1;
 
 ImageTexture::ImageTexture(const std::string filePath)
-	: texFilePath(filePath)
+	: ImageTexture(filePath, false)
+{
+}
+
+ImageTexture::ImageTexture(const std::string filePath, const bool streamed, const TextureCompression compression,
+						const bool shareable)
+	: texFilePath(filePath), compression(compression)
 {
+	id = nextId++;
+	this->shareable = streamed && shareable;
+	shared = nullptr;
 	imageWidth = 0;
 	imageHeight = 0;
 	numChannels = 0;
 	textureObj = 0;
+	uploadTextureObj = 0;
+	compressedImage = nullptr;
+	compressedStorage = false;
+	blockFormat = BLOCK_BC1;
+	internalFormat = 0;
+	numLevels = 0;
+	baseLevel = 0;
+	gpuBytes = 0;
+	resident = false;
+	loading = false;
+	failed = false;
+
+	if (streamed) {
+		loading = true;
+		TextureStreamer::Instance().Request(this);
+		return;
+	}
 
 	// Try to load texture image.
-	texImage = cv::imread(texFilePath);
-	if (texImage.rows == 0 || texImage.cols == 0) {
-		std::cerr << "[ERROR] Failed to load image texture: " << filePath << std::endl;
+	cv::Mat image = DecodeImage(texFilePath);
+	BlockCompressedImage* compressed = nullptr;
+	if (compression != TEXTURE_UNCOMPRESSED && !image.empty())
+		compressed = CompressImage(image, texFilePath, compression);
+	if (!CreateStorage(image, compressed))
 		return;
+
+	glBindTexture(GL_TEXTURE_2D, uploadTextureObj);
+	if (compressedImage != nullptr) {
+		for (int level = 0; level < compressedImage->GetNumLevels(); ++level) {
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, compressedImage->GetLevelWidth(level),
+				compressedImage->GetLevelHeight(level), GetCompressedFormat(),
+				(GLsizei)compressedImage->GetLevel(level).size(), compressedImage->GetLevel(level).data());
+		}
 	}
-	imageWidth = texImage.cols;
-	imageHeight = texImage.rows;
-	numChannels = texImage.channels();
+	else {
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageWidth, imageHeight,
+						GetPixelFormat(), GL_UNSIGNED_BYTE, texImage.ptr());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	FinishUpload();
+}
+
+ImageTexture::~ImageTexture()
+{
+	if (loading)
+		TextureStreamer::Instance().Cancel(this);
+	glDeleteTextures(1, &textureObj);
+	glDeleteTextures(1, &uploadTextureObj);
+	texImage.release();
+	if (compressedImage) {
+		delete compressedImage;
+		compressedImage = nullptr;
+	}
+}
+
+uint64_t ImageTexture::ReadFile(const std::string& filePath, std::vector<unsigned char>& data)
+{
+	data.clear();
+	std::ifstream in(filePath, std::ios::binary | std::ios::ate);
+	if (!in)
+		return 0;
+	const std::streamoff size = in.tellg();
+	if (size <= 0)
+		return 0;
+	data.resize((size_t)size);
+	in.seekg(0, std::ios::beg);
+	if (!in.read((char*)data.data(), size)) {
+		data.clear();
+		return 0;
+	}
+	uint64_t hash = 14695981039346656037ull;
+	for (const unsigned char byte : data) {
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
+cv::Mat ImageTexture::DecodeImage(const std::string& filePath, const std::vector<unsigned char>* data)
+{
+	// Unchanged, so alpha is kept (BC3 when compressed).
+	cv::Mat image;
+	if (data == nullptr)
+		image = cv::imread(filePath, cv::IMREAD_UNCHANGED);
+	else if (!data->empty())
+		image = cv::imdecode(*data, cv::IMREAD_UNCHANGED);
+	if (image.rows == 0 || image.cols == 0) {
+		std::cerr << "[ERROR] Failed to load image texture: " << filePath << std::endl;
+		return cv::Mat();
+	}
+	// Textures are 8-bit BGR or BGRA; gray is expanded, as GL_RED would sample as red.
+	if (image.depth() == CV_16U)
+		image.convertTo(image, CV_8U, 1.0 / 257.0);
+	else if (image.depth() != CV_8U)
+		image.convertTo(image, CV_8U, 255.0);
+	if (image.channels() == 1) {
+		cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+	}
+	else if (image.channels() == 2) {
+		// Gray and alpha.
+		std::vector<cv::Mat> planes;
+		cv::split(image, planes);
+		cv::merge(std::vector<cv::Mat>{ planes[0], planes[0], planes[0], planes[1] }, image);
+	}
+	else if (image.channels() == 4) {
+		// An alpha channel that is opaque everywhere is dropped, so it compresses to BC1.
+		cv::Mat alpha;
+		cv::extractChannel(image, alpha, 3);
+		double minAlpha = 0.0;
+		cv::minMaxLoc(alpha, &minAlpha);
+		if (minAlpha >= 255.0)
+			cv::cvtColor(image, image, cv::COLOR_BGRA2BGR);
+	}
 	// Flip texture in vertical direction.
 	// OpenCV has smaller y coordinate on top; while OpenGL has larger.
-	cv::flip(texImage, texImage, 0);
+	cv::flip(image, image, 0);
+	return image;
+}
+
+BlockCompressedImage* ImageTexture::CompressImage(const cv::Mat& image, const std::string& filePath,
+												const TextureCompression compression)
+{
+	BlockFormat format = BLOCK_BC7;
+	if (compression == TEXTURE_BC1_BC3)
+		format = image.channels() == 4 ? BLOCK_BC3 : BLOCK_BC1;
+	const std::string cachePath = filePath + (format == BLOCK_BC1 ? ".bc1.dds" : (format == BLOCK_BC3 ? ".bc3.dds" : ".bc7.dds"));
+
+	BlockCompressedImage* compressed = new BlockCompressedImage();
+	const bool fromCache = compressed->LoadDDS(cachePath, filePath, format);
+	if (!fromCache) {
+		compressed->Encode(image.ptr(), image.cols, image.rows, image.channels(), image.step, format);
+		compressed->SaveDDS(cachePath, filePath);
+	}
+	if (compressed->GetWidth() != image.cols || compressed->GetHeight() != image.rows) {
+		delete compressed;
+		return nullptr;
+	}
+
+	// Against a full RGBA8 mip chain, which is what drivers allocate for GL_RGB(A).
+	size_t uncompressedBytes = 0;
+	for (int level = 0; level < compressed->GetNumLevels(); ++level)
+		uncompressedBytes += (size_t)compressed->GetLevelWidth(level) * compressed->GetLevelHeight(level) * 4;
+	const float psnr = compressed->ComputePSNR(image.ptr(), image.channels(), image.step);
+	// One write, so lines from several workers do not interleave.
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(2) << "Texture " << filePath << ": "
+		   << BlockCompressedImage::GetFormatName(format) << " " << image.cols << "x" << image.rows << ", "
+		   << (fromCache ? "loaded from cache" : "encoded in " + std::to_string((int)compressed->GetLastEncodeTimeMs()) + " ms")
+		   << ", " << uncompressedBytes / (1024.0f * 1024.0f) << " MB -> " << compressed->GetTotalBytes() / (1024.0f * 1024.0f)
+		   << " MB (" << (float)uncompressedBytes / (float)compressed->GetTotalBytes() << "x), PSNR " << psnr << " dB\n";
+	std::cout << report.str() << std::flush;
+	return compressed;
+}
+
+bool ImageTexture::CreateStorage(cv::Mat& image, BlockCompressedImage* compressed)
+{
+	if (image.rows == 0 || image.cols == 0) {
+		delete compressed;
+		failed = true;
+		loading = false;
+		return false;
+	}
+	if (!image.isContinuous())
+		image = image.clone();
 
-	glGenTextures(1, &textureObj);
-    glBindTexture(GL_TEXTURE_2D, textureObj);
-    switch (numChannels) {
+	switch (image.channels()) {
 	case 1:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, imageWidth, imageHeight, 
-						0, GL_RED, GL_UNSIGNED_BYTE, texImage.ptr());
+		internalFormat = GL_RED;
 		break;
 	case 3:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 
-						0, GL_BGR, GL_UNSIGNED_BYTE, texImage.ptr());
+		internalFormat = GL_RGB;
 		break;
 	case 4:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageWidth, imageHeight, 
-						0, GL_BGRA, GL_UNSIGNED_BYTE, texImage.ptr());
+		internalFormat = GL_RGBA;
 		break;
 	default:
 		std::cerr << "[ERROR] Unsupport texture format" << std::endl;
-		break;
+		delete compressed;
+		failed = true;
+		loading = false;
+		return false;
+	}
+	texImage = image;
+	imageWidth = texImage.cols;
+	imageHeight = texImage.rows;
+	numChannels = texImage.channels();
+
+	delete compressedImage;
+	compressedImage = compressed;
+	if (compressedImage != nullptr) {
+		const bool supported = compressedImage->GetFormat() == BLOCK_BC7
+			? GLEW_ARB_texture_compression_bptc : GLEW_EXT_texture_compression_s3tc;
+		if (!supported) {
+			std::cerr << "[ERROR] " << BlockCompressedImage::GetFormatName(compressedImage->GetFormat())
+					  << " textures are not supported; uploading uncompressed: " << texFilePath << std::endl;
+			delete compressedImage;
+			compressedImage = nullptr;
+		}
+	}
+	compressedStorage = compressedImage != nullptr;
+	if (compressedStorage) {
+		blockFormat = compressedImage->GetFormat();
+		internalFormat = GetCompressedFormat();
+		numLevels = compressedImage->GetNumLevels();
+	}
+	else {
+		numLevels = 1;
+		while ((std::max(imageWidth, imageHeight) >> numLevels) > 0)
+			numLevels++;
 	}
 
+	// Levels are allocated empty and filled by the caller (at once, or in bands by the streamer).
+	// A reload goes to a new texture, so the evicted one stays bound until it is done.
+	glDeleteTextures(1, &uploadTextureObj);
+	glGenTextures(1, &uploadTextureObj);
+	AllocateLevels(uploadTextureObj, 0);
+	return true;
+}
+
+void ImageTexture::AllocateLevels(const GLuint texId, const int firstLevel) const
+{
+	glBindTexture(GL_TEXTURE_2D, texId);
+	for (int level = firstLevel; level < numLevels; ++level) {
+		const int levelWidth = std::max(1, imageWidth >> level);
+		const int levelHeight = std::max(1, imageHeight >> level);
+		if (compressedStorage) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, level - firstLevel, internalFormat, levelWidth, levelHeight,
+								0, (GLsizei)GetLevelBytes(level), nullptr);
+		}
+		else {
+			glTexImage2D(GL_TEXTURE_2D, level - firstLevel, internalFormat, levelWidth, levelHeight,
+						0, GetPixelFormat(), GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1 - firstLevel);
+
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	
-	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-ImageTexture::~ImageTexture()
+GLenum ImageTexture::GetPixelFormat() const
+{
+	switch (numChannels) {
+	case 1:
+		return GL_RED;
+	case 4:
+		return GL_BGRA;
+	default:
+		return GL_BGR;
+	}
+}
+
+size_t ImageTexture::GetLevelBytes(const int level) const
+{
+	const size_t levelWidth = std::max(1, imageWidth >> level);
+	const size_t levelHeight = std::max(1, imageHeight >> level);
+	if (compressedStorage)
+		return ((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * BlockCompressedImage::GetBlockBytes(blockFormat);
+	// Drivers pad GL_RGB to four bytes per texel.
+	return levelWidth * levelHeight * (numChannels == 1 ? 1 : 4);
+}
+
+size_t ImageTexture::GetCpuBytes() const
 {
+	size_t total = texImage.total() * texImage.elemSize();
+	if (compressedImage != nullptr)
+		total += compressedImage->GetTotalBytes();
+	return total;
+}
+
+GLenum ImageTexture::GetCompressedFormat() const
+{
+	switch (blockFormat) {
+	case BLOCK_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	default:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+}
+
+void ImageTexture::FinishUpload()
+{
+	if (!compressedStorage) {
+		glBindTexture(GL_TEXTURE_2D, uploadTextureObj);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
 	glDeleteTextures(1, &textureObj);
+	textureObj = uploadTextureObj;
+	uploadTextureObj = 0;
+	baseLevel = 0;
+	gpuBytes = 0;
+	for (int level = 0; level < numLevels; ++level)
+		gpuBytes += GetLevelBytes(level);
+	resident = true;
+	loading = false;
+	// Not evicted again before it is bound.
+	MarkUsed();
+}
+
+void ImageTexture::ShareWith(ImageTexture* owner)
+{
+	// Nothing of this one is loaded yet: it is shared as soon as its file has been read.
+	glDeleteTextures(1, &textureObj);
+	glDeleteTextures(1, &uploadTextureObj);
+	textureObj = 0;
+	uploadTextureObj = 0;
 	texImage.release();
+	delete compressedImage;
+	compressedImage = nullptr;
+	gpuBytes = 0;
+	resident = false;
+	loading = false;
+	shared = owner;
+}
+
+size_t ImageTexture::ReleaseCpuCopy()
+{
+	// Still needed by an upload in progress.
+	if (!resident || loading)
+		return 0;
+	const size_t freed = GetCpuBytes();
+	texImage.release();
+	if (compressedImage) {
+		delete compressedImage;
+		compressedImage = nullptr;
+	}
+	return freed;
+}
+
+size_t ImageTexture::Evict()
+{
+	if (!resident || loading || textureObj == 0)
+		return 0;
+	// Drop the top level while it is larger than minEvictedSize, by copying the rest of
+	// the chain into a smaller texture; below that (or without ARB_copy_image) drop it all.
+	const int minEvictedSize = 64;
+	const int topSize = std::max(std::max(1, imageWidth >> baseLevel), std::max(1, imageHeight >> baseLevel));
+	if (GLEW_ARB_copy_image && baseLevel + 1 < numLevels && topSize > minEvictedSize) {
+		GLuint texId = 0;
+		glGenTextures(1, &texId);
+		AllocateLevels(texId, baseLevel + 1);
+		for (int level = baseLevel + 1; level < numLevels; ++level) {
+			glCopyImageSubData(textureObj, GL_TEXTURE_2D, level - baseLevel, 0, 0, 0,
+							texId, GL_TEXTURE_2D, level - baseLevel - 1, 0, 0, 0,
+							std::max(1, imageWidth >> level), std::max(1, imageHeight >> level), 1);
+		}
+		glDeleteTextures(1, &textureObj);
+		textureObj = texId;
+		const size_t freed = GetLevelBytes(baseLevel);
+		gpuBytes -= freed;
+		++baseLevel;
+		return freed;
+	}
+	return ReleaseGpuCopy();
+}
+
+size_t ImageTexture::ReleaseGpuCopy()
+{
+	if (!resident || loading || textureObj == 0)
+		return 0;
+	const size_t freed = gpuBytes;
+	glDeleteTextures(1, &textureObj);
+	textureObj = 0;
+	gpuBytes = 0;
+	resident = false;
+	return freed;
 }
 
 void ImageTexture::Bind(GLenum textureUnit)
 {
+	if (shared != nullptr) {
+		shared->Bind(textureUnit);
+		return;
+	}
+	MarkUsed();
+	// Evicted (in part or whole): reload from the file, or its DDS cache when compressed;
+	// what is left of it, or the placeholder, is bound meanwhile.
+	if ((textureObj == 0 || baseLevel > 0) && !loading && !failed) {
+		loading = true;
+		TextureStreamer::Instance().Request(this);
+	}
 	glActiveTexture(textureUnit);
-    glBindTexture(GL_TEXTURE_2D, textureObj);
+	glBindTexture(GL_TEXTURE_2D, textureObj != 0 ? textureObj : TextureStreamer::GetPlaceholder());
 }
 
 void ImageTexture::Preview()
 {
+	if (shared != nullptr) {
+		shared->Preview();
+		return;
+	}
+	if (texImage.empty()) {
+		std::cerr << "[ERROR] No CPU copy to preview (released after upload): " << texFilePath << std::endl;
+		return;
+	}
 	std::string windowText = "[DEBUG] TexturePreview: " + texFilePath;
 	cv::Mat previewImg = cv::Mat(texImage.rows, texImage.cols, texImage.type());
 	cv::cvtColor(texImage, previewImg, cv::COLOR_BGR2RGB);
 	cv::imshow(windowText, previewImg);
 	cv::waitKey(0);
 }
-
@@ -2,28 +2,132 @@
 #define IMAGE_TEXTURE_H
 
 #include "headers.h"
+#include "blockcompression.h"
+#include "memorybudget.h"
+
+// How a texture is stored on the GPU.
+enum TextureCompression
+{
+	TEXTURE_UNCOMPRESSED = 0,
+	// BC1, or BC3 if the image has alpha.
+	TEXTURE_BC1_BC3,
+	// BC7 (higher quality, slower to encode).
+	TEXTURE_BC7
+};
 
 // Texture Declarations.
-class ImageTexture
+// Accounted by MemoryBudget: the CPU copy is dropped once uploaded, and under memory
+// pressure the top mip levels (or the whole texture) are evicted and reloaded when bound.
+class ImageTexture : public BudgetedResource
 {
 public:
 	// Texture Public Methods.
 	ImageTexture(const std::string filePath);
+	// streamed = true: decode on a worker and upload over the next frames (see TextureStreamer);
+	// a placeholder is bound until then.
+	// Compressed textures are encoded on the CPU once and cached as <file>.<format>.dds.
+	// shareable (streamed only): TextureManager may find a texture of a file with the same
+	// contents once the file is read, and point this one at it instead of loading a copy.
+	ImageTexture(const std::string filePath, const bool streamed,
+				const TextureCompression compression = TEXTURE_UNCOMPRESSED, const bool shareable = false);
 	~ImageTexture();
 
 	void Bind(GLenum textureUnit);
 	void Preview();
 	std::string GetPath() const { return texFilePath; }
+	// The texture holding the image: this one, or the one it shares (see shareable). The
+	// getters below and Bind go to it.
+	ImageTexture* GetShared() { return shared != nullptr ? shared : this; }
+	const ImageTexture* GetShared() const { return shared != nullptr ? shared : this; }
+	// Uploaded (possibly without its evicted top mip levels, see GetBaseLevel).
+	bool IsResident() const { return GetShared()->resident; }
+	// The image could not be loaded; the placeholder stays bound.
+	bool IsFailed() const { return GetShared()->failed; }
+	// CPU copy of the image: bottom row first (GL order), BGR(A) channels. Only valid in
+	// the frame the texture becomes resident (MemoryBudget drops it in its next Update).
+	const cv::Mat& GetImage() const { return GetShared()->texImage; }
+	int GetWidth() const { return GetShared()->imageWidth; }
+	int GetHeight() const { return GetShared()->imageHeight; }
+	int GetNumChannels() const { return GetShared()->numChannels; }
+	bool IsCompressed() const { return GetShared()->compressedStorage; }
+	// Mip levels evicted from the top of the chain.
+	int GetBaseLevel() const { return GetShared()->baseLevel; }
+
+	// BudgetedResource interface (a texture sharing another's image holds no memory itself).
+	const char* GetResourceType() const { return "texture"; }
+	// Video memory once resident (RGBA8 or block-compressed mip chain), 0 before.
+	size_t GetGpuBytes() const { return resident ? gpuBytes : 0; }
+	size_t GetCpuBytes() const;
+	size_t ReleaseCpuCopy();
+	size_t Evict();
+	// Drop the whole GL texture (a copy now lives elsewhere, e.g. in a TextureArray); like an
+	// evicted one it reloads when bound again. Returns the bytes freed.
+	size_t ReleaseGpuCopy();
+
+	// Compression used for material textures (map_Kd).
+	static void SetMaterialCompression(const TextureCompression value) { materialCompression = value; }
+	static TextureCompression GetMaterialCompression() { return materialCompression; }
 
 private:
+	friend class TextureStreamer;
+	friend class TextureArray;
+	friend class TextureManager;
+	friend class TextureContents;
+
+	// Texture Private Methods.
+	// Read a whole file (any thread); returns a 64-bit FNV-1a of its contents, 0 if it cannot
+	// be read.
+	static uint64_t ReadFile(const std::string& filePath, std::vector<unsigned char>& data);
+	// Decode and flip (any thread); data holds the file when it has been read already.
+	static cv::Mat DecodeImage(const std::string& filePath, const std::vector<unsigned char>* data = nullptr);
+	// Load the block-compressed mip chain from the cache, or encode and cache it (any thread).
+	static BlockCompressedImage* CompressImage(const cv::Mat& image, const std::string& filePath,
+											const TextureCompression compression);
+	// Take a decoded image (and its compressed levels, owned from now on) and allocate the
+	// (still empty) GL texture.
+	bool CreateStorage(cv::Mat& image, BlockCompressedImage* compressed);
+	// Client format of texImage (GL_RED, GL_BGR or GL_BGRA).
+	GLenum GetPixelFormat() const;
+	// GL internal format of the compressed levels.
+	GLenum GetCompressedFormat() const;
+	// Video memory of one level of the full chain.
+	size_t GetLevelBytes(const int level) const;
+	// Allocate empty levels first..numLevels-1 of the full chain as levels 0.. of texId.
+	void AllocateLevels(const GLuint texId, const int firstLevel) const;
+	// Every level of uploadTextureObj is uploaded: build the mip chain unless it came
+	// compressed, and replace the current (placeholder or evicted) texture.
+	void FinishUpload();
+	// Use owner's image from now on, in place of loading this one (TextureManager).
+	void ShareWith(ImageTexture* owner);
+
 	// Texture Private Data.
 	std::string texFilePath;
+	// Unique for the run (TextureContents refers to textures by it).
+	uint64_t id;
+	bool shareable;
+	ImageTexture* shared;
 	GLuint textureObj;
+	// Being filled by the streamer (the first load or a reload after eviction).
+	GLuint uploadTextureObj;
 	int imageWidth;
 	int imageHeight;
 	int numChannels;
 	cv::Mat texImage;
+	TextureCompression compression;
+	BlockCompressedImage* compressedImage;
+	// GL storage, kept when the CPU copies are dropped.
+	bool compressedStorage;
+	BlockFormat blockFormat;
+	GLenum internalFormat;
+	int numLevels;
+	int baseLevel;
+	size_t gpuBytes;
+	bool resident;
+	bool loading;
+	bool failed;
+
+	static TextureCompression materialCompression;
+	static uint64_t nextId;
 };
 
 #endif
-
@@ -4,6 +4,7 @@
 #include "headers.h"
 #include "shaderprog.h"
 #include "imagetexture.h"
+#include "texturemanager.h"
 
 // Material Declarations.
 class Material
@@ -35,19 +36,29 @@ public:
 		Ns = 0.0f;
 		mapKd = nullptr;
 	};
-	~PhongMaterial() {};
+	~PhongMaterial() { TextureManager::Instance().Release(mapKd); };
 
 	void SetKa(const glm::vec3 ka) { Ka = ka; }
 	void SetKd(const glm::vec3 kd) { Kd = kd; }
 	void SetKs(const glm::vec3 ks) { Ks = ks; }
 	void SetNs(const float n) { Ns = n; }
-	void SetMapKd(ImageTexture* tex) { mapKd = tex; }
+	// Takes over a reference from TextureManager::Acquire.
+	void SetMapKd(ImageTexture* tex) {
+		// Setting the same texture again still hands over one reference, so the old one is
+		// always released.
+		ImageTexture* old = mapKd;
+		mapKd = tex;
+		TextureManager::Instance().Release(old);
+	}
 
 	const glm::vec3 GetKa() const { return Ka; }
 	const glm::vec3 GetKd() const { return Kd; }
 	const glm::vec3 GetKs() const { return Ks; }
 	const float GetNs() const { return Ns; }
 	ImageTexture* GetMapKd() const { return mapKd; }
+	// map_Kd as read from the MTL file; the texture is acquired from it on the GL thread.
+	void SetMapKdPath(const std::string& path) { mapKdPath = path; }
+	const std::string& GetMapKdPath() const { return mapKdPath; }
 
 private:
 	// PhongMaterial Private Data.
@@ -56,6 +67,7 @@ private:
 	glm::vec3 Ks;
 	float Ns;
 	ImageTexture* mapKd;
+	std::string mapKdPath;
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -68,8 +80,15 @@ public:
 	SkyboxMaterial() {
 		mapKd = nullptr;
 	};
-	~SkyboxMaterial() {};
-	void SetMapKd(ImageTexture* tex) { mapKd = tex; }
+	~SkyboxMaterial() { TextureManager::Instance().Release(mapKd); };
+	// Takes over a reference from TextureManager::Acquire.
+	void SetMapKd(ImageTexture* tex) {
+		// Setting the same texture again still hands over one reference, so the old one is
+		// always released.
+		ImageTexture* old = mapKd;
+		mapKd = tex;
+		TextureManager::Instance().Release(old);
+	}
 	ImageTexture* GetMapKd() const { return mapKd; }
 
 private:
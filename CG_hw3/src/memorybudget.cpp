@@ -0,0 +1,140 @@
+#include "memorybudget.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <string>
+
+// Resources can outlive the budget at exit (static destruction order).
+static bool budgetAlive = false;
+
+BudgetedResource::BudgetedResource()
+{
+	// Creation counts as a use, so nothing is evicted before it is first drawn.
+	lastUsedFrame = MemoryBudget::Instance().GetFrame();
+	MemoryBudget::Instance().Register(this);
+}
+
+BudgetedResource::~BudgetedResource()
+{
+	if (budgetAlive)
+		MemoryBudget::Instance().Unregister(this);
+}
+
+void BudgetedResource::MarkUsed()
+{
+	lastUsedFrame = MemoryBudget::Instance().GetFrame();
+}
+
+MemoryBudget& MemoryBudget::Instance()
+{
+	static MemoryBudget budget;
+	return budget;
+}
+
+MemoryBudget::MemoryBudget()
+{
+	frame = 1;
+	gpuBudget = (size_t)1024 * 1024 * 1024;
+	releaseCpuCopies = true;
+	numEvictions = 0;
+	evictedBytes = 0;
+	releasedCpuBytes = 0;
+	budgetAlive = true;
+}
+
+MemoryBudget::~MemoryBudget()
+{
+	budgetAlive = false;
+	resources.clear();
+}
+
+void MemoryBudget::Register(BudgetedResource* resource)
+{
+	resources.push_back(resource);
+}
+
+void MemoryBudget::Unregister(BudgetedResource* resource)
+{
+	resources.erase(std::remove(resources.begin(), resources.end(), resource), resources.end());
+}
+
+void MemoryBudget::Update()
+{
+	const unsigned int previousFrame = frame;
+	++frame;
+
+	if (releaseCpuCopies) {
+		for (auto&& resource : resources)
+			releasedCpuBytes += resource->ReleaseCpuCopy();
+	}
+
+	if (gpuBudget == 0)
+		return;
+	size_t total = GetGpuBytes();
+	if (total <= gpuBudget)
+		return;
+	// Only resources unused in the last frame, oldest first; each gives up mip levels until
+	// it is gone before the next one is touched.
+	std::vector<BudgetedResource*> candidates;
+	for (auto&& resource : resources)
+		if (resource->GetLastUsedFrame() < previousFrame && resource->GetGpuBytes() > 0)
+			candidates.push_back(resource);
+	std::stable_sort(candidates.begin(), candidates.end(), [](const BudgetedResource* a, const BudgetedResource* b) {
+		return a->GetLastUsedFrame() < b->GetLastUsedFrame();
+	});
+	for (auto&& resource : candidates) {
+		while (total > gpuBudget) {
+			const size_t freed = resource->Evict();
+			if (freed == 0)
+				break;
+			total -= std::min(total, freed);
+			evictedBytes += freed;
+			++numEvictions;
+		}
+		if (total <= gpuBudget)
+			break;
+	}
+}
+
+size_t MemoryBudget::GetGpuBytes() const
+{
+	size_t total = 0;
+	for (auto&& resource : resources)
+		total += resource->GetGpuBytes();
+	return total;
+}
+
+size_t MemoryBudget::GetCpuBytes() const
+{
+	size_t total = 0;
+	for (auto&& resource : resources)
+		total += resource->GetCpuBytes();
+	return total;
+}
+
+void MemoryBudget::PrintStats() const
+{
+	const double mb = 1.0 / (1024.0 * 1024.0);
+	std::map<std::string, std::pair<size_t, size_t>> byType;
+	std::map<std::string, int> counts;
+	for (auto&& resource : resources) {
+		auto& bytes = byType[resource->GetResourceType()];
+		bytes.first += resource->GetGpuBytes();
+		bytes.second += resource->GetCpuBytes();
+		++counts[resource->GetResourceType()];
+	}
+	std::cout << std::fixed << std::setprecision(2) << "Memory: " << GetGpuBytes() * mb << " MB video";
+	if (gpuBudget > 0)
+		std::cout << " (budget " << gpuBudget * mb << " MB)";
+	std::cout << ", " << GetCpuBytes() * mb << " MB CPU copies" << std::endl;
+	for (auto&& type : byType) {
+		std::cout << "  " << type.first << " x" << counts[type.first] << ": " << type.second.first * mb
+				  << " MB video, " << type.second.second * mb << " MB CPU" << std::endl;
+	}
+	std::cout << "  " << numEvictions << " evictions (" << evictedBytes * mb << " MB), "
+			  << releasedCpuBytes * mb << " MB of CPU copies released" << std::endl;
+	std::cout.unsetf(std::ios::fixed);
+	std::cout << std::setprecision(6);
+}
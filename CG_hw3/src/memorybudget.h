@@ -0,0 +1,79 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+// No GL or window-system headers: this module runs headless.
+#include <vector>
+#include <cstddef>
+
+// BudgetedResource Declarations.
+// Anything holding video memory (and possibly a CPU copy of it). Resources register with
+// MemoryBudget on construction and leave on destruction.
+class BudgetedResource
+{
+public:
+	// BudgetedResource Public Methods.
+	BudgetedResource();
+	virtual ~BudgetedResource();
+
+	// Name of the resource kind in the memory report.
+	virtual const char* GetResourceType() const = 0;
+	virtual size_t GetGpuBytes() const = 0;
+	virtual size_t GetCpuBytes() const = 0;
+	// Drop the CPU copy if the GPU no longer needs it; returns the bytes freed.
+	virtual size_t ReleaseCpuCopy() { return 0; }
+	// Free some video memory (the top mip level, or the whole resource); returns the bytes
+	// freed, 0 if nothing more can go. An evicted resource reloads itself when used again.
+	virtual size_t Evict() { return 0; }
+
+	// Record a use in the current frame (least recently used resources are evicted first).
+	void MarkUsed();
+	unsigned int GetLastUsedFrame() const { return lastUsedFrame; }
+
+private:
+	// BudgetedResource Private Data.
+	unsigned int lastUsedFrame;
+};
+
+// MemoryBudget Declarations.
+// Accounts the video memory and CPU copies of every registered resource. Once per frame it
+// drops the CPU copies that are no longer needed and, over the video memory budget, evicts
+// the resources that went unused the longest.
+class MemoryBudget
+{
+public:
+	// MemoryBudget Public Methods.
+	static MemoryBudget& Instance();
+
+	void Register(BudgetedResource* resource);
+	void Unregister(BudgetedResource* resource);
+	// Call once per frame before drawing, after the consumers of fresh CPU copies have run.
+	void Update();
+
+	// 0 disables eviction.
+	void SetGpuBudget(const size_t bytes) { gpuBudget = bytes; }
+	size_t GetGpuBudget() const { return gpuBudget; }
+	void SetReleaseCpuCopies(const bool release) { releaseCpuCopies = release; }
+	bool GetReleaseCpuCopies() const { return releaseCpuCopies; }
+
+	unsigned int GetFrame() const { return frame; }
+	size_t GetGpuBytes() const;
+	size_t GetCpuBytes() const;
+	int GetNumEvictions() const { return numEvictions; }
+	void PrintStats() const;
+
+private:
+	// MemoryBudget Private Methods.
+	MemoryBudget();
+	~MemoryBudget();
+
+	// MemoryBudget Private Data.
+	std::vector<BudgetedResource*> resources;
+	unsigned int frame;
+	size_t gpuBudget;
+	bool releaseCpuCopies;
+	int numEvictions;
+	size_t evictedBytes;
+	size_t releasedCpuBytes;
+};
+
+#endif
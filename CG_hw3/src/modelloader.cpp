@@ -0,0 +1,184 @@
+#include "modelloader.h"
+
+#include <algorithm>
+#include <filesystem>
+
+ModelLoader& ModelLoader::Instance()
+{
+	static ModelLoader loader;
+	return loader;
+}
+
+ModelLoader::ModelLoader()
+{
+	completed = std::make_shared<CompletedQueue>();
+	numCancelled = 0;
+}
+
+ModelLoader::~ModelLoader()
+{
+	// The GL context may already be gone: the unfinished meshes are left to the process exit.
+	CancelAll();
+	pending.clear();
+}
+
+void ModelLoader::Request(const std::string& filePath, const int maxOccluderTriangles, const bool normalized)
+{
+	CancelAll();
+
+	LoadJob* job = new LoadJob();
+	job->filePath = filePath;
+	job->maxOccluderTriangles = maxOccluderTriangles;
+	job->normalized = normalized;
+	job->mesh = NewMesh();
+	job->cancelled = false;
+	job->succeeded = false;
+	job->loadMs = 0.0f;
+	job->prefetch = std::make_shared<TexturePrefetch>();
+	job->prefetch->released = false;
+	std::error_code ec;
+	const uintmax_t fileBytes = std::filesystem::file_size(filePath, ec);
+	job->progressive = !ec && fileBytes >= progressiveMinBytes;
+	job->preview = nullptr;
+	job->next = nullptr;
+	pending.push_back(job);
+
+	std::shared_ptr<CompletedQueue> queue = completed;
+	ThreadPool::Instance().Async([job, queue]() {
+		Load(job);
+		queue->Push(job);
+	});
+}
+
+void ModelLoader::CancelAll()
+{
+	for (auto&& job : pending) {
+		if (!job->cancelled.exchange(true))
+			++numCancelled;
+		ReleasePrefetched(*job->prefetch);
+		ReleasePreview(job);
+	}
+}
+
+TriangleMesh* ModelLoader::GetPreview() const
+{
+	if (pending.empty() || pending.back()->cancelled)
+		return nullptr;
+	return pending.back()->preview;
+}
+
+TriangleMesh* ModelLoader::NewMesh()
+{
+	// Created on the GL thread, as resources register with MemoryBudget on construction, but
+	// kept out of the budget (which would read its CPU data every frame) until FinishMesh.
+	TriangleMesh* mesh = new TriangleMesh();
+	MemoryBudget::Instance().Unregister(mesh);
+	return mesh;
+}
+
+bool ModelLoader::BuildMesh(TriangleMesh* mesh, const std::string& filePath, const bool normalized,
+							const int maxOccluderTriangles, const std::shared_ptr<TexturePrefetch>& prefetch,
+							const std::atomic<bool>* cancelled, const TriangleMesh::BatchCallback& onBatch)
+{
+	const bool succeeded = mesh->LoadFromFile(filePath, normalized, cancelled,
+		[prefetch](const std::string& path) {
+			ThreadPool::Instance().RunOnMainThread([prefetch, path]() {
+				if (prefetch->released)
+					return;
+				ImageTexture* texture = TextureManager::Instance().Acquire(path, true, ImageTexture::GetMaterialCompression());
+				if (texture != nullptr)
+					prefetch->textures.push_back(texture);
+			});
+		}, onBatch);
+	if (succeeded && !(cancelled != nullptr && cancelled->load()))
+		mesh->BuildMeshlets();
+	if (succeeded && !(cancelled != nullptr && cancelled->load()))
+		mesh->BuildOccluders(maxOccluderTriangles);
+	return succeeded;
+}
+
+void ModelLoader::FinishMesh(TriangleMesh* mesh)
+{
+	// The materials share the prefetched textures (TextureManager looks them up by path).
+	mesh->AcquireTextures();
+	mesh->CreateBuffers();
+	MemoryBudget::Instance().Register(mesh);
+	mesh->MarkUsed();
+}
+
+void ModelLoader::ReleasePrefetched(TexturePrefetch& prefetch)
+{
+	for (auto&& texture : prefetch.textures)
+		TextureManager::Instance().Release(texture);
+	prefetch.textures.clear();
+	prefetch.released = true;
+}
+
+void ModelLoader::Load(LoadJob* job)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	TriangleMesh::BatchCallback onBatch = nullptr;
+	if (job->progressive)
+		onBatch = [job](MeshBatch* batch) { job->batches.Push(batch); };
+	job->succeeded = BuildMesh(job->mesh, job->filePath, job->normalized, job->maxOccluderTriangles,
+							job->prefetch, &job->cancelled, onBatch);
+	auto endTime = std::chrono::high_resolution_clock::now();
+	job->loadMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+void ModelLoader::ReleasePreview(LoadJob* job)
+{
+	delete job->preview;
+	job->preview = nullptr;
+	MeshBatch* batch = job->batches.PopAll();
+	while (batch != nullptr) {
+		MeshBatch* next = batch->next;
+		delete batch;
+		batch = next;
+	}
+}
+
+TriangleMesh* ModelLoader::Update()
+{
+	// Grow the preview of the current load by the batches parsed since the last frame.
+	if (!pending.empty() && !pending.back()->cancelled && pending.back()->progressive) {
+		LoadJob* current = pending.back();
+		MeshBatch* batch = current->batches.PopAll();
+		while (batch != nullptr) {
+			MeshBatch* next = batch->next;
+			if (current->preview == nullptr)
+				current->preview = new TriangleMesh();
+			current->preview->AppendBatch(*batch);
+			delete batch;
+			batch = next;
+		}
+	}
+
+	TriangleMesh* loaded = nullptr;
+	LoadJob* job = completed->PopAll();
+	while (job != nullptr) {
+		LoadJob* next = job->next;
+		pending.erase(std::remove(pending.begin(), pending.end(), job), pending.end());
+		if (job->cancelled || !job->succeeded) {
+			if (!job->cancelled)
+				std::cerr << "[ERROR] Failed to load model: " << job->filePath << std::endl;
+			// On the GL thread: the materials give their textures back here.
+			delete job->mesh;
+		}
+		else {
+			// Only the latest request is not cancelled, so at most one mesh gets here.
+			auto startTime = std::chrono::high_resolution_clock::now();
+			FinishMesh(job->mesh);
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "Loaded " << job->filePath << ": " << job->loadMs << " ms on a worker, "
+					  << std::chrono::duration<float, std::milli>(endTime - startTime).count()
+					  << " ms on the render thread" << std::endl;
+			loaded = job->mesh;
+		}
+		ReleasePrefetched(*job->prefetch);
+		ReleasePreview(job);
+		delete job;
+		job = next;
+	}
+	return loaded;
+}
@@ -0,0 +1,100 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include "headers.h"
+#include "trianglemesh.h"
+#include "threadpool.h"
+#include <memory>
+#include <atomic>
+
+// ModelLoader Declarations.
+// Loads OBJ models without blocking the render loop: the OBJ and MTL files are parsed and the
+// meshlets and occluders built on the thread pool, and each finished mesh is handed back to
+// the GL thread through a lock-free queue, where Update creates its buffers. The textures do
+// not wait for the geometry: each map_Kd is acquired on the main thread (ThreadPool::
+// RunOnMainThread) as soon as its MTL library is parsed, so it decodes (TextureStreamer)
+// while the OBJ is still being read. A new request cancels the loads it supersedes; until it completes, the
+// caller keeps drawing the previous model. Files of progressiveMinBytes or more load progressively:
+// the faces parsed so far are streamed into a preview mesh (TriangleMesh::AppendBatch) that the
+// caller draws instead, so a huge scan shows up within a frame or two of the request.
+class ModelLoader
+{
+public:
+	// ModelLoader Public Methods.
+	static ModelLoader& Instance();
+
+	// Start loading a model (GL thread); cancels the loads still running.
+	void Request(const std::string& filePath, const int maxOccluderTriangles, const bool normalized = true);
+	void CancelAll();
+	// Finish the loads completed since the last call; call once per frame on the GL thread.
+	// Returns the mesh of the latest request once it is ready (owned by the caller), else nullptr.
+	TriangleMesh* Update();
+
+	// The partly loaded mesh of the latest request while it loads progressively, else nullptr.
+	// Owned by the loader; valid until the next Update, Request or CancelAll.
+	TriangleMesh* GetPreview() const;
+	bool IsLoading() const { return !pending.empty(); }
+	int GetNumCancelled() const { return numCancelled; }
+
+	// The steps of a load, shared with LoadMesh (assetloader.h).
+	// References taken on the announced textures (main thread) until the mesh takes its own;
+	// shared with the queued main-thread tasks, which may run after the load is gone.
+	struct TexturePrefetch
+	{
+		std::vector<ImageTexture*> textures;
+		bool released;
+	};
+	// A mesh for a worker to fill (GL thread).
+	static TriangleMesh* NewMesh();
+	// Parse the OBJ and build the meshlets and occluders (any thread). Each map_Kd is acquired
+	// into prefetch on the main thread as soon as its MTL library is parsed.
+	static bool BuildMesh(TriangleMesh* mesh, const std::string& filePath, const bool normalized,
+						const int maxOccluderTriangles, const std::shared_ptr<TexturePrefetch>& prefetch,
+						const std::atomic<bool>* cancelled = nullptr,
+						const TriangleMesh::BatchCallback& onBatch = nullptr);
+	// Take the textures, create the buffers and hand the mesh to MemoryBudget (GL thread).
+	static void FinishMesh(TriangleMesh* mesh);
+	// Give back the prefetched references (GL thread); later announcements are dropped.
+	static void ReleasePrefetched(TexturePrefetch& prefetch);
+
+private:
+	typedef AtomicQueue<MeshBatch> BatchQueue;
+	// A model being loaded. The worker owns it until it pushes it to the completed queue, the
+	// GL thread from then on.
+	struct LoadJob
+	{
+		std::string filePath;
+		int maxOccluderTriangles;
+		bool normalized;
+		TriangleMesh* mesh;
+		std::atomic<bool> cancelled;
+		bool succeeded;
+		float loadMs;
+		std::shared_ptr<TexturePrefetch> prefetch;
+		// Progressive loads: the batches parsed and not yet drawn, and the mesh drawing the
+		// others (GL thread).
+		bool progressive;
+		BatchQueue batches;
+		TriangleMesh* preview;
+		LoadJob* next;
+	};
+	// Completed jobs; held by shared_ptr so a job still running at exit does not outlive it.
+	typedef AtomicQueue<LoadJob> CompletedQueue;
+
+	// ModelLoader Private Methods.
+	ModelLoader();
+	~ModelLoader();
+	// Build the CPU data of job->mesh (any thread).
+	static void Load(LoadJob* job);
+	static void ReleasePreview(LoadJob* job);
+
+	static const uintmax_t progressiveMinBytes = 64 * 1024 * 1024;
+
+	// ModelLoader Private Data.
+	// Requested and not yet completed (GL thread only).
+	std::vector<LoadJob*> pending;
+	std::shared_ptr<CompletedQueue> completed;
+	int numCancelled;
+};
+
+#endif
@@ -0,0 +1,1190 @@
+#include "outofcoremesh.h"
+#include "threadpool.h"
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Layout of the *.ocm files: this header, the materials (each an OutOfCoreMaterial followed by
+// its name and map_Kd path), the page table and the pages, each its vertices (VertexPTN) then
+// its indices (unsigned int, into the vertices of the page).
+struct OutOfCoreHeader
+{
+	char magic[4];			// "OOCM".
+	uint32_t version;
+	uint64_t sourceSize;	// The model the pages came from, to detect edits.
+	int64_t sourceTime;
+	int32_t numMaterials;	// One per submesh.
+	int32_t numPages;
+	int32_t pageTriangles;
+	int32_t vertexBytes;	// sizeof(VertexPTN) of the writer.
+};
+struct OutOfCoreMaterial
+{
+	float Ka[3];
+	float Kd[3];
+	float Ks[3];
+	float Ns;
+	uint32_t nameLength;
+	uint32_t mapKdPathLength;
+};
+struct OutOfCorePageRecord
+{
+	float center[3];
+	float radius;
+	float error;
+	int32_t subMesh;
+	int32_t firstChild;		// Pages of the next finer level.
+	int32_t numChildren;
+	uint32_t numVertices;
+	uint32_t numIndices;
+	uint64_t offset;
+};
+static const uint32_t outOfCoreVersion = 1;
+
+// Read-only mapping of a file, a range at a time, so only the pages in flight take address
+// space and memory.
+struct OutOfCoreMesh::MappedFile
+{
+	MappedFile() {
+#ifdef _WIN32
+		fileHandle = INVALID_HANDLE_VALUE;
+		mappingHandle = nullptr;
+#else
+		fd = -1;
+#endif
+		granularity = 4096;
+		writable = false;
+	}
+	~MappedFile() {
+#ifdef _WIN32
+		if (mappingHandle != nullptr)
+			CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(fileHandle);
+#else
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+
+	// Writable mappings (of the build's scratch files) write through to the file.
+	bool Open(const std::string& path, const bool writable = false) {
+		this->writable = writable;
+#ifdef _WIN32
+		fileHandle = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ,
+								nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+		mappingHandle = CreateFileMappingA(fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		if (mappingHandle == nullptr)
+			return false;
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		granularity = info.dwAllocationGranularity;
+#else
+		fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+			return false;
+		granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+		return true;
+	}
+	// Map [offset, offset + numBytes): returns its first byte (nullptr on failure) and the view
+	// to unmap, which starts at the mapping granularity below.
+	const uint8_t* Map(const uint64_t offset, const size_t numBytes, void*& view, size_t& viewBytes) const {
+		const uint64_t start = offset - offset % granularity;
+		viewBytes = (size_t)(offset - start) + numBytes;
+#ifdef _WIN32
+		view = MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(start >> 32),
+							(DWORD)(start & 0xFFFFFFFFu), viewBytes);
+		if (view == nullptr)
+			return nullptr;
+#else
+		view = mmap(nullptr, viewBytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE,
+					fd, (off_t)start);
+		if (view == MAP_FAILED) {
+			view = nullptr;
+			return nullptr;
+		}
+		madvise(view, viewBytes, MADV_WILLNEED);
+#endif
+		return (const uint8_t*)view + (offset - start);
+	}
+	static void Unmap(void* view, const size_t viewBytes) {
+		if (view == nullptr)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(view);
+#else
+		munmap(view, viewBytes);
+#endif
+	}
+
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#else
+	int fd;
+#endif
+	uint64_t granularity;
+	bool writable;
+};
+
+// A scratch file of the build (attribute arrays, triangle bins): written through a stream,
+// then mapped whole, so the operating system pages it in and out instead of it taking memory.
+// Deleted with the object.
+struct OutOfCoreMesh::ScratchFile
+{
+	ScratchFile(const std::string& path) : path(path) {
+		view = nullptr;
+		viewBytes = 0;
+	}
+	~ScratchFile() {
+		Unmap();
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+	// The contents, or nullptr if the file is empty or cannot be mapped.
+	uint8_t* Map(const bool writable) {
+		Unmap();
+		std::error_code ec;
+		const uint64_t numBytes = (uint64_t)std::filesystem::file_size(path, ec);
+		if (ec || numBytes == 0)
+			return nullptr;
+		file.reset(new MappedFile());
+		if (!file->Open(path, writable))
+			return nullptr;
+		return (uint8_t*)file->Map(0, (size_t)numBytes, view, viewBytes);
+	}
+	void Unmap() {
+		MappedFile::Unmap(view, viewBytes);
+		view = nullptr;
+		file.reset();
+	}
+
+	std::string path;
+	std::unique_ptr<MappedFile> file;
+	void* view;
+	size_t viewBytes;
+};
+
+// A page being built (Build).
+struct BuildPage
+{
+	std::vector<VertexPTN> vertices;
+	std::vector<unsigned int> indices;
+	glm::vec3 center;
+	float radius;
+	float error;
+	int firstChild;
+	int numChildren;
+};
+
+// A triangle of the build, binned by the top bits of its Morton code.
+struct BinTriangle
+{
+	uint32_t subMesh;
+	uint32_t mortonCode;
+	VertexPTN corners[3];
+};
+// At most 2^maxBinBits bins (open files) in a build.
+static const int maxBinBits = 8;
+
+// Morton code of a point of the normalized model ([-0.5, 0.5]^3), 10 bits an axis.
+static uint32_t MortonCode(const glm::vec3& p)
+{
+	auto Spread = [](uint32_t v) {
+		v = (v | (v << 16)) & 0x030000FFu;
+		v = (v | (v << 8)) & 0x0300F00Fu;
+		v = (v | (v << 4)) & 0x030C30C3u;
+		v = (v | (v << 2)) & 0x09249249u;
+		return v;
+	};
+	auto Quantize = [](const float x) { return (uint32_t)std::min(std::max((x + 0.5f) * 1023.0f, 0.0f), 1023.0f); };
+	return (Spread(Quantize(p.x)) << 2) | (Spread(Quantize(p.y)) << 1) | Spread(Quantize(p.z));
+}
+
+// Bounding sphere around the AABB center.
+static void ComputeBounds(BuildPage& page)
+{
+	glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+	for (auto&& vertex : page.vertices) {
+		minPos = glm::min(minPos, vertex.position);
+		maxPos = glm::max(maxPos, vertex.position);
+	}
+	page.center = 0.5f * (minPos + maxPos);
+	page.radius = 0.0f;
+	for (auto&& vertex : page.vertices)
+		page.radius = std::max(page.radius, glm::distance(page.center, vertex.position));
+}
+
+// Vertices of a finest page are merged by value.
+struct VertexHash
+{
+	size_t operator()(const VertexPTN& vertex) const {
+		uint32_t words[sizeof(VertexPTN) / 4];
+		std::memcpy(words, &vertex, sizeof(words));
+		uint64_t hash = 14695981039346656037ull;
+		for (auto&& word : words) {
+			hash ^= word;
+			hash *= 1099511628211ull;
+		}
+		return (size_t)hash;
+	}
+};
+struct VertexEqual
+{
+	bool operator()(const VertexPTN& a, const VertexPTN& b) const { return std::memcmp(&a, &b, sizeof(VertexPTN)) == 0; }
+};
+
+// A finest-level page from a run of triangles.
+static void BuildFinestPage(const std::vector<BinTriangle>& triangles, BuildPage& page)
+{
+	std::unordered_map<VertexPTN, unsigned int, VertexHash, VertexEqual> local;
+	page.vertices.clear();
+	page.indices.clear();
+	for (auto&& triangle : triangles) {
+		for (int k = 0; k < 3; ++k) {
+			auto it = local.emplace(triangle.corners[k], (unsigned int)page.vertices.size());
+			if (it.second)
+				page.vertices.push_back(triangle.corners[k]);
+			page.indices.push_back(it.first->second);
+		}
+	}
+	ComputeBounds(page);
+	page.error = 0.0f;
+	page.firstChild = -1;
+	page.numChildren = 0;
+}
+
+// Vertex clustering: snap the vertices to a grid of cellSize from origin, merge those in the
+// same cell (average position and normal) and drop the triangles that collapse.
+static void ClusterVertices(const BuildPage& source, const glm::vec3& origin, const float cellSize, BuildPage& page)
+{
+	std::unordered_map<uint64_t, unsigned int> cells;
+	std::vector<unsigned int> remap(source.vertices.size());
+	std::vector<int> counts;
+	page.vertices.clear();
+	page.indices.clear();
+	for (size_t i = 0; i < source.vertices.size(); ++i) {
+		const VertexPTN& vertex = source.vertices[i];
+		const glm::vec3 cell = (vertex.position - origin) / cellSize;
+		const uint64_t x = (uint64_t)std::min(std::max(std::floor(cell.x), 0.0f), 2097151.0f);
+		const uint64_t y = (uint64_t)std::min(std::max(std::floor(cell.y), 0.0f), 2097151.0f);
+		const uint64_t z = (uint64_t)std::min(std::max(std::floor(cell.z), 0.0f), 2097151.0f);
+		auto it = cells.emplace(x | (y << 21) | (z << 42), (unsigned int)page.vertices.size());
+		if (it.second) {
+			// The texture coordinates of the first vertex: averaging across a seam would smear.
+			page.vertices.push_back(VertexPTN(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), vertex.texcoord));
+			counts.push_back(0);
+		}
+		const unsigned int merged = it.first->second;
+		page.vertices[merged].position += vertex.position;
+		page.vertices[merged].normal += vertex.normal;
+		counts[merged]++;
+		remap[i] = merged;
+	}
+	for (size_t i = 0; i < page.vertices.size(); ++i) {
+		page.vertices[i].position /= (float)counts[i];
+		const float length = glm::length(page.vertices[i].normal);
+		page.vertices[i].normal = length > 0.0f ? page.vertices[i].normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+	for (size_t i = 0; i + 2 < source.indices.size(); i += 3) {
+		const unsigned int a = remap[source.indices[i]];
+		const unsigned int b = remap[source.indices[i + 1]];
+		const unsigned int c = remap[source.indices[i + 2]];
+		if (a == b || b == c || c == a)
+			continue;
+		page.indices.push_back(a);
+		page.indices.push_back(b);
+		page.indices.push_back(c);
+	}
+}
+
+// A coarser page from children [first, first + count) of level: merged, then clustered on a
+// grid coarse enough to bring it down to about pageTriangles triangles.
+static void SimplifyPages(const std::vector<BuildPage>& level, const int first, const int count, BuildPage& page)
+{
+	BuildPage merged;
+	float childError = 0.0f;
+	for (int i = first; i < first + count; ++i) {
+		const unsigned int base = (unsigned int)merged.vertices.size();
+		merged.vertices.insert(merged.vertices.end(), level[i].vertices.begin(), level[i].vertices.end());
+		for (auto&& index : level[i].indices)
+			merged.indices.push_back(base + index);
+		childError = std::max(childError, level[i].error);
+	}
+
+	if (merged.indices.size() / 3 <= (size_t)OutOfCoreMesh::pageTriangles) {
+		page.vertices.swap(merged.vertices);
+		page.indices.swap(merged.indices);
+		page.error = childError;
+	}
+	else {
+		glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+		for (auto&& vertex : merged.vertices) {
+			minPos = glm::min(minPos, vertex.position);
+			maxPos = glm::max(maxPos, vertex.position);
+		}
+		const float extent = std::max(std::max(maxPos.x - minPos.x, maxPos.y - minPos.y), std::max(maxPos.z - minPos.z, 1e-6f));
+		// A surface keeps about two triangles per occupied cell; refine the guess until it fits.
+		float resolution = 2.0f * std::sqrt((float)OutOfCoreMesh::pageTriangles);
+		float cellSize = extent / resolution;
+		for (int attempt = 0; attempt < 16; ++attempt) {
+			cellSize = extent / resolution;
+			ClusterVertices(merged, minPos, cellSize, page);
+			const size_t numTriangles = page.indices.size() / 3;
+			if (numTriangles <= (size_t)OutOfCoreMesh::pageTriangles)
+				break;
+			resolution *= std::max(0.5f, 0.95f * std::sqrt((float)OutOfCoreMesh::pageTriangles / (float)numTriangles));
+		}
+		// A vertex moves at most a cell diagonal away from the surface of the children.
+		page.error = childError + cellSize * std::sqrt(3.0f);
+	}
+
+	// Enclose the children's spheres, so culling a page also culls its whole subtree.
+	glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+	for (int i = first; i < first + count; ++i) {
+		minPos = glm::min(minPos, level[i].center - glm::vec3(level[i].radius));
+		maxPos = glm::max(maxPos, level[i].center + glm::vec3(level[i].radius));
+	}
+	page.center = 0.5f * (minPos + maxPos);
+	page.radius = 0.0f;
+	for (int i = first; i < first + count; ++i)
+		page.radius = std::max(page.radius, glm::distance(page.center, level[i].center) + level[i].radius);
+}
+
+OutOfCoreMesh::OutOfCoreMesh()
+{
+	loaded = std::make_shared<LoadedQueue>();
+	numPagesInFlight = 0;
+	residentBytes = 0;
+	budgetBytes = (size_t)256 * 1024 * 1024;
+	maxPixelError = 1.0f;
+	frame = 1;
+	numPagesUploaded = 0;
+	numPagesEvicted = 0;
+	numTrianglesDrawn = 0;
+}
+
+OutOfCoreMesh::LoadedQueue::~LoadedQueue()
+{
+	for (auto&& page : pages)
+		MappedFile::Unmap(page.view, page.viewBytes);
+}
+
+OutOfCoreMesh::~OutOfCoreMesh()
+{
+	// Reads still in flight finish into the queue, which they keep alive; it unmaps what it
+	// holds once the last of them lets go.
+	loaded.reset();
+	for (int i = 0; i < (int)pages.size(); ++i) {
+		if (pages[i].vboId != 0)
+			ReleasePage(i);
+	}
+	for (auto&& material : materials)
+		delete material;
+	materials.clear();
+}
+
+bool OutOfCoreMesh::Build(const std::string& objPath)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	std::ifstream objIn(objPath);
+	if (!objIn) {
+		std::cerr << "[ERROR] Failed to load model to page: " << objPath << std::endl;
+		return false;
+	}
+	const std::string pagePath = GetPagePath(objPath);
+
+	// Faces are read the same way by every pass: the corners' indices, 3 each, and whether
+	// the face is usable (false for a bad index or fewer than 3 corners).
+	int numPositions = 0, numTexcoords = 0, numNormals = 0;
+	std::vector<int> faceCorners;
+	auto ParseFace = [&](std::istringstream& iss) {
+		faceCorners.clear();
+		std::string corner;
+		while (iss >> corner) {
+			int index[3];
+			if (!TriangleMesh::ParseFaceCorner(corner, numPositions, numTexcoords, numNormals, index))
+				return false;
+			faceCorners.insert(faceCorners.end(), index, index + 3);
+		}
+		return faceCorners.size() >= 9;
+	};
+	auto Rewind = [&]() {
+		objIn.clear();
+		objIn.seekg(0);
+		numPositions = numTexcoords = numNormals = 0;
+	};
+
+	// Pass 1: the attributes go to scratch files (only the faces' indices into them are kept
+	// in memory, a face at a time), the bounding box and the triangles of each submesh are
+	// counted and the material libraries are read.
+	ScratchFile positionFile(pagePath + ".v.tmp");
+	ScratchFile texcoordFile(pagePath + ".vt.tmp");
+	ScratchFile normalFile(pagePath + ".vn.tmp");
+	std::ofstream positionOut(positionFile.path, std::ios::binary);
+	std::ofstream texcoordOut(texcoordFile.path, std::ios::binary);
+	std::ofstream normalOut(normalFile.path, std::ios::binary);
+	glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+	std::map<std::string, std::unique_ptr<PhongMaterial>> materials;
+	// Submeshes by material name, in order of first use; faces before any usemtl go to "".
+	std::vector<std::string> subMeshNames;
+	std::vector<uint64_t> subMeshTriangles;
+	int subMesh = -1;
+	auto SelectSubMesh = [&](const std::string& name) {
+		auto it = std::find(subMeshNames.begin(), subMeshNames.end(), name);
+		subMesh = (int)(it - subMeshNames.begin());
+		if (it == subMeshNames.end()) {
+			subMeshNames.push_back(name);
+			subMeshTriangles.push_back(0);
+		}
+	};
+	bool missingNormals = false;
+	bool reportedBadFace = false;
+	uint64_t numTriangles = 0;
+	std::string line;
+	while (std::getline(objIn, line)) {
+		std::istringstream iss(line);
+		std::string type;
+		iss >> type;
+		if (type == "v") {
+			glm::vec3 position(0.0f, 0.0f, 0.0f);
+			iss >> position.x >> position.y >> position.z;
+			positionOut.write((const char*)&position, sizeof(position));
+			minPos = glm::min(minPos, position);
+			maxPos = glm::max(maxPos, position);
+			++numPositions;
+		}
+		else if (type == "vt") {
+			glm::vec2 texcoord(0.0f, 0.0f);
+			iss >> texcoord.x >> texcoord.y;
+			texcoordOut.write((const char*)&texcoord, sizeof(texcoord));
+			++numTexcoords;
+		}
+		else if (type == "vn") {
+			glm::vec3 normal(0.0f, 0.0f, 0.0f);
+			iss >> normal.x >> normal.y >> normal.z;
+			normalOut.write((const char*)&normal, sizeof(normal));
+			++numNormals;
+		}
+		else if (type == "f") {
+			if (!ParseFace(iss)) {
+				if (!reportedBadFace) {
+					std::cerr << "Error: skipping invalid faces in OBJ file: " << objPath << " (" << line << ")" << std::endl;
+					reportedBadFace = true;
+				}
+				continue;
+			}
+			if (subMesh < 0)
+				SelectSubMesh("");
+			for (size_t i = 2; i < faceCorners.size(); i += 3)
+				missingNormals |= faceCorners[i] < 0;
+			subMeshTriangles[subMesh] += faceCorners.size() / 3 - 2;
+			numTriangles += faceCorners.size() / 3 - 2;
+		}
+		else if (type == "usemtl") {
+			std::string mtlName;
+			iss >> mtlName;
+			SelectSubMesh(mtlName);
+		}
+		else if (type == "mtllib") {
+			std::string mtlfileName;
+			iss >> mtlfileName;
+			std::string mtlfilePath = objPath;
+			size_t lastSlashPos = mtlfilePath.find_last_of('/');
+			if (lastSlashPos != std::string::npos)
+				mtlfilePath.replace(lastSlashPos + 1, std::string::npos, mtlfileName);
+			// A later definition of a name replaces an earlier one.
+			std::map<std::string, PhongMaterial*> libMaterials;
+			TriangleMesh::LoadMTLLib(mtlfilePath, libMaterials);
+			for (auto&& material : libMaterials)
+				materials[material.first].reset(material.second);
+		}
+	}
+	positionOut.close();
+	texcoordOut.close();
+	normalOut.close();
+	if (numTriangles == 0) {
+		std::cerr << "[ERROR] No triangles to page: " << objPath << std::endl;
+		return false;
+	}
+	const glm::vec3* positions = (const glm::vec3*)positionFile.Map(false);
+	const glm::vec2* texcoords = (const glm::vec2*)texcoordFile.Map(false);
+	const glm::vec3* normals = (const glm::vec3*)normalFile.Map(false);
+	if (positions == nullptr || (numTexcoords > 0 && texcoords == nullptr) || (numNormals > 0 && normals == nullptr)) {
+		std::cerr << "[ERROR] Cannot map scratch files to page: " << objPath << std::endl;
+		return false;
+	}
+	// Normalized as TriangleMesh::LoadFromFile does it.
+	const glm::vec3 objCenter = 0.5f * (minPos + maxPos);
+	const float maxLen = std::max(std::max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
+	const float scale = maxLen > 0.0f ? 1.0f / maxLen : 1.0f;
+
+	// Pass 2, for the corners without a normal (all of them with recomputed normals): the
+	// normals of the faces around each position, weighted by area and corner angle, summed
+	// in a scratch file. Paged models are smoothed across every edge (no crease angle).
+	const bool recomputeNormals = TriangleMesh::GetRecomputeNormals();
+	ScratchFile smoothFile(pagePath + ".sn.tmp");
+	glm::vec3* smoothNormals = nullptr;
+	if (missingNormals || recomputeNormals) {
+		std::ofstream smoothOut(smoothFile.path, std::ios::binary);
+		smoothOut.seekp((std::streamoff)numPositions * sizeof(glm::vec3) - 1);
+		smoothOut.put('\0');
+		smoothOut.close();
+		smoothNormals = (glm::vec3*)smoothFile.Map(true);
+		if (smoothNormals == nullptr) {
+			std::cerr << "[ERROR] Cannot map scratch files to page: " << objPath << std::endl;
+			return false;
+		}
+		Rewind();
+		while (std::getline(objIn, line)) {
+			std::istringstream iss(line);
+			std::string type;
+			iss >> type;
+			if (type == "v")
+				++numPositions;
+			else if (type == "vt")
+				++numTexcoords;
+			else if (type == "vn")
+				++numNormals;
+			else if (type == "f" && ParseFace(iss)) {
+				for (size_t i = 6; i < faceCorners.size(); i += 3) {
+					const int triangle[3] = { faceCorners[0], faceCorners[i - 3], faceCorners[i] };
+					const glm::vec3 p[3] = { positions[triangle[0]], positions[triangle[1]], positions[triangle[2]] };
+					const glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+					const float length = glm::length(normal);
+					if (length <= 0.0f)
+						continue;
+					for (int k = 0; k < 3; ++k) {
+						const glm::vec3 e1 = p[(k + 1) % 3] - p[k];
+						const glm::vec3 e2 = p[(k + 2) % 3] - p[k];
+						const float lengths = glm::length(e1) * glm::length(e2);
+						const float angle = lengths > 0.0f ? std::acos(glm::clamp(glm::dot(e1, e2) / lengths, -1.0f, 1.0f)) : 0.0f;
+						smoothNormals[triangle[k]] += normal / length * (0.5f * length * angle);
+					}
+				}
+			}
+		}
+	}
+
+	// Pass 3: the triangles, with their vertices complete, go to bins by the top bits of the
+	// Morton code of their centers, about binBytes each, so a bin in order is a run of the
+	// model in Morton order that fits in memory.
+	const uint64_t binBytes = (uint64_t)64 * 1024 * 1024;
+	int binBits = 0;
+	while (binBits < maxBinBits && (numTriangles * sizeof(BinTriangle)) >> binBits > binBytes)
+		++binBits;
+	std::vector<std::unique_ptr<ScratchFile>> binFiles;
+	std::vector<std::ofstream> binOuts(1 << binBits);
+	for (int b = 0; b < (1 << binBits); ++b) {
+		binFiles.emplace_back(new ScratchFile(pagePath + ".bin" + std::to_string(b) + ".tmp"));
+		binOuts[b].open(binFiles[b]->path, std::ios::binary);
+	}
+	Rewind();
+	subMesh = -1;
+	std::vector<VertexPTN> faceVertices;
+	while (std::getline(objIn, line)) {
+		std::istringstream iss(line);
+		std::string type;
+		iss >> type;
+		if (type == "v")
+			++numPositions;
+		else if (type == "vt")
+			++numTexcoords;
+		else if (type == "vn")
+			++numNormals;
+		else if (type == "usemtl") {
+			std::string mtlName;
+			iss >> mtlName;
+			SelectSubMesh(mtlName);
+		}
+		else if (type == "f" && ParseFace(iss)) {
+			if (subMesh < 0)
+				SelectSubMesh("");
+			const int cntVertices = (int)faceCorners.size() / 3;
+			const glm::vec3 faceNormal = glm::cross(positions[faceCorners[3]] - positions[faceCorners[0]],
+													positions[faceCorners[6]] - positions[faceCorners[0]]);
+			const float faceLength = glm::length(faceNormal);
+			faceVertices.resize(cntVertices);
+			for (int i = 0; i < cntVertices; ++i) {
+				const int* index = &faceCorners[3 * i];
+				VertexPTN& vertex = faceVertices[i];
+				vertex.position = (positions[index[0]] - objCenter) * scale;
+				vertex.texcoord = index[1] >= 0 ? texcoords[index[1]] : glm::vec2(0.0f, 0.0f);
+				glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);
+				if (index[2] >= 0 && !recomputeNormals)
+					normal = normals[index[2]];
+				else {
+					const float length = glm::length(smoothNormals[index[0]]);
+					if (length > 0.0f)
+						normal = smoothNormals[index[0]] / length;
+					else if (faceLength > 0.0f)
+						normal = faceNormal / faceLength;
+					else
+						normal = glm::vec3(0.0f, 1.0f, 0.0f);
+				}
+				vertex.normal = normal;
+			}
+			for (int i = 2; i < cntVertices; ++i) {
+				BinTriangle triangle;
+				triangle.subMesh = (uint32_t)subMesh;
+				triangle.corners[0] = faceVertices[0];
+				triangle.corners[1] = faceVertices[i - 1];
+				triangle.corners[2] = faceVertices[i];
+				triangle.mortonCode = MortonCode((triangle.corners[0].position + triangle.corners[1].position
+												+ triangle.corners[2].position) / 3.0f);
+				binOuts[triangle.mortonCode >> (30 - binBits)].write((const char*)&triangle, sizeof(triangle));
+			}
+		}
+	}
+	objIn.close();
+	for (auto&& binOut : binOuts)
+		binOut.close();
+	positionFile.Unmap();
+	texcoordFile.Unmap();
+	normalFile.Unmap();
+	smoothFile.Unmap();
+
+	// Each level groups pageChildren pages of the one below, so the page count is known ahead
+	// and the pages can be written as they are built, behind the page table. The levels of
+	// each submesh are numbered finest first.
+	const int numSubMeshes = (int)subMeshNames.size();
+	std::vector<std::vector<int>> levelFirst(numSubMeshes), levelCount(numSubMeshes);
+	int numPages = 0;
+	int numLevels = 0;
+	for (int s = 0; s < numSubMeshes; ++s) {
+		int levelPages = (int)((subMeshTriangles[s] + pageTriangles - 1) / pageTriangles);
+		while (levelPages > 0) {
+			levelFirst[s].push_back(numPages);
+			levelCount[s].push_back(levelPages);
+			numPages += levelPages;
+			if (levelPages == 1)
+				break;
+			levelPages = (levelPages + pageChildren - 1) / pageChildren;
+		}
+		numLevels = std::max(numLevels, (int)levelFirst[s].size());
+	}
+
+	OutOfCoreHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic[0] = 'O'; header.magic[1] = 'O'; header.magic[2] = 'C'; header.magic[3] = 'M';
+	header.version = outOfCoreVersion;
+	std::error_code ec;
+	header.sourceSize = (uint64_t)std::filesystem::file_size(objPath, ec);
+	header.sourceTime = (int64_t)std::filesystem::last_write_time(objPath, ec).time_since_epoch().count();
+	header.numMaterials = (int32_t)numSubMeshes;
+	header.numPages = numPages;
+	header.pageTriangles = pageTriangles;
+	header.vertexBytes = (int32_t)sizeof(VertexPTN);
+
+	std::string materialData;
+	for (int s = 0; s < numSubMeshes; ++s) {
+		// No usemtl, or one naming no material of the libraries: plain gray.
+		PhongMaterial defaultMaterial;
+		defaultMaterial.SetName(subMeshNames[s]);
+		defaultMaterial.SetKa(glm::vec3(0.1f, 0.1f, 0.1f));
+		defaultMaterial.SetKd(glm::vec3(0.6f, 0.6f, 0.6f));
+		defaultMaterial.SetKs(glm::vec3(0.2f, 0.2f, 0.2f));
+		defaultMaterial.SetNs(16.0f);
+		auto it = materials.find(subMeshNames[s]);
+		const PhongMaterial* material = it != materials.end() ? it->second.get() : &defaultMaterial;
+		OutOfCoreMaterial record;
+		for (int i = 0; i < 3; ++i) {
+			record.Ka[i] = material->GetKa()[i];
+			record.Kd[i] = material->GetKd()[i];
+			record.Ks[i] = material->GetKs()[i];
+		}
+		record.Ns = material->GetNs();
+		record.nameLength = (uint32_t)material->GetName().size();
+		record.mapKdPathLength = (uint32_t)material->GetMapKdPath().size();
+		materialData.append((const char*)&record, sizeof(record));
+		materialData.append(material->GetName());
+		materialData.append(material->GetMapKdPath());
+	}
+
+	// Read back too: the coarser levels are built from the pages already written.
+	std::fstream out(pagePath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write out-of-core mesh: " << pagePath << std::endl;
+		return false;
+	}
+	std::vector<OutOfCorePageRecord> records(numPages);
+	uint64_t writeOffset = sizeof(header) + materialData.size() + records.size() * sizeof(OutOfCorePageRecord);
+	auto WritePage = [&](const BuildPage& page, const int subMesh, const int index) {
+		OutOfCorePageRecord& record = records[index];
+		record.center[0] = page.center.x;
+		record.center[1] = page.center.y;
+		record.center[2] = page.center.z;
+		record.radius = page.radius;
+		record.error = page.error;
+		record.subMesh = subMesh;
+		record.firstChild = page.firstChild;
+		record.numChildren = page.numChildren;
+		record.numVertices = (uint32_t)page.vertices.size();
+		record.numIndices = (uint32_t)page.indices.size();
+		record.offset = writeOffset;
+		out.seekp((std::streamoff)writeOffset);
+		out.write((const char*)page.vertices.data(), page.vertices.size() * sizeof(VertexPTN));
+		out.write((const char*)page.indices.data(), page.indices.size() * sizeof(unsigned int));
+		writeOffset += page.vertices.size() * sizeof(VertexPTN) + page.indices.size() * sizeof(unsigned int);
+	};
+	auto ReadPage = [&](const int index, BuildPage& page) {
+		const OutOfCorePageRecord& record = records[index];
+		page.vertices.resize(record.numVertices);
+		page.indices.resize(record.numIndices);
+		out.seekg((std::streamoff)record.offset);
+		out.read((char*)page.vertices.data(), page.vertices.size() * sizeof(VertexPTN));
+		out.read((char*)page.indices.data(), page.indices.size() * sizeof(unsigned int));
+		page.center = glm::vec3(record.center[0], record.center[1], record.center[2]);
+		page.radius = record.radius;
+		page.error = record.error;
+	};
+
+	// Finest level: runs of pageTriangles triangles of each submesh, filled bin by bin, so
+	// they follow the Morton order of the whole submesh.
+	std::vector<std::vector<BinTriangle>> pending(numSubMeshes);
+	std::vector<int> numFinestPages(numSubMeshes, 0);
+	std::vector<std::pair<int, std::vector<BinTriangle>>> runs;
+	auto WriteRuns = [&]() {
+		std::vector<BuildPage> runPages(runs.size());
+		ThreadPool::Instance().ParallelFor(0, (int)runs.size(), [&](int begin, int end) {
+			for (int r = begin; r < end; ++r)
+				BuildFinestPage(runs[r].second, runPages[r]);
+		}, 1);
+		for (size_t r = 0; r < runs.size(); ++r) {
+			const int s = runs[r].first;
+			WritePage(runPages[r], s, levelFirst[s][0] + numFinestPages[s]++);
+		}
+		runs.clear();
+	};
+	for (int b = 0; b < (1 << binBits); ++b) {
+		std::vector<BinTriangle> triangles;
+		{
+			std::ifstream binIn(binFiles[b]->path, std::ios::binary | std::ios::ate);
+			triangles.resize((size_t)binIn.tellg() / sizeof(BinTriangle));
+			binIn.seekg(0);
+			binIn.read((char*)triangles.data(), triangles.size() * sizeof(BinTriangle));
+		}
+		binFiles[b].reset();
+		std::stable_sort(triangles.begin(), triangles.end(), [](const BinTriangle& x, const BinTriangle& y) {
+			return x.subMesh != y.subMesh ? x.subMesh < y.subMesh : x.mortonCode < y.mortonCode;
+		});
+		for (auto&& triangle : triangles) {
+			std::vector<BinTriangle>& run = pending[triangle.subMesh];
+			run.push_back(triangle);
+			if (run.size() == (size_t)pageTriangles) {
+				runs.push_back(std::make_pair((int)triangle.subMesh, std::vector<BinTriangle>()));
+				runs.back().second.swap(run);
+			}
+		}
+		WriteRuns();
+	}
+	for (int s = 0; s < numSubMeshes; ++s) {
+		if (!pending[s].empty()) {
+			runs.push_back(std::make_pair(s, std::vector<BinTriangle>()));
+			runs.back().second.swap(pending[s]);
+		}
+	}
+	WriteRuns();
+
+	// Coarser levels, until a single root page, a batch of parents at a time (their children
+	// read back from the file).
+	const int batchParents = std::max(1, 2 * ThreadPool::Instance().GetNumThreads());
+	for (int s = 0; s < numSubMeshes; ++s) {
+		for (size_t l = 1; l < levelFirst[s].size(); ++l) {
+			const int childFirst = levelFirst[s][l - 1];
+			const int numChildren = levelCount[s][l - 1];
+			for (int p0 = 0; p0 < levelCount[s][l]; p0 += batchParents) {
+				const int p1 = std::min(levelCount[s][l], p0 + batchParents);
+				const int c0 = p0 * pageChildren;
+				std::vector<BuildPage> children(std::min(numChildren, p1 * pageChildren) - c0);
+				for (int c = 0; c < (int)children.size(); ++c)
+					ReadPage(childFirst + c0 + c, children[c]);
+				std::vector<BuildPage> parents(p1 - p0);
+				ThreadPool::Instance().ParallelFor(p0, p1, [&](int begin, int end) {
+					for (int p = begin; p < end; ++p) {
+						const int first = p * pageChildren;
+						const int count = std::min((int)pageChildren, numChildren - first);
+						BuildPage& parent = parents[p - p0];
+						SimplifyPages(children, first - c0, count, parent);
+						parent.firstChild = childFirst + first;
+						parent.numChildren = count;
+					}
+				}, 1);
+				for (int p = p0; p < p1; ++p)
+					WritePage(parents[p - p0], s, levelFirst[s][l] + p);
+			}
+		}
+	}
+
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.write(materialData.data(), materialData.size());
+	out.write((const char*)records.data(), records.size() * sizeof(OutOfCorePageRecord));
+	out.close();
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write out-of-core mesh: " << pagePath << std::endl;
+		return false;
+	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	std::cout << "Paged " << objPath << ": " << numTriangles << " triangles in " << numPages << " pages of up to "
+			  << pageTriangles << ", " << numLevels << " levels, " << writeOffset / (1024 * 1024) << " MB ("
+			  << (1 << binBits) << " bins) in " << std::chrono::duration<float, std::milli>(endTime - startTime).count()
+			  << " ms" << std::endl;
+	return true;
+}
+
+bool OutOfCoreMesh::Open(const std::string& objPath)
+{
+	pagePath = GetPagePath(objPath);
+	std::ifstream in(pagePath, std::ios::binary);
+	OutOfCoreHeader header;
+	if (!in.read((char*)&header, sizeof(header)) || std::strncmp(header.magic, "OOCM", 4) != 0
+		|| header.version != outOfCoreVersion || header.pageTriangles != pageTriangles
+		|| header.vertexBytes != (int32_t)sizeof(VertexPTN) || header.numMaterials < 1 || header.numPages < 1) {
+		std::cerr << "[ERROR] Not an out-of-core mesh: " << pagePath << std::endl;
+		return false;
+	}
+	// The source may be gone (only the pages are needed), but must not be newer.
+	std::error_code ec;
+	if (std::filesystem::exists(objPath, ec)) {
+		const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(objPath, ec);
+		const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(objPath, ec).time_since_epoch().count();
+		if (header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+			std::cerr << "[ERROR] Out-of-core mesh is older than its model (page it again): " << pagePath << std::endl;
+			return false;
+		}
+	}
+
+	for (int i = 0; i < header.numMaterials; ++i) {
+		OutOfCoreMaterial record;
+		if (!in.read((char*)&record, sizeof(record))) {
+			std::cerr << "[ERROR] Truncated out-of-core mesh: " << pagePath << std::endl;
+			return false;
+		}
+		std::string name(record.nameLength, '\0');
+		std::string mapKdPath(record.mapKdPathLength, '\0');
+		in.read(&name[0], name.size());
+		in.read(&mapKdPath[0], mapKdPath.size());
+		PhongMaterial* material = new PhongMaterial();
+		material->SetName(name);
+		material->SetKa(glm::vec3(record.Ka[0], record.Ka[1], record.Ka[2]));
+		material->SetKd(glm::vec3(record.Kd[0], record.Kd[1], record.Kd[2]));
+		material->SetKs(glm::vec3(record.Ks[0], record.Ks[1], record.Ks[2]));
+		material->SetNs(record.Ns);
+		if (!mapKdPath.empty()) {
+			material->SetMapKdPath(mapKdPath);
+			material->SetMapKd(TextureManager::Instance().Acquire(mapKdPath, true, ImageTexture::GetMaterialCompression()));
+		}
+		materials.push_back(material);
+	}
+
+	std::vector<OutOfCorePageRecord> records(header.numPages);
+	if (!in.read((char*)records.data(), records.size() * sizeof(OutOfCorePageRecord))) {
+		std::cerr << "[ERROR] Truncated out-of-core mesh: " << pagePath << std::endl;
+		return false;
+	}
+	const uint64_t fileBytes = (uint64_t)std::filesystem::file_size(pagePath, ec);
+	std::vector<unsigned char> isChild(records.size(), 0);
+	pages.resize(records.size());
+	for (size_t i = 0; i < records.size(); ++i) {
+		const OutOfCorePageRecord& record = records[i];
+		Page& page = pages[i];
+		page.center = glm::vec3(record.center[0], record.center[1], record.center[2]);
+		page.radius = record.radius;
+		page.error = record.error;
+		page.subMesh = record.subMesh;
+		page.firstChild = record.firstChild;
+		page.numChildren = record.numChildren;
+		page.numVertices = record.numVertices;
+		page.numIndices = record.numIndices;
+		page.offset = record.offset;
+		page.vboId = 0;
+		page.iboId = 0;
+		page.loading = false;
+		page.lastUsedFrame = 0;
+		if (page.subMesh < 0 || page.subMesh >= header.numMaterials || page.numChildren < 0 || page.numIndices % 3 != 0
+			|| (page.numChildren > 0 && (page.firstChild < 0 || page.firstChild + page.numChildren > (int)i))
+			|| page.offset + GetPageBytes((int)i) > fileBytes) {
+			std::cerr << "[ERROR] Corrupt out-of-core mesh: " << pagePath << std::endl;
+			pages.clear();
+			return false;
+		}
+		for (int c = 0; c < page.numChildren; ++c)
+			isChild[page.firstChild + c] = 1;
+	}
+	for (size_t i = 0; i < pages.size(); ++i) {
+		if (!isChild[i])
+			rootPages.push_back((int)i);
+	}
+
+	file = std::make_shared<MappedFile>();
+	if (!file->Open(pagePath)) {
+		std::cerr << "[ERROR] Cannot map out-of-core mesh: " << pagePath << std::endl;
+		return false;
+	}
+	drawLists.assign(materials.size(), std::vector<int>());
+	// The roots (the coarsest pages) are what everything else falls back on.
+	for (auto&& root : rootPages) {
+		void* view = nullptr;
+		size_t viewBytes = 0;
+		const uint8_t* data = file->Map(pages[root].offset, GetPageBytes(root), view, viewBytes);
+		if (data == nullptr || !CheckIndices(data, pages[root].numVertices, pages[root].numIndices)) {
+			std::cerr << "[ERROR] Cannot read out-of-core mesh: " << pagePath << std::endl;
+			MappedFile::Unmap(view, viewBytes);
+			return false;
+		}
+		UploadPage(root, data);
+		MappedFile::Unmap(view, viewBytes);
+	}
+	numPagesUploaded = 0;
+	std::cout << "Out-of-core mesh " << pagePath << ": " << pages.size() << " pages, " << materials.size()
+			  << " submeshes, roots " << residentBytes / 1024 << " KB, budget " << budgetBytes / (1024 * 1024)
+			  << " MB" << std::endl;
+	return true;
+}
+
+size_t OutOfCoreMesh::GetPageBytes(const int page) const
+{
+	return (size_t)pages[page].numVertices * sizeof(VertexPTN) + (size_t)pages[page].numIndices * sizeof(unsigned int);
+}
+
+bool OutOfCoreMesh::CheckIndices(const uint8_t* data, const unsigned int numVertices, const unsigned int numIndices)
+{
+	const uint8_t* indexData = data + (size_t)numVertices * sizeof(VertexPTN);
+	unsigned int maxIndex = 0;
+	for (unsigned int i = 0; i < numIndices; ++i) {
+		unsigned int index;
+		std::memcpy(&index, indexData + (size_t)i * sizeof(unsigned int), sizeof(index));
+		maxIndex = std::max(maxIndex, index);
+	}
+	return numIndices == 0 || maxIndex < numVertices;
+}
+
+void OutOfCoreMesh::Update(const glm::mat4x4& worldMatrix, const glm::mat4x4& viewMatrix, const glm::mat4x4& projMatrix,
+						const int screenHeight)
+{
+	++frame;
+	MarkUsed();
+
+	std::vector<LoadedPage> arrived;
+	{
+		std::lock_guard<std::mutex> lock(loaded->mutex);
+		while (!loaded->pages.empty() && (int)arrived.size() < maxUploadsPerFrame) {
+			arrived.push_back(loaded->pages.front());
+			loaded->pages.pop_front();
+		}
+	}
+	for (auto&& page : arrived) {
+		--numPagesInFlight;
+		if (page.data == nullptr) {
+			// Left marked as loading, so it is not asked for again: its parent stays drawn.
+			std::cerr << "[ERROR] Cannot read (or corrupt) out-of-core mesh page " << page.page << ": " << pagePath << std::endl;
+			continue;
+		}
+		pages[page.page].loading = false;
+		UploadPage(page.page, page.data);
+		MappedFile::Unmap(page.view, page.viewBytes);
+	}
+
+	// Test in object space: planes from the MVP, camera moved by the inverse model-view. Under
+	// a uniform scale the projected error does not depend on it: pixels = error * k / distance.
+	const glm::mat4x4 modelViewMatrix = viewMatrix * worldMatrix;
+	const Frustum frustum(projMatrix * modelViewMatrix);
+	const glm::vec4 objCameraPos = glm::inverse(modelViewMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	const glm::vec3 eye = glm::vec3(objCameraPos) / objCameraPos.w;
+	const float pixelsAtUnitDistance = projMatrix[1][1] * 0.5f * (float)screenHeight;
+
+	for (auto&& drawList : drawLists)
+		drawList.clear();
+	numTrianglesDrawn = 0;
+	// Missing pages by priority: those needed now by how coarse their parent looks, then
+	// (prefetch) the children of pages close to needing them.
+	std::vector<std::pair<float, int>> wanted;
+	std::vector<int> stack(rootPages);
+	while (!stack.empty()) {
+		const int p = stack.back();
+		stack.pop_back();
+		Page& page = pages[p];
+		if (!frustum.IsSphereVisible(page.center, page.radius))
+			continue;
+		page.lastUsedFrame = frame;
+		const float distance = std::max(glm::distance(eye, page.center) - page.radius, 1e-4f);
+		const float pixelError = page.error * pixelsAtUnitDistance / distance;
+		if (page.numChildren > 0 && pixelError > maxPixelError) {
+			// A page is refined only once all its children are in: those in count as used, even
+			// off screen, or evicting them would send the page back to its coarse self.
+			bool childrenResident = true;
+			for (int c = page.firstChild; c < page.firstChild + page.numChildren; ++c) {
+				if (pages[c].vboId != 0) {
+					pages[c].lastUsedFrame = frame;
+					continue;
+				}
+				childrenResident = false;
+				if (!pages[c].loading)
+					wanted.push_back(std::make_pair(pixelError, c));
+			}
+			if (childrenResident) {
+				for (int c = page.firstChild; c < page.firstChild + page.numChildren; ++c)
+					stack.push_back(c);
+				continue;
+			}
+		}
+		else if (page.numChildren > 0 && pixelError > 0.5f * maxPixelError) {
+			for (int c = page.firstChild; c < page.firstChild + page.numChildren; ++c) {
+				if (pages[c].vboId == 0 && !pages[c].loading)
+					wanted.push_back(std::make_pair(pixelError - maxPixelError, c));
+			}
+		}
+		drawLists[page.subMesh].push_back(p);
+		numTrianglesDrawn += (int)page.numIndices / 3;
+	}
+
+	std::sort(wanted.begin(), wanted.end(), std::greater<std::pair<float, int>>());
+	for (auto&& request : wanted) {
+		if (numPagesInFlight >= maxPagesInFlight)
+			break;
+		RequestPage(request.second);
+	}
+	EvictPages();
+}
+
+void OutOfCoreMesh::RequestPage(const int page)
+{
+	pages[page].loading = true;
+	++numPagesInFlight;
+	// The task only touches the file and the queue, never the mesh.
+	std::shared_ptr<LoadedQueue> queue = loaded;
+	std::shared_ptr<MappedFile> mappedFile = file;
+	const uint64_t offset = pages[page].offset;
+	const size_t numBytes = GetPageBytes(page);
+	const unsigned int numVertices = pages[page].numVertices;
+	const unsigned int numIndices = pages[page].numIndices;
+	ThreadPool::Instance().Async([queue, mappedFile, page, offset, numBytes, numVertices, numIndices]() {
+		LoadedPage loadedPage;
+		loadedPage.page = page;
+		loadedPage.data = mappedFile->Map(offset, numBytes, loadedPage.view, loadedPage.viewBytes);
+		// Fault the page in here rather than in the upload on the GL thread; the index check
+		// reads the indices, the vertices are touched a memory page at a time.
+		if (loadedPage.data != nullptr && numBytes > 0) {
+			const volatile uint8_t* bytes = loadedPage.data;
+			for (size_t i = 0; i < (size_t)numVertices * sizeof(VertexPTN); i += 4096)
+				(void)bytes[i];
+			// An index past the page's vertices would have the GPU read outside its buffer.
+			if (!CheckIndices(loadedPage.data, numVertices, numIndices)) {
+				MappedFile::Unmap(loadedPage.view, loadedPage.viewBytes);
+				loadedPage.view = nullptr;
+				loadedPage.data = nullptr;
+			}
+		}
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->pages.push_back(loadedPage);
+	});
+}
+
+void OutOfCoreMesh::UploadPage(const int page, const uint8_t* data)
+{
+	Page& p = pages[page];
+	const size_t vertexBytes = (size_t)p.numVertices * sizeof(VertexPTN);
+	glGenBuffers(1, &p.vboId);
+	glBindBuffer(GL_ARRAY_BUFFER, p.vboId);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, data, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glGenBuffers(1, &p.iboId);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p.iboId);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)p.numIndices * sizeof(unsigned int), data + vertexBytes, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	p.lastUsedFrame = frame;
+	residentBytes += GetPageBytes(page);
+	++numPagesUploaded;
+}
+
+void OutOfCoreMesh::ReleasePage(const int page)
+{
+	Page& p = pages[page];
+	glDeleteBuffers(1, &p.vboId);
+	glDeleteBuffers(1, &p.iboId);
+	p.vboId = 0;
+	p.iboId = 0;
+	residentBytes -= GetPageBytes(page);
+}
+
+void OutOfCoreMesh::EvictPages()
+{
+	if (residentBytes <= budgetBytes)
+		return;
+	std::vector<unsigned char> isRoot(pages.size(), 0);
+	for (auto&& root : rootPages)
+		isRoot[root] = 1;
+	std::vector<std::pair<unsigned int, int>> candidates;
+	for (int i = 0; i < (int)pages.size(); ++i) {
+		if (pages[i].vboId != 0 && !isRoot[i] && pages[i].lastUsedFrame < frame)
+			candidates.push_back(std::make_pair(pages[i].lastUsedFrame, i));
+	}
+	std::sort(candidates.begin(), candidates.end());
+	for (auto&& candidate : candidates) {
+		if (residentBytes <= budgetBytes)
+			break;
+		ReleasePage(candidate.second);
+		++numPagesEvicted;
+	}
+}
+
+void OutOfCoreMesh::RenderSubMesh(const int subMesh)
+{
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	TriangleMesh::SetIdentityInstanceAttributes();
+	// The pages carry no tangents.
+	glVertexAttrib4f(3, 1.0f, 0.0f, 0.0f, 1.0f);
+
+	for (auto&& p : drawLists[subMesh]) {
+		const Page& page = pages[p];
+		glBindBuffer(GL_ARRAY_BUFFER, page.vboId);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), 0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)12);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)24);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.iboId);
+		glDrawElements(GL_TRIANGLES, (GLsizei)page.numIndices, GL_UNSIGNED_INT, 0);
+	}
+
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(2);
+}
+
+size_t OutOfCoreMesh::GetCpuBytes() const
+{
+	size_t total = pages.capacity() * sizeof(Page) + rootPages.capacity() * sizeof(int);
+	for (auto&& drawList : drawLists)
+		total += drawList.capacity() * sizeof(int);
+	return total;
+}
+
+void OutOfCoreMesh::PrintStats() const
+{
+	int numResident = 0, numDrawn = 0;
+	for (auto&& page : pages)
+		numResident += page.vboId != 0 ? 1 : 0;
+	for (auto&& drawList : drawLists)
+		numDrawn += (int)drawList.size();
+	std::cout << "Out-of-core mesh: " << numResident << " of " << pages.size() << " pages resident ("
+			  << residentBytes / (1024 * 1024) << " of " << budgetBytes / (1024 * 1024) << " MB), "
+			  << numTrianglesDrawn << " triangles in " << numDrawn << " pages drawn, " << numPagesUploaded
+			  << " uploaded, " << numPagesEvicted << " evicted, " << numPagesInFlight << " loading" << std::endl;
+}
@@ -0,0 +1,140 @@
+#ifndef OUT_OF_CORE_MESH_H
+#define OUT_OF_CORE_MESH_H
+
+#include "headers.h"
+#include "trianglemesh.h"
+#include "memorybudget.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// OutOfCoreMesh Declarations.
+// A model too large to keep in memory, split offline (Build) into a *.ocm file of pages. The
+// finest level cuts each submesh into runs of pageTriangles triangles in Morton order of their
+// centers, so a page is a compact piece of the surface. Each coarser level merges groups of
+// pageChildren neighbouring pages and simplifies them by vertex clustering to about
+// pageTriangles triangles, up to one root page per submesh. At run time the page tree is walked
+// from the roots every frame. A page is drawn when its simplification error projects to at most
+// maxPixelError pixels, or while one of its children is not resident. The missing children are
+// read on the thread pool: each maps just its page of the file, touches it (so the upload on
+// the GL thread does not wait on the disk) and unmaps it once uploaded. The pages unused the
+// longest are dropped once the resident pages exceed the budget; the roots stay. System memory
+// holds the page table and the pages in flight, whatever the size of the model.
+class OutOfCoreMesh : public BudgetedResource
+{
+public:
+	// OutOfCoreMesh Public Methods.
+	static const int pageTriangles = 16384;
+	static const int pageChildren = 4;
+
+	OutOfCoreMesh();
+	~OutOfCoreMesh();
+
+	// Offline: page the model (normalized, as TriangleMesh draws it) and write the page tree to
+	// GetPagePath(objPath). Runs headless and streams: the OBJ is read a few times, its attributes
+	// and triangles go through mapped scratch files next to the output, and memory holds one bin
+	// of triangles (about 64 MB), a batch of pages and the page table, whatever the model size.
+	// Missing normals are smoothed across every edge (the crease angle is not applied).
+	static bool Build(const std::string& objPath);
+	static std::string GetPagePath(const std::string& objPath) { return objPath + ".ocm"; }
+
+	// Open the paged file of a model, acquire its textures and load the root pages (GL thread).
+	bool Open(const std::string& objPath);
+	// Pick the pages to draw for this view and request the missing ones, upload the pages read
+	// since the last frame and drop the least recently used over the budget; call once per
+	// frame on the GL thread. The world matrix must not scale non-uniformly.
+	void Update(const glm::mat4x4& worldMatrix, const glm::mat4x4& viewMatrix, const glm::mat4x4& projMatrix,
+				const int screenHeight);
+	// Draw the pages picked for a submesh; the caller sets its material.
+	void RenderSubMesh(const int subMesh);
+	void PrintStats() const;
+
+	// Video memory for the pages (the roots stay resident even over it). System memory is not
+	// budgeted: it holds the page table and at most maxPagesInFlight pages being read.
+	void SetBudget(const size_t bytes) { budgetBytes = bytes; }
+	void SetMaxPixelError(const float pixels) { maxPixelError = pixels; }
+	int GetNumSubMeshes() const { return (int)materials.size(); }
+	PhongMaterial* GetMaterial(const int subMesh) const { return materials[subMesh]; }
+	const std::string& GetPagePath() const { return pagePath; }
+
+	// BudgetedResource interface.
+	const char* GetResourceType() const { return "out-of-core mesh"; }
+	size_t GetGpuBytes() const { return residentBytes; }
+	size_t GetCpuBytes() const;
+
+private:
+	// The opened *.ocm file, mapped a page at a time (definition in the .cpp).
+	struct MappedFile;
+	// A temporary file of Build, mapped whole.
+	struct ScratchFile;
+	// A page mapped and touched by a worker, waiting for upload.
+	struct LoadedPage
+	{
+		int page;
+		void* view;
+		size_t viewBytes;
+		// The vertices then the indices of the page, within the view; nullptr if unreadable.
+		const uint8_t* data;
+	};
+	// Filled by the workers; held by shared_ptr so a read still running at exit does not outlive it.
+	// The last holder (the mesh, or a read finishing after it) unmaps the pages left in it.
+	struct LoadedQueue
+	{
+		~LoadedQueue();
+
+		std::mutex mutex;
+		std::deque<LoadedPage> pages;
+	};
+	// A node of the page tree (as stored in the file) and its run-time state.
+	struct Page
+	{
+		// Bounding sphere enclosing the children's.
+		glm::vec3 center;
+		float radius;
+		// Largest distance from this page's surface to the full resolution one (0 at the finest level).
+		float error;
+		int subMesh;
+		int firstChild;
+		int numChildren;
+		unsigned int numVertices;
+		unsigned int numIndices;
+		uint64_t offset;
+		GLuint vboId;
+		GLuint iboId;
+		bool loading;
+		unsigned int lastUsedFrame;
+	};
+	static const int maxPagesInFlight = 8;
+	static const int maxUploadsPerFrame = 8;
+
+	// OutOfCoreMesh Private Methods.
+	size_t GetPageBytes(const int page) const;
+	// Whether every index of a page's data (as mapped) is one of its vertices.
+	static bool CheckIndices(const uint8_t* data, const unsigned int numVertices, const unsigned int numIndices);
+	void RequestPage(const int page);
+	void UploadPage(const int page, const uint8_t* data);
+	void ReleasePage(const int page);
+	// Drop the least recently used pages (not the roots, nor those used this frame) over the budget.
+	void EvictPages();
+
+	// OutOfCoreMesh Private Data.
+	std::string pagePath;
+	std::shared_ptr<MappedFile> file;
+	std::vector<Page> pages;
+	std::vector<int> rootPages;
+	std::vector<PhongMaterial*> materials;
+	// Pages picked by the last Update, by submesh.
+	std::vector<std::vector<int>> drawLists;
+	std::shared_ptr<LoadedQueue> loaded;
+	int numPagesInFlight;
+	size_t residentBytes;
+	size_t budgetBytes;
+	float maxPixelError;
+	unsigned int frame;
+
+	int numPagesUploaded;
+	int numPagesEvicted;
+	int numTrianglesDrawn;
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "scene.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <emmintrin.h>
+
+// out = a * b for column-major 4x4 matrices, one SSE register per column.
+static inline void MultiplyMat4(const glm::mat4x4& a, const glm::mat4x4& b, glm::mat4x4& out)
+{
+	const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+	const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+	const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+	const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+	for (int j = 0; j < 4; ++j) {
+		const float* bj = &b[j][0];
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+		_mm_storeu_ps(&out[j][0], r);
+	}
+}
+
+Scene::Scene()
+{
+	levelsDirty = false;
+	viewMatrix = glm::mat4x4(1.0f);
+	projMatrix = glm::mat4x4(1.0f);
+	viewProjMatrix = glm::mat4x4(1.0f);
+	cameraDirty = true;
+	numWorldUpdates = 0;
+	numViewUpdates = 0;
+	lastUpdateTimeMs = 0.0f;
+}
+
+Scene::~Scene()
+{
+	Clear();
+}
+
+int Scene::CreateNode(const int parent)
+{
+	const int node = GetNumNodes();
+	int parentNode = parent;
+	if (parentNode >= node) {
+		std::cerr << "[ERROR] Scene node parent " << parentNode << " does not exist" << std::endl;
+		parentNode = -1;
+	}
+	translations.push_back(glm::vec3(0.0f, 0.0f, 0.0f));
+	rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	scales.push_back(glm::vec3(1.0f, 1.0f, 1.0f));
+	parents.push_back(parentNode);
+	depths.push_back(parentNode < 0 ? 0 : depths[parentNode] + 1);
+	localDirty.push_back(1);
+	worldDirty.push_back(0);
+	worldMatrices.push_back(glm::mat4x4(1.0f));
+	worldNormalMatrices.push_back(glm::mat3x3(1.0f));
+	mvpMatrices.push_back(glm::mat4x4(1.0f));
+	normalMatrices.push_back(glm::mat4x4(1.0f));
+	levelsDirty = true;
+	return node;
+}
+
+void Scene::Clear()
+{
+	translations.clear();
+	rotations.clear();
+	scales.clear();
+	parents.clear();
+	depths.clear();
+	levels.clear();
+	localDirty.clear();
+	worldDirty.clear();
+	worldMatrices.clear();
+	worldNormalMatrices.clear();
+	mvpMatrices.clear();
+	normalMatrices.clear();
+	levelsDirty = false;
+}
+
+void Scene::SetTranslation(const int node, const glm::vec3& t)
+{
+	// Setting the same value every frame must not dirty the subtree.
+	if (std::memcmp(&translations[node], &t, sizeof(glm::vec3)) == 0)
+		return;
+	translations[node] = t;
+	MarkDirty(node);
+}
+
+void Scene::SetRotation(const int node, const glm::quat& r)
+{
+	if (std::memcmp(&rotations[node], &r, sizeof(glm::quat)) == 0)
+		return;
+	rotations[node] = r;
+	MarkDirty(node);
+}
+
+void Scene::SetScale(const int node, const glm::vec3& s)
+{
+	if (std::memcmp(&scales[node], &s, sizeof(glm::vec3)) == 0)
+		return;
+	scales[node] = s;
+	MarkDirty(node);
+}
+
+void Scene::SetLocalTransform(const int node, const glm::vec3& t, const glm::quat& r, const glm::vec3& s)
+{
+	SetTranslation(node, t);
+	SetRotation(node, r);
+	SetScale(node, s);
+}
+
+void Scene::SetCamera(const glm::mat4x4& view, const glm::mat4x4& proj)
+{
+	if (std::memcmp(&viewMatrix, &view, sizeof(glm::mat4x4)) == 0
+		&& std::memcmp(&projMatrix, &proj, sizeof(glm::mat4x4)) == 0)
+		return;
+	viewMatrix = view;
+	projMatrix = proj;
+	MultiplyMat4(projMatrix, viewMatrix, viewProjMatrix);
+	cameraDirty = true;
+}
+
+void Scene::BuildLevels()
+{
+	levels.clear();
+	for (int node = 0; node < GetNumNodes(); ++node) {
+		if (depths[node] >= (int)levels.size())
+			levels.resize(depths[node] + 1);
+		levels[depths[node]].push_back(node);
+	}
+	levelsDirty = false;
+}
+
+void Scene::Update()
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	if (levelsDirty)
+		BuildLevels();
+
+	// World matrices, one level at a time: a node only reads its parent's result.
+	std::atomic<int> worldUpdates(0);
+	for (auto&& level : levels) {
+		ThreadPool::Instance().ParallelFor(0, (int)level.size(), [&](int begin, int end) {
+			int count = 0;
+			for (int k = begin; k < end; ++k) {
+				const int node = level[k];
+				const int parent = parents[node];
+				if (!localDirty[node] && (parent < 0 || !worldDirty[parent])) {
+					worldDirty[node] = 0;
+					continue;
+				}
+				// Local = T * R * S.
+				glm::mat3x3 R = glm::mat3_cast(rotations[node]);
+				const glm::vec3& s = scales[node];
+				glm::mat4x4 local = glm::mat4x4(
+					glm::vec4(R[0] * s.x, 0.0f),
+					glm::vec4(R[1] * s.y, 0.0f),
+					glm::vec4(R[2] * s.z, 0.0f),
+					glm::vec4(translations[node], 1.0f));
+				glm::mat4x4& world = worldMatrices[node];
+				if (parent < 0)
+					world = local;
+				else
+					MultiplyMat4(worldMatrices[parent], local, world);
+				// Inverse transpose of the upper 3x3 from its cofactors.
+				const glm::vec3 c0 = glm::vec3(world[0]);
+				const glm::vec3 c1 = glm::vec3(world[1]);
+				const glm::vec3 c2 = glm::vec3(world[2]);
+				const glm::vec3 c12 = glm::cross(c1, c2);
+				const float det = glm::dot(c0, c12);
+				const float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+				worldNormalMatrices[node] = glm::mat3x3(c12 * invDet, glm::cross(c2, c0) * invDet, glm::cross(c0, c1) * invDet);
+				localDirty[node] = 0;
+				worldDirty[node] = 1;
+				++count;
+			}
+			worldUpdates += count;
+		}, 256);
+	}
+
+	// View-dependent matrices: every node after a camera move, otherwise the moved ones.
+	std::atomic<int> viewUpdates(0);
+	const glm::mat3x3 viewRotation = glm::mat3x3(viewMatrix);
+	ThreadPool::Instance().ParallelFor(0, GetNumNodes(), [&](int begin, int end) {
+		int count = 0;
+		for (int node = begin; node < end; ++node) {
+			if (!cameraDirty && !worldDirty[node])
+				continue;
+			MultiplyMat4(viewProjMatrix, worldMatrices[node], mvpMatrices[node]);
+			normalMatrices[node] = glm::mat4x4(viewRotation * worldNormalMatrices[node]);
+			++count;
+		}
+		viewUpdates += count;
+	}, 1024);
+	cameraDirty = false;
+
+	numWorldUpdates = worldUpdates;
+	numViewUpdates = viewUpdates;
+	auto endTime = std::chrono::high_resolution_clock::now();
+	lastUpdateTimeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
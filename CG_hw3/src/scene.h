@@ -0,0 +1,87 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+// No GL or window-system headers: this module runs headless.
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include <cstdint>
+
+// Scene Declarations.
+// Node transforms stored as structure-of-arrays. Every node has a local TRS and an
+// optional parent; a parent is always created before its children.
+// Update() recomputes the world matrix of nodes whose local transform (or an
+// ancestor's) changed, and their MVP and normal matrix; all of them after a camera move.
+// Nodes of one depth level are independent, so each level is updated across the workers.
+class Scene
+{
+public:
+	// Scene Public Methods.
+	Scene();
+	~Scene();
+
+	// Returns the new node index; parent = -1 for a root.
+	int CreateNode(const int parent = -1);
+	void Clear();
+
+	void SetTranslation(const int node, const glm::vec3& t);
+	void SetRotation(const int node, const glm::quat& r);
+	void SetScale(const int node, const glm::vec3& s);
+	void SetLocalTransform(const int node, const glm::vec3& t, const glm::quat& r, const glm::vec3& s);
+	// The view matrix must be rigid (a look-at): normal matrices reuse its rotation.
+	void SetCamera(const glm::mat4x4& viewMatrix, const glm::mat4x4& projMatrix);
+
+	void Update();
+
+	int GetNumNodes() const { return (int)parents.size(); }
+	int GetParent(const int node) const { return parents[node]; }
+	const glm::vec3& GetTranslation(const int node) const { return translations[node]; }
+	const glm::quat& GetRotation(const int node) const { return rotations[node]; }
+	const glm::vec3& GetScale(const int node) const { return scales[node]; }
+	const glm::mat4x4& GetWorldMatrix(const int node) const { return worldMatrices[node]; }
+	const glm::mat4x4& GetMVP(const int node) const { return mvpMatrices[node]; }
+	// Inverse transpose of view * world (what the phong shader's normalMatrix expects).
+	const glm::mat4x4& GetNormalMatrix(const int node) const { return normalMatrices[node]; }
+	const std::vector<glm::mat4x4>& GetWorldMatrices() const { return worldMatrices; }
+
+	// Statistics of the last Update().
+	int GetNumWorldUpdates() const { return numWorldUpdates; }
+	int GetNumViewUpdates() const { return numViewUpdates; }
+	float GetLastUpdateTimeMs() const { return lastUpdateTimeMs; }
+
+private:
+	// Scene Private Methods.
+	void MarkDirty(const int node) { localDirty[node] = 1; }
+	void BuildLevels();
+
+	// Scene Private Data.
+	// Local transform and hierarchy.
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<int> parents;
+	std::vector<int> depths;
+	// Nodes grouped by depth; rebuilt when nodes are added.
+	std::vector<std::vector<int>> levels;
+	bool levelsDirty;
+	// 1 if the local transform changed since the last Update().
+	std::vector<uint8_t> localDirty;
+	// 1 if the world matrix was recomputed by the running Update().
+	std::vector<uint8_t> worldDirty;
+	// Derived matrices.
+	std::vector<glm::mat4x4> worldMatrices;
+	std::vector<glm::mat3x3> worldNormalMatrices;
+	std::vector<glm::mat4x4> mvpMatrices;
+	std::vector<glm::mat4x4> normalMatrices;
+	// Camera.
+	glm::mat4x4 viewMatrix;
+	glm::mat4x4 projMatrix;
+	glm::mat4x4 viewProjMatrix;
+	bool cameraDirty;
+
+	int numWorldUpdates;
+	int numViewUpdates;
+	float lastUpdateTimeMs;
+};
+
+#endif
@@ -66,6 +66,34 @@ bool ShaderProg::LoadFromFiles(const std::string vsFilePath, const std::string f
     return true;
 }
 
+bool ShaderProg::LoadComputeFromFile(const std::string csFilePath)
+{
+    // Load the compute shader from a source file and attach it to the shader program.
+    std::string cs;
+    if (!LoadShaderTextFromFile(csFilePath, cs)) {
+        std::cerr << "[ERROR] Failed to load compute shader source: " << csFilePath << std::endl;
+        return false;
+    }
+    GLuint csId = AddShader(cs, GL_COMPUTE_SHADER);
+
+    // Link the compute program.
+    GLint success = 0;
+    GLchar errorLog[MAX_BUFFER_SIZE] = { 0 };
+    glLinkProgram(shaderProgId);
+    glGetProgramiv(shaderProgId, GL_LINK_STATUS, &success);
+    if (success == 0) {
+        glGetProgramInfoLog(shaderProgId, sizeof(errorLog), NULL, errorLog);
+        std::cerr << "[ERROR] Failed to link compute program: " << errorLog << std::endl;
+        return false;
+    }
+    glDeleteShader(csId);
+
+    // Update the location of uniform variables.
+    GetUniformVariableLocation();
+
+    return true;
+}
+
 void ShaderProg::GetUniformVariableLocation()
 {
     locMVP = glGetUniformLocation(shaderProgId, "MVP");
@@ -157,6 +185,11 @@ PhongShadingDemoShaderProg::PhongShadingDemoShaderProg()
 	// -------------------------------------------------------
     locMapKd = -1;
     lochasMapKd = -1;
+    locMapKdArray = -1;
+    locMapKdLayer = -1;
+    locSpecularEnvMap = -1;
+    locHasSpecularEnvMap = -1;
+    locSpecularEnvMaxLod = -1;
 }
 
 PhongShadingDemoShaderProg::~PhongShadingDemoShaderProg()
@@ -191,7 +224,15 @@ void PhongShadingDemoShaderProg::GetUniformVariableLocation()
 	// -------------------------------------------------------
     locMapKd = glGetUniformLocation(shaderProgId, "mapKd");
     lochasMapKd = glGetUniformLocation(shaderProgId, "hasMapKd");
-
+    locMapKdArray = glGetUniformLocation(shaderProgId, "mapKdArray");
+    locMapKdLayer = glGetUniformLocation(shaderProgId, "mapKdLayer");
+    locSpecularEnvMap = glGetUniformLocation(shaderProgId, "specularEnvMap");
+    locHasSpecularEnvMap = glGetUniformLocation(shaderProgId, "hasSpecularEnvMap");
+    locSpecularEnvMaxLod = glGetUniformLocation(shaderProgId, "specularEnvMaxLod");
+    // Image-based ambient lighting.
+    GLuint shBlockIndex = glGetUniformBlockIndex(shaderProgId, "SHLighting");
+    if (shBlockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(shaderProgId, shBlockIndex, shLightingBinding);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -199,6 +240,16 @@ void PhongShadingDemoShaderProg::GetUniformVariableLocation()
 SkyboxShaderProg::SkyboxShaderProg()
 {
     locMapKd = -1;
+    locInvViewProj = -1;
+    locFullscreen = -1;
+    locUseCubeMap = -1;
+    locCubeMap = -1;
+    locUseVirtualTexture = -1;
+    locVirtualFeedback = -1;
+    locVtIndirection = -1;
+    locVtPageCache = -1;
+    locVtParams = -1;
+    locVtCacheParams = -1;
 }
 
 SkyboxShaderProg::~SkyboxShaderProg()
@@ -208,4 +259,60 @@ void SkyboxShaderProg::GetUniformVariableLocation()
 {
     ShaderProg::GetUniformVariableLocation();
     locMapKd = glGetUniformLocation(shaderProgId, "mapKd");
+    locInvViewProj = glGetUniformLocation(shaderProgId, "invViewProj");
+    locFullscreen = glGetUniformLocation(shaderProgId, "fullscreen");
+    locUseCubeMap = glGetUniformLocation(shaderProgId, "useCubeMap");
+    locCubeMap = glGetUniformLocation(shaderProgId, "cubeMap");
+    locUseVirtualTexture = glGetUniformLocation(shaderProgId, "useVirtualTexture");
+    locVirtualFeedback = glGetUniformLocation(shaderProgId, "virtualFeedback");
+    locVtIndirection = glGetUniformLocation(shaderProgId, "vtIndirection");
+    locVtPageCache = glGetUniformLocation(shaderProgId, "vtPageCache");
+    locVtParams = glGetUniformLocation(shaderProgId, "vtParams");
+    locVtCacheParams = glGetUniformLocation(shaderProgId, "vtCacheParams");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+MeshletCullShaderProg::MeshletCullShaderProg()
+{
+    locFrustumPlanes = -1;
+    locCameraPos = -1;
+    locNumChunks = -1;
+    locPass = -1;
+    locUseHiZ = -1;
+    locHiZ = -1;
+    locHiZMaxLevel = -1;
+}
+
+MeshletCullShaderProg::~MeshletCullShaderProg()
+{}
+
+void MeshletCullShaderProg::GetUniformVariableLocation()
+{
+    ShaderProg::GetUniformVariableLocation();
+    locFrustumPlanes = glGetUniformLocation(shaderProgId, "frustumPlanes");
+    locCameraPos = glGetUniformLocation(shaderProgId, "cameraPos");
+    locNumChunks = glGetUniformLocation(shaderProgId, "numChunks");
+    locPass = glGetUniformLocation(shaderProgId, "pass");
+    locUseHiZ = glGetUniformLocation(shaderProgId, "useHiZ");
+    locHiZ = glGetUniformLocation(shaderProgId, "hiZ");
+    locHiZMaxLevel = glGetUniformLocation(shaderProgId, "hiZMaxLevel");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+HiZBuildShaderProg::HiZBuildShaderProg()
+{
+    locMode = -1;
+    locDepthTex = -1;
+}
+
+HiZBuildShaderProg::~HiZBuildShaderProg()
+{}
+
+void HiZBuildShaderProg::GetUniformVariableLocation()
+{
+    ShaderProg::GetUniformVariableLocation();
+    locMode = glGetUniformLocation(shaderProgId, "mode");
+    locDepthTex = glGetUniformLocation(shaderProgId, "depthTex");
 }
@@ -12,6 +12,7 @@ public:
 	~ShaderProg();
 
 	bool LoadFromFiles(const std::string vsFilePath, const std::string fsFilePath);
+	bool LoadComputeFromFile(const std::string csFilePath);
 	void Bind() { glUseProgram(shaderProgId); };
 	void UnBind() { glUseProgram(0); };
 
@@ -64,6 +65,9 @@ public:
 	PhongShadingDemoShaderProg();
 	~PhongShadingDemoShaderProg();
 
+	// Uniform buffer binding point of the SHLighting block.
+	static const GLuint shLightingBinding = 0;
+
 	GLint GetLocM() const { return locM; }
 	GLint GetLocV() const { return locV; }
 	GLint GetLocNM() const { return locNM; }
@@ -90,6 +94,11 @@ public:
 	// -------------------------------------------------------
 	GLint GetLocMapKd() const { return locMapKd; }
 	GLint GetLocHasMapKd() const { return lochasMapKd; }
+	GLint GetLocMapKdArray() const { return locMapKdArray; }
+	GLint GetLocMapKdLayer() const { return locMapKdLayer; }
+	GLint GetLocSpecularEnvMap() const { return locSpecularEnvMap; }
+	GLint GetLocHasSpecularEnvMap() const { return locHasSpecularEnvMap; }
+	GLint GetLocSpecularEnvMaxLod() const { return locSpecularEnvMaxLod; }
 
 protected:
 	// PhongShadingDemoShaderProg Protected Methods.
@@ -127,6 +136,11 @@ private:
 	// -------------------------------------------------------
 	GLint locMapKd;
 	GLint lochasMapKd;
+	GLint locMapKdArray;
+	GLint locMapKdLayer;
+	GLint locSpecularEnvMap;
+	GLint locHasSpecularEnvMap;
+	GLint locSpecularEnvMaxLod;
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -140,6 +154,16 @@ public:
 	~SkyboxShaderProg();
 
 	GLint GetLocMapKd() const { return locMapKd; }
+	GLint GetLocInvViewProj() const { return locInvViewProj; }
+	GLint GetLocFullscreen() const { return locFullscreen; }
+	GLint GetLocUseCubeMap() const { return locUseCubeMap; }
+	GLint GetLocCubeMap() const { return locCubeMap; }
+	GLint GetLocUseVirtualTexture() const { return locUseVirtualTexture; }
+	GLint GetLocVirtualFeedback() const { return locVirtualFeedback; }
+	GLint GetLocVtIndirection() const { return locVtIndirection; }
+	GLint GetLocVtPageCache() const { return locVtPageCache; }
+	GLint GetLocVtParams() const { return locVtParams; }
+	GLint GetLocVtCacheParams() const { return locVtCacheParams; }
 
 protected:
 	// PhongShadingDemoShaderProg Protected Methods.
@@ -148,6 +172,84 @@ protected:
 private:
 	// SkyboxShaderProg Public Data.
 	GLint locMapKd;
+	GLint locInvViewProj;
+	GLint locFullscreen;
+	GLint locUseCubeMap;
+	GLint locCubeMap;
+	GLint locUseVirtualTexture;
+	GLint locVirtualFeedback;
+	GLint locVtIndirection;
+	GLint locVtPageCache;
+	GLint locVtParams;
+	GLint locVtCacheParams;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// MeshletCullShaderProg Declarations.
+class MeshletCullShaderProg : public ShaderProg
+{
+public:
+	// MeshletCullShaderProg Public Methods.
+	MeshletCullShaderProg();
+	~MeshletCullShaderProg();
+
+	void Dispatch(const unsigned int numItems) { glDispatchCompute((numItems + workGroupSize - 1) / workGroupSize, 1, 1); }
+
+	GLint GetLocFrustumPlanes() const { return locFrustumPlanes; }
+	GLint GetLocCameraPos() const { return locCameraPos; }
+	GLint GetLocNumChunks() const { return locNumChunks; }
+	GLint GetLocPass() const { return locPass; }
+	GLint GetLocUseHiZ() const { return locUseHiZ; }
+	GLint GetLocHiZ() const { return locHiZ; }
+	GLint GetLocHiZMaxLevel() const { return locHiZMaxLevel; }
+
+	// Must match local_size_x in the compute shader.
+	static const unsigned int workGroupSize = 64;
+
+protected:
+	// MeshletCullShaderProg Protected Methods.
+	void GetUniformVariableLocation();
+
+private:
+	// MeshletCullShaderProg Private Data.
+	GLint locFrustumPlanes;
+	GLint locCameraPos;
+	GLint locNumChunks;
+	GLint locPass;
+	GLint locUseHiZ;
+	GLint locHiZ;
+	GLint locHiZMaxLevel;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// HiZBuildShaderProg Declarations.
+class HiZBuildShaderProg : public ShaderProg
+{
+public:
+	// HiZBuildShaderProg Public Methods.
+	HiZBuildShaderProg();
+	~HiZBuildShaderProg();
+
+	void Dispatch(const int width, const int height) {
+		glDispatchCompute((width + workGroupSize - 1) / workGroupSize, (height + workGroupSize - 1) / workGroupSize, 1);
+	}
+
+	GLint GetLocMode() const { return locMode; }
+	GLint GetLocDepthTex() const { return locDepthTex; }
+
+	// Must match local_size_x/y in the compute shader.
+	static const int workGroupSize = 8;
+
+protected:
+	// HiZBuildShaderProg Protected Methods.
+	void GetUniformVariableLocation();
+
+private:
+	// HiZBuildShaderProg Private Data.
+	GLint locMode;
+	GLint locDepthTex;
 };
 
 #endif
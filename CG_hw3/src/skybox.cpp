@@ -3,10 +3,25 @@
 Skybox::Skybox(const std::string& texImagePath, const int nSlices, const int nStacks, const float radius)
 {
 	rotationY = 0.0f;
+	mode = SKYBOX_FULLSCREEN;
 
-	// Load panorama.
-	panorama = new ImageTexture(texImagePath);
+	// Tiled panorama: only the pages in view are loaded.
+	virtualTexture = nullptr;
+	panorama = nullptr;
+	if (std::filesystem::exists(VirtualTexture::GetTilePath(texImagePath))) {
+		virtualTexture = new VirtualTexture();
+		if (!virtualTexture->Open(texImagePath)) {
+			delete virtualTexture;
+			virtualTexture = nullptr;
+		}
+	}
+	// Load panorama (streamed: the cube maps are built once it is resident, see Update).
+	if (virtualTexture == nullptr)
+		panorama = TextureManager::Instance().Acquire(texImagePath, true);
 	// panorama->Preview();
+	cubeMap = nullptr;
+	specularMap = nullptr;
+	environmentReady = false;
 
 	// Create material.
 	material = new SkyboxMaterial();
@@ -23,6 +38,14 @@ Skybox::Skybox(const std::string& texImagePath, const int nSlices, const int nSt
 	glGenBuffers(1, &iboId);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &(indices[0]), GL_STATIC_DRAW);
+
+	// One triangle whose clipped part covers the viewport, at depth 1 (z = w).
+	const glm::vec3 fullscreenTriangle[3] = {
+		glm::vec3(-1.0f, -1.0f, 1.0f), glm::vec3(3.0f, -1.0f, 1.0f), glm::vec3(-1.0f, 3.0f, 1.0f)
+	};
+	glGenBuffers(1, &fullscreenVboId);
+	glBindBuffer(GL_ARRAY_BUFFER, fullscreenVboId);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreenTriangle), fullscreenTriangle, GL_STATIC_DRAW);
 }
 
 Skybox::~Skybox()
@@ -31,10 +54,21 @@ Skybox::~Skybox()
 	glDeleteBuffers(1, &vboId);
 	indices.clear();
 	glDeleteBuffers(1, &iboId);
+	glDeleteBuffers(1, &fullscreenVboId);
 
-	if (panorama) {
-		delete panorama;
-		panorama = nullptr;
+	// The material holds the panorama's reference.
+	panorama = nullptr;
+	if (virtualTexture) {
+		delete virtualTexture;
+		virtualTexture = nullptr;
+	}
+	if (cubeMap) {
+		delete cubeMap;
+		cubeMap = nullptr;
+	}
+	if (specularMap) {
+		delete specularMap;
+		specularMap = nullptr;
 	}
 	if (material) {
 		delete material;
@@ -42,8 +76,53 @@ Skybox::~Skybox()
 	}
 }
 
+bool Skybox::Update()
+{
+	environmentImage.release();
+	if (virtualTexture != nullptr)
+		virtualTexture->Update();
+	if (environmentReady)
+		return false;
+	std::string environmentPath;
+	if (virtualTexture != nullptr) {
+		// A level small enough to convert; the lighting needs no more detail.
+		environmentImage = virtualTexture->ReadLevel(4096);
+		environmentPath = virtualTexture->GetTilePath();
+	}
+	else if (panorama != nullptr && panorama->IsResident()) {
+		environmentImage = panorama->GetImage();
+		environmentPath = panorama->GetPath();
+	}
+	else
+		return false;
+	environmentReady = true;
+
+	cubeMap = new CubeMap();
+	if (!cubeMap->CreateFromPanorama(environmentImage, environmentPath)) {
+		delete cubeMap;
+		cubeMap = nullptr;
+	}
+	if (cubeMap != nullptr) {
+		specularMap = new CubeMap();
+		int lastPercent = -1;
+		specularMap->CreatePrefilteredGGX(cubeMap, specularMapSize, specularMapSamples, [&lastPercent](float progress) {
+			int percent = (int)(progress * 100.0f);
+			if (percent / 10 != lastPercent / 10)
+				std::cout << "Prefiltering specular map: " << percent << "%" << std::endl;
+			lastPercent = percent;
+		});
+	}
+	return true;
+}
+
 void Skybox::Render(Camera* camera, SkyboxShaderProg* shader)
 {
+	// The sphere has no virtual texture path.
+	if (mode == SKYBOX_FULLSCREEN || virtualTexture != nullptr) {
+		RenderFullscreen(camera, shader);
+		return;
+	}
+
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
@@ -61,6 +140,7 @@ void Skybox::Render(Camera* camera, SkyboxShaderProg* shader)
 	glm::mat4x4 MVP = camera->GetProjMatrix() * camera->GetViewMatrix() * S * R;
 	// -------------------------------------------------------
 	glUniformMatrix4fv(shader->GetLocMVP(), 1, GL_FALSE, glm::value_ptr(MVP));
+	glUniform1i(shader->GetLocFullscreen(), false);
 	// Set material properties.
 	if (material->GetMapKd() != nullptr) {
 		material->GetMapKd()->Bind(GL_TEXTURE0);
@@ -77,6 +157,65 @@ void Skybox::Render(Camera* camera, SkyboxShaderProg* shader)
     glDisableVertexAttribArray(1);
 }
 
+void Skybox::RenderFeedback(Camera* camera, SkyboxShaderProg* shader, const int screenWidth, const int screenHeight)
+{
+	if (virtualTexture == nullptr)
+		return;
+	virtualTexture->BeginFeedback(screenWidth, screenHeight);
+	RenderFullscreen(camera, shader, true);
+	virtualTexture->EndFeedback();
+}
+
+void Skybox::RenderFullscreen(Camera* camera, SkyboxShaderProg* shader, const bool feedback)
+{
+	// Drawn last: pixels already covered by geometry fail the depth test before shading.
+	glDepthFunc(GL_LEQUAL);
+	glDepthMask(GL_FALSE);
+
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, fullscreenVboId);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+
+	shader->Bind();
+	// Clip space to skybox space: no camera translation, and the inverse of the skybox rotation.
+	glm::mat4x4 R = glm::rotate(glm::mat4x4(1.0f), glm::radians(rotationY), glm::vec3(0, 1, 0));
+	glm::mat4x4 viewRotation = glm::mat4x4(glm::mat3x3(camera->GetViewMatrix()));
+	glm::mat4x4 invViewProj = glm::inverse(camera->GetProjMatrix() * viewRotation * R);
+	glUniformMatrix4fv(shader->GetLocInvViewProj(), 1, GL_FALSE, glm::value_ptr(invViewProj));
+	glUniform1i(shader->GetLocFullscreen(), true);
+	glUniform1i(shader->GetLocUseVirtualTexture(), virtualTexture != nullptr);
+	glUniform1i(shader->GetLocVirtualFeedback(), feedback);
+	if (virtualTexture != nullptr) {
+		virtualTexture->Bind(GL_TEXTURE2, GL_TEXTURE3);
+		glUniform1i(shader->GetLocVtIndirection(), 2);
+		glUniform1i(shader->GetLocVtPageCache(), 3);
+		// The feedback buffer is smaller than the screen: bias its level back to full resolution.
+		const float lodBias = feedback ? -std::log2((float)VirtualTexture::feedbackScale) : 0.0f;
+		glUniform4f(shader->GetLocVtParams(), (float)virtualTexture->GetPagesX(), (float)virtualTexture->GetPagesY(),
+					(float)virtualTexture->GetNumLevels(), lodBias);
+		glUniform3f(shader->GetLocVtCacheParams(), (float)VirtualTexture::pageSize, (float)VirtualTexture::pageBorder,
+					(float)virtualTexture->GetCacheSize());
+	}
+	// The cube map is a lower resolution copy: the virtual texture is drawn directly.
+	glUniform1i(shader->GetLocUseCubeMap(), cubeMap != nullptr && virtualTexture == nullptr);
+	if (cubeMap != nullptr) {
+		cubeMap->Bind(GL_TEXTURE1);
+		glUniform1i(shader->GetLocCubeMap(), 1);
+	}
+	if (material->GetMapKd() != nullptr) {
+		material->GetMapKd()->Bind(GL_TEXTURE0);
+		glUniform1i(shader->GetLocMapKd(), 0);
+	}
+
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	shader->UnBind();
+	glDisableVertexAttribArray(0);
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+}
+
 void Skybox::CreateSphere3D(const int nSlices, const int nStacks, const float radius, 
 					std::vector<VertexPT>& vertices, std::vector<unsigned int>& indices)
 {
@@ -6,6 +6,8 @@
 #include "shaderprog.h"
 #include "material.h"
 #include "camera.h"
+#include "cubemap.h"
+#include "virtualtexture.h"
 
 
 // VertexPT Declarations.
@@ -24,23 +26,52 @@ struct VertexPT
 };
 
 
+// How the panorama is drawn.
+enum SkyboxMode
+{
+	// Tessellated sphere around the camera, uv interpolated per vertex.
+	SKYBOX_SPHERE = 0,
+	// One triangle covering the screen at the far plane, equirectangular lookup per pixel.
+	SKYBOX_FULLSCREEN
+};
+
 // Skybox Declarations.
 class Skybox
 {
 public:
 	// Skybox Public Methods.
+	// Size and GGX samples per texel of the prefiltered specular map.
+	static const int specularMapSize = 128;
+	static const int specularMapSamples = 64;
+
+	// A panorama tiled with VirtualTexture::Tile (a *.vt file next to it) is drawn from its
+	// pages instead of being loaded whole.
 	Skybox(const std::string& texImagePath, const int nSlices, 
 			const int nStacks, const float radius);
 	~Skybox();
+	// Build the cube maps once the streamed panorama is resident; true on the frame it happens.
+	// Also updates the pages of a virtual texture.
+	bool Update();
 	void Render(Camera* camera, SkyboxShaderProg* shader);
+	// Virtual texture only: render the pages needed by the current view into the feedback buffer.
+	void RenderFeedback(Camera* camera, SkyboxShaderProg* shader, const int screenWidth, const int screenHeight);
 	
 	void SetRotation(const float newRotation) { rotationY = newRotation; }
+	void SetMode(const SkyboxMode newMode) { mode = newMode; }
 	
 	ImageTexture* GetTexture() { return panorama; };
+	VirtualTexture* GetVirtualTexture() { return virtualTexture; }
+	// The panorama the cube maps were built from (bottom row first); only valid in the
+	// frame Update returns true.
+	const cv::Mat& GetEnvironmentImage() const { return environmentImage; }
+	CubeMap* GetCubeMap() { return cubeMap; }
+	CubeMap* GetSpecularMap() { return specularMap; }
 	float GetRotation() const  { return rotationY; }
+	SkyboxMode GetMode() const { return mode; }
 
 private:
 	// Skybox Private Methods.
+	void RenderFullscreen(Camera* camera, SkyboxShaderProg* shader, const bool feedback = false);
 	static void CreateSphere3D(const int nSlices, const int nStacks, const float radius, 
 					std::vector<VertexPT>& vertices, std::vector<unsigned int>& indices);
 
@@ -49,11 +80,22 @@ private:
 	GLuint iboId;
 	std::vector<VertexPT> vertices;
 	std::vector<unsigned int> indices;
+	// Fullscreen triangle (clip-space positions).
+	GLuint fullscreenVboId;
 	
 	SkyboxMaterial* material;
 	ImageTexture* panorama;
+	// Tiled panorama (nullptr when the panorama is loaded whole).
+	VirtualTexture* virtualTexture;
+	cv::Mat environmentImage;
+	// Resampled panorama used by the fullscreen mode (nullptr if the conversion failed).
+	CubeMap* cubeMap;
+	// GGX-prefiltered cube map for glossy reflections (mip level = roughness).
+	CubeMap* specularMap;
+	bool environmentReady;
 
 	float rotationY;
+	SkyboxMode mode;
 };
 
 #endif
@@ -0,0 +1,180 @@
+#include "softwareocclusion.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <emmintrin.h>
+
+SoftwareOcclusionBuffer::SoftwareOcclusionBuffer(const int width, const int height)
+{
+	this->width = std::max(4, (width + 3) & ~3);
+	this->height = std::max(1, height);
+	depth.resize((size_t)this->width * this->height);
+	numRasterizedTriangles = 0;
+	lastRenderTimeMs = 0.0f;
+	Clear();
+}
+
+SoftwareOcclusionBuffer::~SoftwareOcclusionBuffer()
+{
+	depth.clear();
+	screenTriangles.clear();
+}
+
+void SoftwareOcclusionBuffer::Clear()
+{
+	std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+void SoftwareOcclusionBuffer::RenderOccluders(const std::vector<glm::vec3>& triangles, const glm::mat4x4& MVP)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	// Transform and set up the triangles in parallel.
+	const int numTriangles = (int)(triangles.size() / 3);
+	screenTriangles.resize(numTriangles);
+	const float w = (float)width;
+	const float h = (float)height;
+	ThreadPool::Instance().ParallelFor(0, numTriangles, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			ScreenTriangle& tri = screenTriangles[t];
+			// Marked empty unless fully set up below.
+			tri.minY = 1;
+			tri.maxY = 0;
+			float z[3];
+			bool nearClipped = false;
+			for (int k = 0; k < 3; ++k) {
+				glm::vec4 clip = MVP * glm::vec4(triangles[3 * t + k], 1.0f);
+				// Skipping an occluder only makes the buffer less occluding, never wrong. A
+				// vertex behind the near plane would otherwise cover pixels where the clipped
+				// triangle is not drawn.
+				if (clip.w <= 1.0e-5f || clip.z < -clip.w) {
+					nearClipped = true;
+					break;
+				}
+				tri.x[k] = (clip.x / clip.w * 0.5f + 0.5f) * w;
+				tri.y[k] = (clip.y / clip.w * 0.5f + 0.5f) * h;
+				z[k] = clip.z / clip.w * 0.5f + 0.5f;
+			}
+			if (nearClipped)
+				continue;
+			float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+			if (std::fabs(area) < 1.0e-6f)
+				continue;
+			// Counter-clockwise, so every edge function is positive inside.
+			if (area < 0.0f) {
+				std::swap(tri.x[1], tri.x[2]);
+				std::swap(tri.y[1], tri.y[2]);
+			}
+			tri.maxDepth = std::min(1.0f, std::max(z[0], std::max(z[1], z[2])));
+			tri.minX = std::max(0, (int)std::floor(std::min(tri.x[0], std::min(tri.x[1], tri.x[2]))));
+			tri.maxX = std::min(width - 1, (int)std::ceil(std::max(tri.x[0], std::max(tri.x[1], tri.x[2]))));
+			tri.minY = std::max(0, (int)std::floor(std::min(tri.y[0], std::min(tri.y[1], tri.y[2]))));
+			tri.maxY = std::min(height - 1, (int)std::ceil(std::max(tri.y[0], std::max(tri.y[1], tri.y[2]))));
+			if (tri.minX > tri.maxX)
+				tri.maxY = tri.minY - 1;
+		}
+	}, 64);
+
+	numRasterizedTriangles = 0;
+	for (auto&& tri : screenTriangles)
+		numRasterizedTriangles += (tri.minY <= tri.maxY) ? 1 : 0;
+
+	// Each worker owns a band of rows, so no two threads write the same pixel.
+	const int rowsPerBand = 4;
+	const int numBands = (height + rowsPerBand - 1) / rowsPerBand;
+	ThreadPool::Instance().ParallelFor(0, numBands, [&](int begin, int end) {
+		RasterizeRows(begin * rowsPerBand, std::min(height, end * rowsPerBand));
+	});
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	lastRenderTimeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+void SoftwareOcclusionBuffer::RasterizeRows(const int rowBegin, const int rowEnd)
+{
+	const __m128 pixelOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (auto&& tri : screenTriangles) {
+		const int y0 = std::max(rowBegin, tri.minY);
+		const int y1 = std::min(rowEnd - 1, tri.maxY);
+		if (y0 > y1)
+			continue;
+
+		// Edge functions E(x, y) = A * x + B * y + C, E >= 0 inside the edge.
+		// (Shrinking them to full-pixel coverage would leave cracks along shared edges.)
+		float A[3], B[3], C[3];
+		for (int i = 0; i < 3; ++i) {
+			const int j = (i + 1) % 3;
+			A[i] = -(tri.y[j] - tri.y[i]);
+			B[i] = tri.x[j] - tri.x[i];
+			C[i] = -(A[i] * tri.x[i] + B[i] * tri.y[i]);
+		}
+		const __m128 A0 = _mm_set1_ps(A[0]), A1 = _mm_set1_ps(A[1]), A2 = _mm_set1_ps(A[2]);
+		const __m128 triDepth = _mm_set1_ps(tri.maxDepth);
+		const int xStart = tri.minX & ~3;
+
+		for (int py = y0; py <= y1; ++py) {
+			const float yc = (float)py + 0.5f;
+			const __m128 rowE0 = _mm_set1_ps(B[0] * yc + C[0]);
+			const __m128 rowE1 = _mm_set1_ps(B[1] * yc + C[1]);
+			const __m128 rowE2 = _mm_set1_ps(B[2] * yc + C[2]);
+			float* row = &depth[(size_t)py * width];
+			for (int x = xStart; x <= tri.maxX; x += 4) {
+				const __m128 xs = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(A0, xs), rowE0);
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(A1, xs), rowE1);
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(A2, xs), rowE2);
+				const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+					_mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+				const __m128 current = _mm_loadu_ps(row + x);
+				const __m128 nearer = _mm_min_ps(current, triDepth);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+			}
+		}
+	}
+}
+
+bool SoftwareOcclusionBuffer::IsSphereOccluded(const glm::vec3& center, const float radius, const glm::mat4x4& MVP) const
+{
+	// Screen rectangle and nearest depth of the sphere's bounding box.
+	glm::vec3 ndcMin = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 ndcMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (int i = 0; i < 8; ++i) {
+		glm::vec3 corner = center + radius * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+		glm::vec4 clip = MVP * glm::vec4(corner, 1.0f);
+		if (clip.w <= 1.0e-5f)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		ndcMin = glm::min(ndcMin, ndc);
+		ndcMax = glm::max(ndcMax, ndc);
+	}
+	const int x0 = std::max(0, (int)std::floor((ndcMin.x * 0.5f + 0.5f) * width));
+	const int x1 = std::min(width - 1, (int)std::floor((ndcMax.x * 0.5f + 0.5f) * width));
+	const int y0 = std::max(0, (int)std::floor((ndcMin.y * 0.5f + 0.5f) * height));
+	const int y1 = std::min(height - 1, (int)std::floor((ndcMax.y * 0.5f + 0.5f) * height));
+	if (x0 > x1 || y0 > y1)
+		return false;
+	const float nearestDepth = ndcMin.z * 0.5f + 0.5f;
+
+	// Occluded only if every covered pixel holds an occluder in front of the sphere.
+	const __m128 nearest = _mm_set1_ps(nearestDepth);
+	for (int py = y0; py <= y1; ++py) {
+		const float* row = &depth[(size_t)py * width];
+		int x = x0;
+		for (; x + 3 <= x1; x += 4) {
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nearest)) != 0)
+				return false;
+		}
+		for (; x <= x1; ++x) {
+			if (row[x] >= nearestDepth)
+				return false;
+		}
+	}
+	return true;
+}
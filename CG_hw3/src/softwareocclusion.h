@@ -0,0 +1,55 @@
+#ifndef SOFTWAREOCCLUSION_H
+#define SOFTWAREOCCLUSION_H
+
+// No GL or window-system headers: this module runs headless.
+#include <glm/glm.hpp>
+#include <vector>
+
+// SoftwareOcclusionBuffer Declarations.
+// A low-resolution depth buffer filled by a SIMD rasterizer with a few large occluders.
+// Pixels are sampled at their centers and receive the triangle's farthest depth, so a
+// query can only be wrong by the sub-pixel part of an occluder silhouette.
+class SoftwareOcclusionBuffer
+{
+public:
+	// SoftwareOcclusionBuffer Public Methods.
+	SoftwareOcclusionBuffer(const int width = 256, const int height = 128);
+	~SoftwareOcclusionBuffer();
+
+	void Clear();
+	// Rasterize a triangle list (3 object-space positions per triangle) on the worker threads.
+	// Triangles that cross the near plane are not clipped but skipped.
+	void RenderOccluders(const std::vector<glm::vec3>& triangles, const glm::mat4x4& MVP);
+	// True if an object-space sphere is hidden behind the rendered occluders.
+	bool IsSphereOccluded(const glm::vec3& center, const float radius, const glm::mat4x4& MVP) const;
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	const std::vector<float>& GetDepth() const { return depth; }
+	int GetNumRasterizedTriangles() const { return numRasterizedTriangles; }
+	float GetLastRenderTimeMs() const { return lastRenderTimeMs; }
+
+private:
+	// SoftwareOcclusionBuffer Private Methods.
+	void RasterizeRows(const int rowBegin, const int rowEnd);
+
+	// Screen-space occluder triangle, with the edge functions set up for rasterization.
+	struct ScreenTriangle
+	{
+		float x[3];
+		float y[3];
+		float maxDepth;
+		int minY, maxY;
+		int minX, maxX;
+	};
+
+	// SoftwareOcclusionBuffer Private Data.
+	int width;		// Multiple of 4 (one SSE register per 4 pixels).
+	int height;
+	std::vector<float> depth;
+	std::vector<ScreenTriangle> screenTriangles;
+	int numRasterizedTriangles;
+	float lastRenderTimeMs;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "sphericalharmonics.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+
+SphericalHarmonics::SphericalHarmonics()
+{
+	width = 0;
+	height = 0;
+	nextRow = 0;
+	for (int i = 0; i < 9; ++i) {
+		pending[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+		coefficients[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+	}
+	valid = false;
+	projectionTimeMs = 0.0f;
+	lastProjectionTimeMs = 0.0f;
+}
+
+SphericalHarmonics::~SphericalHarmonics()
+{
+	image.clear();
+}
+
+void SphericalHarmonics::EvalBasis(const glm::vec3& d, float basis[9])
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * d.y;
+	basis[2] = 0.488603f * d.z;
+	basis[3] = 0.488603f * d.x;
+	basis[4] = 1.092548f * d.x * d.y;
+	basis[5] = 1.092548f * d.y * d.z;
+	basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+	basis[7] = 1.092548f * d.x * d.z;
+	basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+void SphericalHarmonics::BeginProjection(const unsigned char* pixels, const int w, const int h,
+										const int channels, const size_t rowStride)
+{
+	width = w;
+	height = h;
+	nextRow = 0;
+	projectionTimeMs = 0.0f;
+	for (int i = 0; i < 9; ++i)
+		pending[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+	image.resize((size_t)width * height);
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* src = pixels + y * rowStride;
+		for (int x = 0; x < width; ++x, src += channels) {
+			uint32_t b = src[0];
+			uint32_t g = channels >= 3 ? src[1] : src[0];
+			uint32_t r = channels >= 3 ? src[2] : src[0];
+			image[(size_t)y * width + x] = b | (g << 8) | (r << 16);
+		}
+	}
+}
+
+bool SphericalHarmonics::ContinueProjection(const int maxRows)
+{
+	if (!IsProjecting())
+		return false;
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	const int rowEnd = std::min(height, nextRow + std::max(1, maxRows));
+	const float pi = glm::pi<float>();
+	// Solid angle of a texel: dPhi * dTheta * cos(theta).
+	const float texelArea = (2.0f * pi / (float)width) * (pi / (float)height);
+	ThreadPool::Instance().ParallelFor(nextRow, rowEnd, [&](int begin, int end) {
+		glm::vec3 sums[9];
+		for (int i = 0; i < 9; ++i)
+			sums[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+		for (int y = begin; y < end; ++y) {
+			// Every texel of a row shares theta and the solid angle.
+			const float theta = ((float)y + 0.5f) / (float)height * pi - 0.5f * pi;
+			const float cosTheta = std::cos(theta);
+			const float sinTheta = std::sin(theta);
+			const float weight = texelArea * cosTheta / 255.0f;
+			const uint32_t* row = &image[(size_t)y * width];
+			for (int x = 0; x < width; ++x) {
+				const float phi = ((float)x + 0.5f) / (float)width * 2.0f * pi;
+				glm::vec3 dir = glm::vec3(cosTheta * std::cos(phi), sinTheta, cosTheta * std::sin(phi));
+				float basis[9];
+				EvalBasis(dir, basis);
+				const uint32_t texel = row[x];
+				glm::vec3 color = weight * glm::vec3((float)((texel >> 16) & 0xff), (float)((texel >> 8) & 0xff), (float)(texel & 0xff));
+				for (int i = 0; i < 9; ++i)
+					sums[i] += basis[i] * color;
+			}
+		}
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		for (int i = 0; i < 9; ++i)
+			pending[i] += sums[i];
+	}, 4);
+	nextRow = rowEnd;
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	projectionTimeMs += std::chrono::duration<float, std::milli>(endTime - startTime).count();
+	if (IsProjecting())
+		return false;
+
+	for (int i = 0; i < 9; ++i)
+		coefficients[i] = pending[i];
+	valid = true;
+	lastProjectionTimeMs = projectionTimeMs;
+	image.clear();
+	image.shrink_to_fit();
+	return true;
+}
+
+void SphericalHarmonics::GetIrradianceCoefficients(glm::vec4 out[9]) const
+{
+	// Cosine lobe convolution per band (PI, 2PI/3, PI/4), divided by PI.
+	const float bandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+	for (int i = 0; i < 9; ++i) {
+		const int band = i == 0 ? 0 : (i < 4 ? 1 : 2);
+		out[i] = glm::vec4(coefficients[i] * bandScale[band], 0.0f);
+	}
+}
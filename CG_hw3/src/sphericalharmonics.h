@@ -0,0 +1,53 @@
+#ifndef SPHERICALHARMONICS_H
+#define SPHERICALHARMONICS_H
+
+// No GL or window-system headers: this module runs headless.
+#include <glm/glm.hpp>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+// SphericalHarmonics Declarations.
+// Projects an equirectangular panorama onto the 9 real SH basis functions of bands 0-2.
+// Directions follow the skybox mapping: u = phi / 2PI from +x towards +z, v = 0 at the bottom.
+// The projection can run a few rows at a time, so a new panorama is picked up over several
+// frames while the previous coefficients stay in use.
+class SphericalHarmonics
+{
+public:
+	// SphericalHarmonics Public Methods.
+	SphericalHarmonics();
+	~SphericalHarmonics();
+
+	// Start projecting a BGR(A) 8-bit image, bottom row first (the pixels are copied).
+	void BeginProjection(const unsigned char* pixels, const int width, const int height,
+						const int channels, const size_t rowStride);
+	// Project up to maxRows more rows on the workers; true when the new coefficients are ready.
+	bool ContinueProjection(const int maxRows);
+	bool IsProjecting() const { return nextRow < height; }
+
+	// Coefficients of the radiance.
+	const glm::vec3* GetCoefficients() const { return coefficients; }
+	// Coefficients pre-multiplied by the cosine lobe and 1/PI: evaluating them at a normal
+	// gives the irradiance / PI, i.e. what a white Lambertian surface reflects.
+	void GetIrradianceCoefficients(glm::vec4 out[9]) const;
+	bool IsValid() const { return valid; }
+	float GetLastProjectionTimeMs() const { return lastProjectionTimeMs; }
+
+	static void EvalBasis(const glm::vec3& dir, float basis[9]);
+
+private:
+	// SphericalHarmonics Private Data.
+	std::vector<uint32_t> image;	// BGRA.
+	int width;
+	int height;
+	int nextRow;
+	glm::vec3 pending[9];
+	std::mutex pendingMutex;
+	glm::vec3 coefficients[9];
+	bool valid;
+	float projectionTimeMs;
+	float lastProjectionTimeMs;
+};
+
+#endif
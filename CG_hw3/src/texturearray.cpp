@@ -0,0 +1,107 @@
+#include "texturearray.h"
+
+TextureArray::TextureArray()
+{
+	textureObj = 0;
+	width = 0;
+	height = 0;
+	numLayers = 0;
+	gpuBytes = 0;
+}
+
+TextureArray::~TextureArray()
+{
+	glDeleteTextures(1, &textureObj);
+}
+
+std::string TextureArray::GetPackingKey(const ImageTexture* texture)
+{
+	std::ostringstream key;
+	key << texture->GetWidth() << "x" << texture->GetHeight() << " ";
+	if (texture->IsCompressed())
+		key << BlockCompressedImage::GetFormatName(texture->blockFormat);
+	else
+		key << texture->GetNumChannels() << "ch";
+	return key.str();
+}
+
+bool TextureArray::Create(const std::vector<ImageTexture*>& textures)
+{
+	if (textures.empty())
+		return false;
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	if ((int)textures.size() > maxLayers) {
+		std::cerr << "[ERROR] Too many layers for a texture array: " << textures.size() << std::endl;
+		return false;
+	}
+	const ImageTexture* first = textures[0];
+	width = first->GetWidth();
+	height = first->GetHeight();
+	numLayers = (int)textures.size();
+	gpuBytes = 0;
+
+	if (textureObj == 0)
+		glGenTextures(1, &textureObj);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureObj);
+	for (int level = 0; level < first->numLevels; ++level) {
+		const int levelWidth = std::max(1, width >> level);
+		const int levelHeight = std::max(1, height >> level);
+		if (first->IsCompressed()) {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first->internalFormat, levelWidth, levelHeight,
+				numLayers, 0, (GLsizei)(first->GetLevelBytes(level) * numLayers), nullptr);
+		}
+		else {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first->internalFormat, levelWidth, levelHeight, numLayers,
+						0, first->GetPixelFormat(), GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first->numLevels - 1);
+
+	// The CPU copies are gone by now (MemoryBudget), so every level is copied from the textures.
+	std::vector<uint8_t> readback;
+	for (int layer = 0; layer < numLayers; ++layer) {
+		const ImageTexture* texture = textures[layer];
+		for (int level = 0; level < first->numLevels; ++level) {
+			const int levelWidth = std::max(1, width >> level);
+			const int levelHeight = std::max(1, height >> level);
+			if (GLEW_ARB_copy_image) {
+				glCopyImageSubData(texture->textureObj, GL_TEXTURE_2D, level, 0, 0, 0,
+								textureObj, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, levelWidth, levelHeight, 1);
+				continue;
+			}
+			readback.resize(texture->GetLevelBytes(level));
+			glBindTexture(GL_TEXTURE_2D, texture->textureObj);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			if (first->IsCompressed()) {
+				glGetCompressedTexImage(GL_TEXTURE_2D, level, readback.data());
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, levelWidth, levelHeight, 1,
+										first->internalFormat, (GLsizei)readback.size(), readback.data());
+			}
+			else {
+				glGetTexImage(GL_TEXTURE_2D, level, texture->GetPixelFormat(), GL_UNSIGNED_BYTE, readback.data());
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, levelWidth, levelHeight, 1,
+								texture->GetPixelFormat(), GL_UNSIGNED_BYTE, readback.data());
+			}
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		gpuBytes += texture->GetGpuBytes();
+	}
+	// Same sampling as ImageTexture.
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
+
+void TextureArray::Bind(GLenum textureUnit)
+{
+	MarkUsed();
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureObj);
+}
@@ -0,0 +1,43 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include "headers.h"
+#include "imagetexture.h"
+
+// TextureArray Declarations.
+// Resident image textures of the same size and format copied into the layers of one
+// GL_TEXTURE_2D_ARRAY, so draws that use different images can share a single bind.
+// Accounted by MemoryBudget but never evicted.
+class TextureArray : public BudgetedResource
+{
+public:
+	// TextureArray Public Methods.
+	TextureArray();
+	~TextureArray();
+
+	// Textures that may share an array have the same key (size and pixel/block format).
+	static std::string GetPackingKey(const ImageTexture* texture);
+	// Copy the textures (resident with every level, one packing key) into layers 0..n-1, on
+	// the GPU with ARB_copy_image or else through a read back.
+	bool Create(const std::vector<ImageTexture*>& textures);
+	void Bind(GLenum textureUnit);
+
+	int GetNumLayers() const { return numLayers; }
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+
+	// BudgetedResource interface.
+	const char* GetResourceType() const { return "texture array"; }
+	size_t GetGpuBytes() const { return gpuBytes; }
+	size_t GetCpuBytes() const { return 0; }
+
+private:
+	// TextureArray Private Data.
+	GLuint textureObj;
+	int width;
+	int height;
+	int numLayers;
+	size_t gpuBytes;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "texturemanager.h"
+
+uint64_t TextureContents::FindOrAdd(const uint64_t textureId, const std::string& filePath, const uint64_t contentHash,
+									const TextureCompression compression, const std::vector<unsigned char>& data)
+{
+	const std::string key = std::to_string(contentHash) + "|" + std::to_string((int)compression);
+	// The files are compared outside the lock; owners registered meanwhile are compared after.
+	std::vector<uint64_t> compared;
+	while (true) {
+		std::vector<Owner> candidates;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto range = owners.equal_range(key);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second.textureId == textureId)
+					return 0;
+				if (std::find(compared.begin(), compared.end(), it->second.textureId) == compared.end())
+					candidates.push_back(it->second);
+			}
+			if (candidates.empty()) {
+				owners.emplace(key, Owner{ textureId, filePath });
+				return 0;
+			}
+		}
+		for (auto&& candidate : candidates) {
+			std::vector<unsigned char> candidateData;
+			if (ImageTexture::ReadFile(candidate.filePath, candidateData) == contentHash && candidateData == data)
+				return candidate.textureId;
+			compared.push_back(candidate.textureId);
+		}
+	}
+}
+
+void TextureContents::Remove(const uint64_t textureId)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::erase_if(owners, [textureId](const auto& owner) { return owner.second.textureId == textureId; });
+}
+
+TextureManager& TextureManager::Instance()
+{
+	static TextureManager manager;
+	return manager;
+}
+
+TextureManager::TextureManager()
+{
+	contents = std::make_shared<TextureContents>();
+	numShared = 0;
+	numContentShared = 0;
+}
+
+TextureManager::~TextureManager()
+{
+	// Textures still held at exit belong to a GL context that is gone; just drop the records.
+	for (auto&& entry : entries)
+		delete entry.second;
+	entries.clear();
+	byPath.clear();
+	byId.clear();
+}
+
+ImageTexture* TextureManager::Acquire(const std::string& filePath, const bool streamed,
+									const TextureCompression compression)
+{
+	// The same file compressed differently is a different texture.
+	const std::string suffix = "|" + std::to_string((int)compression);
+	std::error_code ec;
+	std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filePath, ec);
+	const std::string pathKey = (ec ? filePath : canonicalPath.string()) + suffix;
+
+	auto pathIt = byPath.find(pathKey);
+	if (pathIt != byPath.end()) {
+		++pathIt->second->refCount;
+		++numShared;
+		return pathIt->second->texture;
+	}
+
+	if (!std::filesystem::is_regular_file(filePath, ec)) {
+		std::cerr << "[ERROR] Failed to load image texture: " << filePath << std::endl;
+		return nullptr;
+	}
+
+	Entry* entry = new Entry();
+	entry->texture = new ImageTexture(filePath, streamed, compression, true);
+	entry->refCount = 1;
+	entry->pathKey = pathKey;
+	entries[entry->texture] = entry;
+	byPath[pathKey] = entry;
+	byId[entry->texture->id] = entry;
+	return entry->texture;
+}
+
+bool TextureManager::ShareContent(ImageTexture* texture, const uint64_t ownerId)
+{
+	auto ownerIt = byId.find(ownerId);
+	if (ownerIt == byId.end() || entries.count(texture) == 0 || ownerIt->second->texture == texture)
+		return false;
+	// The copy holds a reference on the owner until it is deleted itself.
+	++ownerIt->second->refCount;
+	texture->ShareWith(ownerIt->second->texture);
+	++numContentShared;
+	return true;
+}
+
+void TextureManager::Release(ImageTexture* texture)
+{
+	if (texture == nullptr)
+		return;
+	auto it = entries.find(texture);
+	if (it == entries.end()) {
+		std::cerr << "[ERROR] Releasing a texture the manager does not own: " << texture->GetPath() << std::endl;
+		return;
+	}
+	Entry* entry = it->second;
+	if (--entry->refCount > 0)
+		return;
+
+	byPath.erase(entry->pathKey);
+	byId.erase(entry->texture->id);
+	entries.erase(it);
+	contents->Remove(entry->texture->id);
+	ImageTexture* owner = entry->texture->shared;
+	delete entry->texture;
+	delete entry;
+	Release(owner);
+}
+
+size_t TextureManager::GetResidentBytes() const
+{
+	size_t total = 0;
+	for (auto&& entry : entries)
+		total += entry.first->GetGpuBytes();
+	return total;
+}
+
+size_t TextureManager::GetCpuBytes() const
+{
+	size_t total = 0;
+	for (auto&& entry : entries)
+		total += entry.first->GetCpuBytes();
+	return total;
+}
+
+void TextureManager::PrintStats() const
+{
+	// Copies sharing another's image are not counted as textures of their own.
+	int numTextures = 0;
+	int numResident = 0;
+	int numCopies = 0;
+	int numReferences = 0;
+	for (auto&& entry : entries) {
+		numReferences += entry.second->refCount;
+		if (entry.first->shared != nullptr) {
+			++numCopies;
+			continue;
+		}
+		++numTextures;
+		numResident += entry.first->IsResident() ? 1 : 0;
+	}
+	std::cout << std::fixed << std::setprecision(2)
+			  << "Textures: " << numTextures << " (" << numResident << " resident, "
+			  << numCopies << " copies under other names sharing them, " << numReferences << " references, "
+			  << numShared + numContentShared << " loads avoided), "
+			  << GetResidentBytes() / (1024.0 * 1024.0) << " MB video memory, "
+			  << GetCpuBytes() / (1024.0 * 1024.0) << " MB CPU copies" << std::endl;
+	std::cout.unsetf(std::ios::fixed);
+	std::cout << std::setprecision(6);
+}
@@ -0,0 +1,91 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include "headers.h"
+#include "imagetexture.h"
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+// TextureContents Declarations.
+// The file contents of the shareable textures (by hash and compression), so the decode
+// workers recognize a copy of a loaded image under another name. An entry lives as long as
+// its texture; thread-safe.
+class TextureContents
+{
+public:
+	// TextureContents Public Methods.
+	// The id of a registered texture whose file holds the same bytes as data (hashing to
+	// contentHash), compared byte for byte, with the same compression. Otherwise registers
+	// textureId for them and returns 0 (also when it is registered already).
+	uint64_t FindOrAdd(const uint64_t textureId, const std::string& filePath, const uint64_t contentHash,
+					const TextureCompression compression, const std::vector<unsigned char>& data);
+	void Remove(const uint64_t textureId);
+
+private:
+	struct Owner
+	{
+		uint64_t textureId;
+		std::string filePath;
+	};
+
+	// TextureContents Private Data.
+	std::mutex mutex;
+	// Several owners per key only for different files with colliding hashes.
+	std::unordered_multimap<std::string, Owner> owners;
+};
+
+// TextureManager Declarations.
+// Registry of the loaded image textures, looked up by canonical path, so the same image
+// referenced from several materials is loaded once. Copies under another name share the
+// first one's image: the decode workers find them by content (TextureContents), which keeps
+// file reads off the GL thread, and the copy then forwards to it (ImageTexture::GetShared).
+// Textures are reference counted and deleted, GPU and CPU copies included, when the last user
+// releases them.
+class TextureManager
+{
+public:
+	// TextureManager Public Methods.
+	static TextureManager& Instance();
+
+	// Shared texture for an image file, loaded on the first request (nullptr if the file is
+	// missing). Every Acquire must be matched by a Release.
+	ImageTexture* Acquire(const std::string& filePath, const bool streamed = true,
+						const TextureCompression compression = TEXTURE_UNCOMPRESSED);
+	void Release(ImageTexture* texture);
+	// Point texture at the texture registered as ownerId, whose file has the same contents
+	// (TextureStreamer, GL thread); false if that one has been released meanwhile.
+	bool ShareContent(ImageTexture* texture, const uint64_t ownerId);
+	// Held by the decode tasks, which may outlive the manager at exit.
+	std::shared_ptr<TextureContents> GetContents() const { return contents; }
+
+	int GetNumTextures() const { return (int)entries.size(); }
+	// Video memory of the resident textures, mip chains included.
+	size_t GetResidentBytes() const;
+	// Images kept on the CPU (decoded pixels and compressed levels).
+	size_t GetCpuBytes() const;
+	void PrintStats() const;
+
+private:
+	struct Entry
+	{
+		ImageTexture* texture;
+		int refCount;
+		std::string pathKey;
+	};
+
+	// TextureManager Private Methods.
+	TextureManager();
+	~TextureManager();
+
+	// TextureManager Private Data.
+	std::unordered_map<ImageTexture*, Entry*> entries;
+	std::unordered_map<std::string, Entry*> byPath;
+	std::unordered_map<uint64_t, Entry*> byId;
+	std::shared_ptr<TextureContents> contents;
+	// Acquires of a loaded path, and textures sharing another's image.
+	int numShared;
+	int numContentShared;
+};
+
+#endif
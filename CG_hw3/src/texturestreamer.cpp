@@ -0,0 +1,256 @@
+#include "texturestreamer.h"
+#include "texturemanager.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Shared by every texture that is not resident; created on first use.
+static GLuint placeholderTexId = 0;
+
+TextureStreamer& TextureStreamer::Instance()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+TextureStreamer::TextureStreamer()
+{
+	decoded = std::make_shared<DecodedQueue>();
+	for (int i = 0; i < numPbos; ++i)
+		pboIds[i] = 0;
+	pboSize = 0;
+	nextPbo = 0;
+	byteBudget = 4 * 1024 * 1024;
+	lastFrameBytes = 0;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	// The GL context may already be gone: GL objects are freed by ReleaseGLResources.
+	for (auto& request : requests)
+		request->cancelled = true;
+	requests.clear();
+	uploads.clear();
+}
+
+GLuint TextureStreamer::GetPlaceholder()
+{
+	if (placeholderTexId == 0) {
+		// Mid gray, so untextured materials look like their diffuse color at half strength.
+		const unsigned char gray[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &placeholderTexId);
+		glBindTexture(GL_TEXTURE_2D, placeholderTexId);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, gray);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	return placeholderTexId;
+}
+
+void TextureStreamer::Request(ImageTexture* texture)
+{
+	std::shared_ptr<StreamRequest> request = std::make_shared<StreamRequest>();
+	request->texture = texture;
+	request->path = texture->GetPath();
+	request->compression = texture->compression;
+	request->textureId = texture->shareable ? texture->id : 0;
+	request->sharedWith = 0;
+	request->cancelled = false;
+	request->storageCreated = false;
+	request->level = 0;
+	request->nextRow = 0;
+	requests.push_back(request);
+
+	// The task only touches the request, the queue and the content registry, never the texture
+	// or the streamer.
+	std::shared_ptr<DecodedQueue> queue = decoded;
+	std::shared_ptr<TextureContents> contents = TextureManager::Instance().GetContents();
+	ThreadPool::Instance().Async([request, queue, contents]() {
+		if (request->cancelled)
+			return;
+		std::vector<unsigned char> data;
+		const uint64_t contentHash = ImageTexture::ReadFile(request->path, data);
+		if (contentHash == 0) {
+			std::cerr << "[ERROR] Failed to load image texture: " << request->path << std::endl;
+		}
+		else {
+			// A copy of a loaded file is not decoded: Update points the texture at that one.
+			if (request->textureId != 0)
+				request->sharedWith = contents->FindOrAdd(request->textureId, request->path, contentHash,
+														request->compression, data);
+			if (request->sharedWith == 0) {
+				request->image = ImageTexture::DecodeImage(request->path, &data);
+				if (request->compression != TEXTURE_UNCOMPRESSED && !request->image.empty())
+					request->compressed.reset(ImageTexture::CompressImage(request->image, request->path, request->compression));
+			}
+		}
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->requests.push_back(request);
+	});
+}
+
+void TextureStreamer::Cancel(ImageTexture* texture)
+{
+	for (size_t i = 0; i < requests.size(); ++i) {
+		if (requests[i]->texture == texture) {
+			// A decode still in flight finishes, but its result is dropped in Update.
+			requests[i]->cancelled = true;
+			requests.erase(requests.begin() + i);
+			return;
+		}
+	}
+}
+
+int TextureStreamer::Update()
+{
+	std::vector<std::shared_ptr<StreamRequest>> copies;
+	{
+		std::lock_guard<std::mutex> lock(decoded->mutex);
+		while (!decoded->requests.empty()) {
+			std::shared_ptr<StreamRequest> request = decoded->requests.front();
+			decoded->requests.pop_front();
+			if (request->cancelled)
+				continue;
+			if (request->sharedWith != 0)
+				copies.push_back(request);
+			else
+				uploads.push_back(request);
+		}
+	}
+	// Copies of loaded files share their texture; if it was released meanwhile, the copy is
+	// requested again (and this time loads, or finds another copy).
+	for (auto&& request : copies) {
+		requests.erase(std::remove(requests.begin(), requests.end(), request), requests.end());
+		if (!TextureManager::Instance().ShareContent(request->texture, request->sharedWith))
+			Request(request->texture);
+	}
+
+	int numResident = 0;
+	size_t frameBytes = 0;
+	while (!uploads.empty() && frameBytes < byteBudget) {
+		std::shared_ptr<StreamRequest> request = uploads.front();
+		if (request->cancelled) {
+			uploads.pop_front();
+			continue;
+		}
+		bool failed = false;
+		if (!request->storageCreated) {
+			failed = !request->texture->CreateStorage(request->image, request->compressed.release());
+			request->storageCreated = true;
+		}
+		if (!failed) {
+			frameBytes += UploadChunk(*request, byteBudget - frameBytes);
+			if (!IsUploaded(*request))
+				break;
+			request->texture->FinishUpload();
+			++numResident;
+		}
+		// Done (or failed: the texture keeps the placeholder).
+		uploads.pop_front();
+		request->image.release();
+		requests.erase(std::remove(requests.begin(), requests.end(), request), requests.end());
+	}
+	lastFrameBytes = frameBytes;
+	return numResident;
+}
+
+bool TextureStreamer::IsUploaded(const StreamRequest& request)
+{
+	const BlockCompressedImage* compressed = request.texture->compressedImage;
+	if (compressed != nullptr)
+		return request.level >= compressed->GetNumLevels();
+	return request.nextRow >= request.image.rows;
+}
+
+bool TextureStreamer::StageInPbo(const void* data, const size_t numBytes)
+{
+	// Ring buffers hold a whole frame's budget, and at least one row.
+	const size_t neededSize = std::max(byteBudget, numBytes);
+	if (pboIds[0] == 0 || pboSize < neededSize) {
+		if (pboIds[0] != 0)
+			glDeleteBuffers(numPbos, pboIds);
+		glGenBuffers(numPbos, pboIds);
+		for (int i = 0; i < numPbos; ++i) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboIds[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, neededSize, nullptr, GL_STREAM_DRAW);
+		}
+		pboSize = neededSize;
+	}
+
+	// The buffer used three chunks ago has been consumed by now, so mapping with
+	// invalidation does not wait on the GPU.
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboIds[nextPbo]);
+	nextPbo = (nextPbo + 1) % numPbos;
+	void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, numBytes,
+								GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dst == nullptr) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	std::memcpy(dst, data, numBytes);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	return true;
+}
+
+size_t TextureStreamer::UploadChunk(StreamRequest& request, const size_t maxBytes)
+{
+	ImageTexture* texture = request.texture;
+	const BlockCompressedImage* compressed = texture->compressedImage;
+	const size_t chunkBytes = std::min(maxBytes, std::max(pboSize, byteBudget));
+	size_t numBytes = 0;
+
+	if (compressed != nullptr) {
+		// Whole rows of 4x4 blocks of the current level.
+		const int level = request.level;
+		const int levelWidth = compressed->GetLevelWidth(level);
+		const int levelHeight = compressed->GetLevelHeight(level);
+		const size_t blockRowBytes = compressed->GetBlockRowBytes(level);
+		const int numBlockRows = (levelHeight + 3) / 4;
+		const int numRows = std::max(1, std::min((int)(chunkBytes / blockRowBytes), numBlockRows - request.nextRow));
+		numBytes = blockRowBytes * numRows;
+		if (!StageInPbo(compressed->GetLevel(level).data() + request.nextRow * blockRowBytes, numBytes))
+			return 0;
+		glBindTexture(GL_TEXTURE_2D, texture->uploadTextureObj);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 4 * request.nextRow, levelWidth,
+			std::min(4 * numRows, levelHeight - 4 * request.nextRow), texture->GetCompressedFormat(),
+			(GLsizei)numBytes, nullptr);
+		request.nextRow += numRows;
+		if (request.nextRow == numBlockRows) {
+			++request.level;
+			request.nextRow = 0;
+		}
+	}
+	else {
+		const cv::Mat& image = request.image;
+		const size_t rowBytes = (size_t)image.cols * image.channels();
+		const int numRows = std::max(1, std::min((int)(chunkBytes / rowBytes), image.rows - request.nextRow));
+		numBytes = rowBytes * numRows;
+		if (!StageInPbo(image.ptr(request.nextRow), numBytes))
+			return 0;
+		glBindTexture(GL_TEXTURE_2D, texture->uploadTextureObj);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, request.nextRow, image.cols, numRows,
+						texture->GetPixelFormat(), GL_UNSIGNED_BYTE, nullptr);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		request.nextRow += numRows;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return numBytes;
+}
+
+void TextureStreamer::ReleaseGLResources()
+{
+	if (pboIds[0] != 0) {
+		glDeleteBuffers(numPbos, pboIds);
+		for (int i = 0; i < numPbos; ++i)
+			pboIds[i] = 0;
+		pboSize = 0;
+	}
+	if (placeholderTexId != 0) {
+		glDeleteTextures(1, &placeholderTexId);
+		placeholderTexId = 0;
+	}
+}
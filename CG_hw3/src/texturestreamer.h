@@ -0,0 +1,91 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include "headers.h"
+#include "imagetexture.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// TextureStreamer Declarations.
+// Loads ImageTextures in the background: decode, flip and block compression run on the
+// thread pool, and the GL thread uploads the rows (block rows when compressed) through a
+// ring of pixel buffer objects, at most byteBudget bytes per frame, so a large texture is
+// spread over several frames instead of stalling one. Until a texture is resident, ImageTexture::Bind binds a 1x1 placeholder;
+// textures evicted by MemoryBudget are reloaded the same way. The workers hash each file as
+// they read it: a shareable texture whose file is a copy of a loaded one is not decoded, but
+// shares that one's image (TextureManager::ShareContent).
+class TextureStreamer
+{
+public:
+	// TextureStreamer Public Methods.
+	static TextureStreamer& Instance();
+
+	// Called by ImageTexture (GL thread).
+	void Request(ImageTexture* texture);
+	void Cancel(ImageTexture* texture);
+	// Upload decoded images within the byte budget; call once per frame on the GL thread.
+	// Returns the number of textures that became resident.
+	int Update();
+	// Drop the PBOs and the placeholder (before the GL context goes away).
+	void ReleaseGLResources();
+
+	void SetByteBudget(const size_t bytes) { byteBudget = std::max(bytes, (size_t)4096); }
+	size_t GetByteBudget() const { return byteBudget; }
+	int GetNumPending() const { return (int)requests.size(); }
+	size_t GetLastFrameBytes() const { return lastFrameBytes; }
+
+	static GLuint GetPlaceholder();
+
+private:
+	// Per-texture state shared with the decode task.
+	struct StreamRequest
+	{
+		ImageTexture* texture;
+		std::string path;
+		TextureCompression compression;
+		// ImageTexture id of a shareable texture (0: load it whatever its contents), and that
+		// of the texture whose file the worker found to have the same contents (0: none).
+		uint64_t textureId;
+		uint64_t sharedWith;
+		cv::Mat image;
+		std::unique_ptr<BlockCompressedImage> compressed;
+		std::atomic<bool> cancelled;
+		bool storageCreated;
+		// Next row (block row when compressed) of the mip level being uploaded.
+		int level;
+		int nextRow;
+	};
+	// Decoded requests, filled by the workers; held by shared_ptr so a task still running
+	// at exit does not outlive it.
+	struct DecodedQueue
+	{
+		std::mutex mutex;
+		std::deque<std::shared_ptr<StreamRequest>> requests;
+	};
+	static const int numPbos = 3;
+
+	// TextureStreamer Private Methods.
+	TextureStreamer();
+	~TextureStreamer();
+	// Upload up to maxBytes of the request (at least one row); returns the bytes uploaded.
+	size_t UploadChunk(StreamRequest& request, const size_t maxBytes);
+	// Copy data into the next PBO of the ring and leave it bound; false if mapping failed.
+	bool StageInPbo(const void* data, const size_t numBytes);
+	static bool IsUploaded(const StreamRequest& request);
+
+	// TextureStreamer Private Data.
+	// Requested and not yet resident (GL thread only).
+	std::vector<std::shared_ptr<StreamRequest>> requests;
+	std::shared_ptr<DecodedQueue> decoded;
+	// Decoded, waiting for upload, in arrival order (GL thread only).
+	std::deque<std::shared_ptr<StreamRequest>> uploads;
+	GLuint pboIds[numPbos];
+	size_t pboSize;
+	int nextPbo;
+	size_t byteBudget;
+	size_t lastFrameBytes;
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "threadpool.h"
+
+#include <iostream>
+#include <iomanip>
+
+// The pool and worker index of the calling thread (-1 off the pool's workers).
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+void PendingTask::Run()
+{
+	if (started.exchange(true))
+		return;
+	task();
+	task = nullptr;
+	std::vector<std::shared_ptr<PendingTask>> ready;
+	{
+		std::lock_guard<std::mutex> lock(doneMutex);
+		dependencies.clear();
+		done = true;
+		doneCond.notify_all();
+		ready.swap(dependents);
+	}
+	for (auto&& dependent : ready) {
+		if (dependent->numDependencies.fetch_sub(1) == 1)
+			pool->QueueReady(dependent);
+	}
+}
+
+void PendingTask::Wait()
+{
+	// Help with the dependencies rather than block on tasks still queued behind busy workers.
+	if (!started) {
+		std::vector<std::shared_ptr<PendingTask>> waitFor;
+		{
+			std::lock_guard<std::mutex> lock(doneMutex);
+			waitFor = dependencies;
+		}
+		for (auto&& dependency : waitFor)
+			dependency->Wait();
+		Run();
+	}
+	std::unique_lock<std::mutex> lock(doneMutex);
+	doneCond.wait(lock, [this]() { return done.load(); });
+}
+
+ThreadPool::ThreadPool(const unsigned int numThreads)
+{
+	stopping = false;
+	numQueued = 0;
+	numMainThreadTasks = 0;
+	statsStart = std::chrono::steady_clock::now();
+
+	// The calling thread also takes part in ParallelFor, so spawn one less worker.
+	unsigned int n = numThreads;
+	if (n == 0)
+		n = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int i = 1; i < n; ++i)
+		workers.push_back(std::make_unique<Worker>());
+	for (unsigned int i = 1; i < n; ++i)
+		threads.emplace_back(&ThreadPool::WorkerLoop, this, (int)i - 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	sleepCond.notify_all();
+	for (auto&& thread : threads)
+		thread.join();
+	threads.clear();
+	workers.clear();
+	MainThreadTask* node = mainThreadTasks.PopAll();
+	while (node != nullptr) {
+		MainThreadTask* next = node->next;
+		delete node;
+		node = next;
+	}
+}
+
+ThreadPool& ThreadPool::Instance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+int ThreadPool::GetGrainSize(const int count, const int grainSize) const
+{
+	// A few chunks per thread keeps the load balanced when chunk costs differ.
+	return std::max(grainSize, (count + 4 * GetNumThreads() - 1) / (4 * GetNumThreads()));
+}
+
+void ThreadPool::ParallelFor(const int begin, const int end, const std::function<void(int, int)>& body,
+							const int grainSize)
+{
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+
+	const int grain = GetGrainSize(count, grainSize);
+	const int numChunks = (count + grain - 1) / grain;
+	if (numChunks == 1 || threads.empty()) {
+		body(begin, end);
+		return;
+	}
+
+	struct SharedState {
+		std::atomic<int> nextChunk{ 0 };
+		std::atomic<int> doneChunks{ 0 };
+		std::mutex doneMutex;
+		std::condition_variable doneCond;
+	};
+	auto state = std::make_shared<SharedState>();
+
+	auto runChunks = [=, &body]() {
+		int chunk;
+		while ((chunk = state->nextChunk.fetch_add(1)) < numChunks) {
+			const int chunkBegin = begin + chunk * grain;
+			body(chunkBegin, std::min(end, chunkBegin + grain));
+			if (state->doneChunks.fetch_add(1) + 1 == numChunks) {
+				std::lock_guard<std::mutex> lock(state->doneMutex);
+				state->doneCond.notify_all();
+			}
+		}
+	};
+
+	// Helpers that start after the last chunk was claimed return at once.
+	const int numHelpers = std::min((int)threads.size(), numChunks - 1);
+	for (int i = 0; i < numHelpers; ++i)
+		Submit(runChunks);
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(state->doneMutex);
+	state->doneCond.wait(lock, [&]() { return state->doneChunks.load() == numChunks; });
+}
+
+void ThreadPool::Async(std::function<void()> task)
+{
+	if (threads.empty()) {
+		task();
+		return;
+	}
+	Submit(std::move(task));
+}
+
+std::shared_ptr<PendingTask> ThreadPool::Spawn(std::function<void()> task)
+{
+	return Spawn(std::move(task), std::vector<std::shared_ptr<PendingTask>>());
+}
+
+std::shared_ptr<PendingTask> ThreadPool::Spawn(std::function<void()> task,
+											const std::vector<std::shared_ptr<PendingTask>>& dependencies)
+{
+	std::shared_ptr<PendingTask> pending = std::make_shared<PendingTask>(this, std::move(task));
+	// One count for this call, so the task is not queued before every dependency is added.
+	pending->numDependencies = (int)dependencies.size() + 1;
+	pending->dependencies = dependencies;
+	for (auto&& dependency : dependencies) {
+		std::lock_guard<std::mutex> lock(dependency->doneMutex);
+		if (dependency->done)
+			pending->numDependencies.fetch_sub(1);
+		else
+			dependency->dependents.push_back(pending);
+	}
+	if (pending->numDependencies.fetch_sub(1) == 1)
+		QueueReady(pending);
+	return pending;
+}
+
+void ThreadPool::QueueReady(const std::shared_ptr<PendingTask>& task)
+{
+	// Without workers it runs in Wait.
+	if (!threads.empty())
+		Submit([task]() { task->Run(); });
+}
+
+void ThreadPool::RunOnMainThread(std::function<void()> task)
+{
+	MainThreadTask* node = new MainThreadTask();
+	node->task = std::move(task);
+	mainThreadTasks.Push(node);
+}
+
+int ThreadPool::RunMainThreadTasks()
+{
+	int numRun = 0;
+	MainThreadTask* node = mainThreadTasks.PopAll();
+	while (node != nullptr) {
+		MainThreadTask* next = node->next;
+		node->task();
+		delete node;
+		node = next;
+		++numRun;
+	}
+	numMainThreadTasks += numRun;
+	return numRun;
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	if (currentPool == this && currentWorker >= 0) {
+		Worker& worker = *workers[currentWorker];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(std::move(task));
+	}
+	else {
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		sharedTasks.push_back(std::move(task));
+	}
+	numQueued.fetch_add(1);
+	// Sleepers test numQueued under sleepMutex: taking it here means none misses the wake-up.
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	sleepCond.notify_one();
+}
+
+bool ThreadPool::PopTask(const int self, std::function<void()>& task, bool& stolen)
+{
+	stolen = false;
+	if (self >= 0) {
+		Worker& worker = *workers[self];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.tasks.empty()) {
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			numQueued.fetch_sub(1);
+			return true;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		if (!sharedTasks.empty()) {
+			task = std::move(sharedTasks.front());
+			sharedTasks.pop_front();
+			numQueued.fetch_sub(1);
+			return true;
+		}
+	}
+	const int numWorkers = (int)workers.size();
+	for (int i = 1; i <= numWorkers; ++i) {
+		const int victim = (std::max(self, 0) + i) % numWorkers;
+		if (victim == self)
+			continue;
+		Worker& worker = *workers[victim];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.tasks.empty()) {
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			numQueued.fetch_sub(1);
+			stolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(const int index)
+{
+	currentPool = this;
+	currentWorker = index;
+	Worker& worker = *workers[index];
+	while (true) {
+		std::function<void()> task;
+		bool stolen = false;
+		if (PopTask(index, task, stolen)) {
+			auto startTime = std::chrono::steady_clock::now();
+			task();
+			auto endTime = std::chrono::steady_clock::now();
+			worker.busyNs.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count(),
+									std::memory_order_relaxed);
+			worker.numTasks.fetch_add(1, std::memory_order_relaxed);
+			if (stolen)
+				worker.numStolen.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepCond.wait(lock, [this]() { return stopping || numQueued.load() > 0; });
+		if (stopping && numQueued.load() == 0)
+			return;
+	}
+}
+
+void ThreadPool::PrintStats() const
+{
+	const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - statsStart).count();
+	std::cout << "Thread pool: " << GetNumThreads() << " threads (" << workers.size() << " workers + caller), "
+			  << std::fixed << std::setprecision(1) << elapsedMs << " ms" << std::endl;
+	for (size_t i = 0; i < workers.size(); ++i) {
+		const Worker& worker = *workers[i];
+		const double busyMs = (double)worker.busyNs.load() / 1e6;
+		std::cout << "  Worker " << i << ": " << worker.numTasks.load() << " tasks (" << worker.numStolen.load()
+				  << " stolen), busy " << busyMs << " ms (" << (elapsedMs > 0.0 ? 100.0 * busyMs / elapsedMs : 0.0)
+				  << "%)" << std::endl;
+	}
+	std::cout << "  Main-thread tasks: " << numMainThreadTasks << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+void ThreadPool::ResetStats()
+{
+	for (auto&& worker : workers) {
+		worker->numTasks = 0;
+		worker->numStolen = 0;
+		worker->busyNs = 0;
+	}
+	numMainThreadTasks = 0;
+	statsStart = std::chrono::steady_clock::now();
+}
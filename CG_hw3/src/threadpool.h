@@ -0,0 +1,196 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+class ThreadPool;
+
+// AtomicQueue Declarations.
+// Lock-free list of nodes with a next pointer, many producers and one consumer: producers push
+// with a compare-and-swap and the consumer takes the whole list in one exchange, so a node is
+// never popped while another thread still reads it.
+template <typename Node>
+class AtomicQueue
+{
+public:
+	// AtomicQueue Public Methods.
+	AtomicQueue() : head(nullptr) {}
+
+	void Push(Node* node) {
+		node->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+			;
+	}
+	// Every node pushed so far, oldest first.
+	Node* PopAll() {
+		// Pushed newest first: reverse into arrival order.
+		Node* node = head.exchange(nullptr, std::memory_order_acquire);
+		Node* ordered = nullptr;
+		while (node != nullptr) {
+			Node* next = node->next;
+			node->next = ordered;
+			ordered = node;
+			node = next;
+		}
+		return ordered;
+	}
+
+private:
+	// AtomicQueue Private Data.
+	std::atomic<Node*> head;
+};
+
+// PendingTask Declarations.
+// A task started with ThreadPool::Spawn. Wait runs it on the calling thread if no worker has
+// picked it up yet, so a task may wait on the tasks it spawned even when every worker is busy.
+// A task with dependencies is queued once the last of them finishes.
+class PendingTask
+{
+public:
+	// PendingTask Public Methods.
+	PendingTask(ThreadPool* pool, std::function<void()> task)
+		: pool(pool), task(std::move(task)), numDependencies(0), started(false), done(false) {}
+
+	// Run the task if nobody has yet (any thread; its dependencies must be done).
+	void Run();
+	// Return once the task has finished.
+	void Wait();
+	bool IsDone() const { return done; }
+
+private:
+	friend class ThreadPool;
+
+	// PendingTask Private Data.
+	ThreadPool* pool;
+	std::function<void()> task;
+	// Unfinished dependencies (and, while they are being added, one for Spawn itself).
+	std::atomic<int> numDependencies;
+	std::vector<std::shared_ptr<PendingTask>> dependencies;
+	// Tasks waiting for this one (guarded by doneMutex).
+	std::vector<std::shared_ptr<PendingTask>> dependents;
+	std::atomic<bool> started;
+	std::atomic<bool> done;
+	std::mutex doneMutex;
+	std::condition_variable doneCond;
+};
+
+// ThreadPool Declarations.
+// A fixed set of worker threads shared by the CPU-side passes (loading, texture decoding,
+// culling, ...). Work stealing: each worker owns a deque, pushes and pops the tasks it spawns
+// at the back (the most recent, still in cache) and, when it runs dry, takes the oldest task
+// of the shared queue (tasks from other threads) or steals from the front of another worker's.
+class ThreadPool
+{
+public:
+	// ThreadPool Public Methods.
+	ThreadPool(const unsigned int numThreads = 0);
+	~ThreadPool();
+
+	// The process-wide pool.
+	static ThreadPool& Instance();
+
+	// Run body(chunkBegin, chunkEnd) over [begin, end) on the workers and the calling thread.
+	// Returns when every chunk is done.
+	void ParallelFor(const int begin, const int end, const std::function<void(int, int)>& body,
+					const int grainSize = 1);
+	// Reduce body(chunkBegin, chunkEnd) over the chunks of [begin, end); the partial results
+	// are combined in chunk order, so the result does not depend on the scheduling.
+	template <typename T, typename Body, typename Combine>
+	T ParallelReduce(const int begin, const int end, const T& identity, const Body& body,
+					const Combine& combine, const int grainSize = 1);
+
+	// Run a task on a worker without waiting for it (inline if there are no workers).
+	void Async(std::function<void()> task);
+	// Run a task on a worker and return a handle to join it later (see PendingTask).
+	std::shared_ptr<PendingTask> Spawn(std::function<void()> task);
+	// Same, once every dependency has finished.
+	std::shared_ptr<PendingTask> Spawn(std::function<void()> task,
+									const std::vector<std::shared_ptr<PendingTask>>& dependencies);
+
+	// GL affinity: queue a task for the main (GL) thread, from any thread.
+	void RunOnMainThread(std::function<void()> task);
+	// Run the queued main-thread tasks; call once per frame on the main thread. Returns the
+	// number run.
+	int RunMainThreadTasks();
+
+	int GetNumThreads() const { return (int)threads.size() + 1; }
+	// Tasks run, stolen and time busy per worker since the last ResetStats.
+	void PrintStats() const;
+	void ResetStats();
+
+private:
+	friend class PendingTask;
+
+	// Per-worker deque and utilization counters (a cache line each).
+	struct alignas(64) Worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+		std::atomic<uint64_t> numTasks{ 0 };
+		std::atomic<uint64_t> numStolen{ 0 };
+		std::atomic<uint64_t> busyNs{ 0 };
+	};
+	struct MainThreadTask
+	{
+		std::function<void()> task;
+		MainThreadTask* next;
+	};
+
+	// ThreadPool Private Methods.
+	// Chunk size used by ParallelFor for a range of count items.
+	int GetGrainSize(const int count, const int grainSize) const;
+	void Submit(std::function<void()> task);
+	// Own deque first, then the shared queue, then the other workers (self = -1 off the pool).
+	bool PopTask(const int self, std::function<void()>& task, bool& stolen);
+	void QueueReady(const std::shared_ptr<PendingTask>& task);
+	void WorkerLoop(const int index);
+
+	// ThreadPool Private Data.
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<Worker>> workers;
+	// Tasks submitted from outside the pool.
+	std::deque<std::function<void()>> sharedTasks;
+	std::mutex sharedMutex;
+	// Tasks in any queue; idle workers sleep until it is positive.
+	std::atomic<int> numQueued;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCond;
+	bool stopping;
+	AtomicQueue<MainThreadTask> mainThreadTasks;
+	uint64_t numMainThreadTasks;
+	std::chrono::steady_clock::time_point statsStart;
+};
+
+template <typename T, typename Body, typename Combine>
+T ThreadPool::ParallelReduce(const int begin, const int end, const T& identity, const Body& body,
+							const Combine& combine, const int grainSize)
+{
+	const int count = end - begin;
+	if (count <= 0)
+		return identity;
+	const int grain = GetGrainSize(count, grainSize);
+	const int numChunks = (count + grain - 1) / grain;
+	std::vector<T> partials(numChunks, identity);
+	ParallelFor(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+		for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+			const int first = begin + chunk * grain;
+			partials[chunk] = body(first, std::min(end, first + grain));
+		}
+	}, 1);
+	T result = identity;
+	for (auto&& partial : partials)
+		result = combine(result, partial);
+	return result;
+}
+
+#endif
@@ -1,4 +1,14 @@
 #include "trianglemesh.h"
+#include "threadpool.h"
+#include <emmintrin.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+
+bool TriangleMesh::recomputeNormals = false;
+float TriangleMesh::creaseAngleDeg = 180.0f;
+bool TriangleMesh::generateTangents = false;
 
 // Constructor of a triangle mesh.
 TriangleMesh::TriangleMesh()
@@ -8,9 +18,26 @@ TriangleMesh::TriangleMesh()
 	// -------------------------------------------------------
 	numVertices = 0;
 	numTriangles = 0;
+	numMeshlets = 0;
+	numVisibleMeshlets = 0;
+	numOccludedMeshlets = 0;
+	numInstances = 0;
+	cullMode = MESHLET_CULL_NONE;
+	boundingCenter = glm::vec3(0.0f, 0.0f, 0.0f);
+	boundingRadius = 0.0f;
 	objCenter = glm::vec3(0.0f, 0.0f, 0.0f);
 	objExtent = glm::vec3(0.0f, 0.0f, 0.0f);
 	vboId = 0;
+	tangentVboId = 0;
+	cullBoundsBufferId = 0;
+	indirectBufferId = 0;
+	cullStatsBufferId = 0;
+	occlusionFlagsBufferId = 0;
+	instanceBufferId = 0;
+	bufferBytes = 0;
+	batchVertexCapacity = 0;
+	batchIndexCapacity = 0;
+	texturesPacked = false;
 }
 
 // Destructor of a triangle mesh.
@@ -22,10 +49,83 @@ TriangleMesh::~TriangleMesh()
 	vertices.clear();
 	ReleaseBuffers();
 	subMeshes.clear();
+	for (auto&& textureArray : textureArrays)
+		delete textureArray;
+	textureArrays.clear();
+	// Materials release their textures; shared ones stay loaded for the other meshes.
+	for (auto&& material : materials)
+		delete material.second;
+	materials.clear();
+}
+
+bool TriangleMesh::ParseFaceCorner(const std::string& corner, const int numPositions, const int numTexcoords,
+								const int numNormals, int index[3])
+{
+	const int counts[3] = { numPositions, numTexcoords, numNormals };
+	index[0] = index[1] = index[2] = -1;
+	const char* p = corner.c_str();
+	for (int k = 0; k < 3; ++k) {
+		if (k > 0) {
+			if (*p != '/')
+				break;
+			++p;
+		}
+		if (*p == '/' || *p == '\0') {
+			if (k == 0)
+				return false;
+			continue;
+		}
+		char* end;
+		const long value = std::strtol(p, &end, 10);
+		const long i = value > 0 ? value - 1 : counts[k] + value;
+		if (end == p || value == 0 || i < 0 || i >= counts[k])
+			return false;
+		index[k] = (int)i;
+		p = end;
+	}
+	return true;
+}
+
+// Give positions with the same coordinates (bit for bit, -0 as 0) one id, so a file that
+// repeats a "v" line for every corner (a triangle soup) is smoothed across its edges too.
+// Sorts the positions by their bits and renumbers vertexPositions; returns the number of ids.
+static unsigned int WeldPositions(const std::vector<glm::vec3>& positions, std::vector<unsigned int>& vertexPositions)
+{
+	typedef std::array<uint32_t, 3> PositionKey;
+	const int numPositions = (int)positions.size();
+	std::vector<PositionKey> keys(numPositions);
+	ThreadPool& pool = ThreadPool::Instance();
+	pool.ParallelFor(0, numPositions, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			std::memcpy(keys[i].data(), &positions[i], sizeof(PositionKey));
+			for (auto&& bits : keys[i])
+				bits = bits == 0x80000000u ? 0u : bits;
+		}
+	}, 16384);
+	std::vector<unsigned int> order(numPositions);
+	for (int i = 0; i < numPositions; ++i)
+		order[i] = (unsigned int)i;
+	std::sort(order.begin(), order.end(), [&keys](const unsigned int a, const unsigned int b) {
+		return keys[a] < keys[b];
+	});
+	std::vector<unsigned int> ids(numPositions);
+	unsigned int numIds = 0;
+	for (int i = 0; i < numPositions; ++i) {
+		if (i == 0 || keys[order[i]] != keys[order[i - 1]])
+			++numIds;
+		ids[order[i]] = numIds - 1;
+	}
+	pool.ParallelFor(0, (int)vertexPositions.size(), [&](int begin, int end) {
+		for (int v = begin; v < end; ++v)
+			vertexPositions[v] = ids[vertexPositions[v]];
+	}, 16384);
+	return numIds;
 }
 
 // Load the geometry and material data from an OBJ file.
-bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normalized)
+bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normalized,
+								const std::atomic<bool>* cancelled, const MapKdCallback& onMapKd,
+								const BatchCallback& onBatch)
 {	
 	// Parse the OBJ file.
 	// ---------------------------------------------------------------------------
@@ -40,9 +140,62 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normaliz
 	std::vector<glm::vec3> positions;
 	std::vector<glm::vec3> normals;
 	std::vector<glm::vec2> texcoords;
+	// The material libraries are parsed (and their textures announced) on the thread pool
+	// while the geometry is read; submeshes keep the material name until they are joined.
+	struct MTLLibTask
+	{
+		std::map<std::string, PhongMaterial*> materials;
+		std::shared_ptr<PendingTask> task;
+	};
+	std::vector<std::shared_ptr<MTLLibTask>> mtlLibTasks;
+	std::vector<std::string> subMeshMaterials;
+	// Bounding box of the positions, grown as they are read (so normalizing takes no extra
+	// pass over the vertices).
+	glm::vec3 minPosBound = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 maxPosBound = glm::vec3(std::numeric_limits<float>::lowest());
+	// Position of each vertex (the "v" line; welded by value before GenerateNormals groups by
+	// it) and, once a face without normals is met, whether each vertex had one in the file.
+	std::vector<unsigned int> vertexPositions;
+	std::vector<unsigned char> fileNormals;
+	// Whether each corner of the face being read has a normal in the file.
+	std::vector<unsigned char> faceFileNormals;
+	bool missingNormals = false;
+	bool reportedBadFace = false;
+	// Progressive load: triangles and first vertex of the batch being filled, and the
+	// provisional normalization (set by the first batch).
+	std::vector<unsigned int> batchIndices;
+	size_t batchFirstVertex = 0;
+	bool batchTransformSet = false;
+	glm::vec3 batchCenter = glm::vec3(0.0f, 0.0f, 0.0f);
+	float batchScale = 1.0f;
+	auto flushBatch = [&]() {
+		if (batchIndices.empty())
+			return;
+		if (normalized && !batchTransformSet && !positions.empty()) {
+			const glm::vec3 size = maxPosBound - minPosBound;
+			const float maxLen = std::max(std::max(size.x, size.y), size.z);
+			batchCenter = 0.5f * (minPosBound + maxPosBound);
+			batchScale = maxLen > 0.0f ? 1.0f / maxLen : 1.0f;
+		}
+		batchTransformSet = true;
+		MeshBatch* batch = new MeshBatch();
+		batch->vertices.assign(vertices.begin() + batchFirstVertex, vertices.end());
+		NormalizePositions(batch->vertices.data(), batch->vertices.size(), batchCenter, batchScale);
+		batch->indices.swap(batchIndices);
+		batch->next = nullptr;
+		batchFirstVertex = vertices.size();
+		onBatch(batch);
+	};
 
 	std::string line;
+	int numLines = 0;
+	bool parseCancelled = false;
 	while (std::getline(objfileIn, line)) {
+		// A superseded load gives up within a few thousand lines.
+		if (cancelled != nullptr && (++numLines & 4095) == 0 && cancelled->load(std::memory_order_relaxed)) {
+			parseCancelled = true;
+			break;
+		}
 		std::istringstream iss(line);
 		std::string type;
 		iss >> type;
@@ -54,12 +207,18 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normaliz
 			if (lastSlashPos != std::string::npos) {
 				mtlfilePath.replace(lastSlashPos + 1, std::string::npos, mtlfileName);
 			}
-			LoadMTLLib(mtlfilePath);
+			std::shared_ptr<MTLLibTask> mtlLib = std::make_shared<MTLLibTask>();
+			mtlLib->task = ThreadPool::Instance().Spawn([mtlLib, mtlfilePath, onMapKd]() {
+				LoadMTLLib(mtlfilePath, mtlLib->materials, onMapKd);
+			});
+			mtlLibTasks.push_back(mtlLib);
 		}
 		else if (type == "v") {
 			float x, y, z;
 			iss >> x >> y >> z;
 			positions.emplace_back(x, y, z);
+			minPosBound = glm::min(minPosBound, positions.back());
+			maxPosBound = glm::max(maxPosBound, positions.back());
 		}
 		else if (type == "vn") {
 			float x, y, z;
@@ -74,19 +233,54 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normaliz
 		else if (type == "f") {
 			int cntVertices = 0;
 			std::string facedata;
+			bool faceValid = true;
+			bool faceMissingNormals = false;
+			faceFileNormals.clear();
 			while (iss >> facedata) {
-				std::istringstream vertiss(facedata);
-				std::string posIndexStr, texcoordIndexStr, normalIndexStr;		// f P/T/N
-				std::getline(vertiss, posIndexStr, '/');
-				std::getline(vertiss, texcoordIndexStr, '/');
-				std::getline(vertiss, normalIndexStr, '/');
-				// ƬO base 1
-				int posIndex = std::stoi(posIndexStr) - 1;
-				int texcoordIndex = std::stoi(texcoordIndexStr) - 1;
-				int normalIndex = std::stoi(normalIndexStr) - 1;
-				vertices.emplace_back(positions[posIndex], normals[normalIndex], texcoords[texcoordIndex]);
+				int index[3];
+				if (!ParseFaceCorner(facedata, (int)positions.size(), (int)texcoords.size(), (int)normals.size(), index)) {
+					faceValid = false;
+					break;
+				}
+				vertices.emplace_back(positions[index[0]],
+					index[2] >= 0 ? normals[index[2]] : glm::vec3(0.0f, 0.0f, 0.0f),
+					index[1] >= 0 ? texcoords[index[1]] : glm::vec2(0.0f, 0.0f));
+				vertexPositions.push_back((unsigned int)index[0]);
+				faceFileNormals.push_back(index[2] >= 0 ? 1 : 0);
+				faceMissingNormals |= index[2] < 0;
 				cntVertices++;
 			}
+			if (!faceValid || cntVertices < 3) {
+				if (!faceValid && !reportedBadFace) {
+					std::cerr << "Error: skipping invalid faces in OBJ file: " << filePath << " (" << line << ")" << std::endl;
+					reportedBadFace = true;
+				}
+				vertices.resize(numVertices);
+				vertexPositions.resize(numVertices);
+				continue;
+			}
+			if (faceMissingNormals && !missingNormals) {
+				missingNormals = true;
+				fileNormals.assign(numVertices, 1);
+			}
+			if (missingNormals)
+				fileNormals.insert(fileNormals.end(), faceFileNormals.begin(), faceFileNormals.end());
+			// Corners without a normal take the face's until GenerateNormals smooths them (so
+			// a progressive preview shows the face flat).
+			if (faceMissingNormals) {
+				const glm::vec3 faceNormal = glm::cross(vertices[numVertices + 1].position - vertices[numVertices].position,
+														vertices[numVertices + 2].position - vertices[numVertices].position);
+				const float length = glm::length(faceNormal);
+				for (int i = 0; i < cntVertices; i++) {
+					if (!faceFileNormals[i])
+						vertices[numVertices + i].normal = length > 0.0f ? faceNormal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+				}
+			}
+			// Faces before any usemtl.
+			if (subMeshes.empty()) {
+				subMeshes.emplace_back();
+				subMeshMaterials.push_back("");
+			}
 
 			// hΤ
 			// HW1_slides V1~V7 : CIӤT i.e., n I| n - 2 ӤT
@@ -100,28 +294,81 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normaliz
 				subMeshes.back().vertexIndices.push_back(numVertices + i - 1);
 				subMeshes.back().vertexIndices.push_back(numVertices + i);
 			}
+			if (onBatch) {
+				for (int i = 2; i < cntVertices; i++) {
+					batchIndices.push_back(numVertices);
+					batchIndices.push_back(numVertices + i - 1);
+					batchIndices.push_back(numVertices + i);
+				}
+			}
 			// sIƶqMTμƶq(I - 2)
 			numVertices += cntVertices;
 			numTriangles += cntVertices - 2;
+			if (onBatch && batchIndices.size() >= 3 * (size_t)numBatchTriangles)
+				flushBatch();
 		}
 		else if (type == "usemtl") {
 			std::string mtlName;
 			iss >> mtlName;
 			// TOC materialu|@ submesh
-			auto it = std::find_if(subMeshes.begin(), subMeshes.end(), [&mtlName](const SubMesh& subMesh) {
-				return subMesh.material && subMesh.material->GetName() == mtlName;
-				});
-			if (it == subMeshes.end()) {
+			auto it = std::find(subMeshMaterials.begin(), subMeshMaterials.end(), mtlName);
+			if (it == subMeshMaterials.end()) {
 				subMeshes.emplace_back();
-				subMeshes.back().material = materials[mtlName];
+				subMeshMaterials.push_back(mtlName);
 			}
 			else {
-				std::iter_swap(it, std::prev(subMeshes.end()));
+				std::iter_swap(subMeshes.begin() + (it - subMeshMaterials.begin()), std::prev(subMeshes.end()));
+				std::iter_swap(it, std::prev(subMeshMaterials.end()));
 			}
 		}
 	}
 
 	objfileIn.close();
+	if (onBatch && !parseCancelled)
+		flushBatch();
+
+	// Join the material libraries (a later definition of a name replaces an earlier one) and
+	// bind the submeshes to them.
+	for (auto&& mtlLib : mtlLibTasks) {
+		mtlLib->task->Wait();
+		for (auto&& material : mtlLib->materials) {
+			PhongMaterial*& entry = materials[material.first];
+			delete entry;
+			entry = material.second;
+		}
+		mtlLib->materials.clear();
+	}
+	for (size_t i = 0; i < subMeshes.size(); ++i) {
+		PhongMaterial*& material = materials[subMeshMaterials[i]];
+		// No usemtl, or one naming no material of the libraries: plain gray.
+		if (material == nullptr) {
+			material = new PhongMaterial();
+			material->SetName(subMeshMaterials[i]);
+			material->SetKa(glm::vec3(0.1f, 0.1f, 0.1f));
+			material->SetKd(glm::vec3(0.6f, 0.6f, 0.6f));
+			material->SetKs(glm::vec3(0.2f, 0.2f, 0.2f));
+			material->SetNs(16.0f);
+		}
+		subMeshes[i].material = material;
+	}
+	if (parseCancelled || (cancelled != nullptr && cancelled->load()))
+		return false;
+
+	unsigned int numWeldedPositions = (unsigned int)positions.size();
+
+	// Both group the corners by position, so "v" lines repeated per corner are merged first.
+	const bool needTangents = generateTangents && !texcoords.empty();
+	if (missingNormals || recomputeNormals || needTangents)
+		numWeldedPositions = WeldPositions(positions, vertexPositions);
+	// Smooth normals for the corners the file gives none (for all, with recomputeNormals).
+	if (missingNormals || recomputeNormals) {
+		if (recomputeNormals)
+			fileNormals.clear();
+		GenerateNormals(vertices, vertexPositions, numWeldedPositions, subMeshes, creaseAngleDeg, fileNormals);
+	}
+	// Tangent frames for normal maps, once the normals are final: textured models, on request.
+	if (needTangents)
+		GenerateTangents(vertices, vertexPositions, numWeldedPositions, subMeshes, tangents);
 
 	// Normalize the geometry data.
 	if (normalized) {
@@ -130,28 +377,248 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath, const bool normaliz
 		// -----------------------------------------------------------------------
 		
 		// ϥ openGL lƮyз
-		glm::vec3 minPosBound = glm::vec3(std::numeric_limits<float>::max()); // La
-		glm::vec3 maxPosBound = glm::vec3(std::numeric_limits<float>::lowest()); // TOOtLa
-		// Bounding Box
-		for (auto&& vertex : vertices) {
-			minPosBound = glm::min(minPosBound, vertex.position);
-			maxPosBound = glm::max(maxPosBound, vertex.position);
-		}
+		// Bounding Box: grown by the parser over every "v" line (a position no face uses still
+		// counts).
 		// Center
 		objCenter = minPosBound + (maxPosBound - minPosBound) * 0.5f;
 		// maximal extent axis
 		float maxLen = std::max(std::max(maxPosBound.x - minPosBound.x, maxPosBound.y - minPosBound.y), maxPosBound.z - minPosBound.z);
 		// maximal extent axis equal to 1
-		for (auto&& vertex : vertices) {
-			vertex.position = (vertex.position - objCenter) / maxLen;
-		}
+		NormalizePositions(vertices.data(), vertices.size(), objCenter, 1.0f / maxLen);
 		// Extent
 		objExtent = (maxPosBound - minPosBound) / maxLen;
 	}
 	return true;
 }
 
-bool TriangleMesh::LoadMTLLib(const std::string& filePath)
+void TriangleMesh::NormalizePositions(VertexPTN* vertices, const size_t count, const glm::vec3& center,
+									const float scale)
+{
+	// One unaligned 16-byte load per vertex takes the position and normal.x; the fourth lane
+	// passes through unchanged ((x - 0) * 1).
+	static_assert(offsetof(VertexPTN, position) == 0 && offsetof(VertexPTN, normal) == 12,
+				"NormalizePositions reads the position and normal.x as four floats");
+	const __m128 offset = _mm_setr_ps(center.x, center.y, center.z, 0.0f);
+	const __m128 factor = _mm_setr_ps(scale, scale, scale, 1.0f);
+	ThreadPool::Instance().ParallelFor(0, (int)count, [=](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			float* p = &vertices[i].position.x;
+			_mm_storeu_ps(p, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p), offset), factor));
+		}
+	}, 16384);
+}
+
+// Weld by position: the triangles of all submeshes in a row (corner c is vertex corners[c], of
+// triangle c / 3), and the corners at each position, positionCorners[firstCorners[i]] up to
+// positionCorners[firstCorners[i + 1]] (in no particular order). Grouped by an atomic scatter:
+// counted, prefix-summed, then each corner takes a slot.
+static void GroupCornersByPosition(const std::vector<SubMesh>& subMeshes, const std::vector<unsigned int>& vertexPositions,
+								const unsigned int numPositions, std::vector<unsigned int>& corners,
+								std::vector<unsigned int>& firstCorners, std::vector<unsigned int>& positionCorners)
+{
+	corners.clear();
+	for (auto&& subMesh : subMeshes)
+		corners.insert(corners.end(), subMesh.vertexIndices.begin(), subMesh.vertexIndices.end());
+	const int numCorners = (int)corners.size();
+	ThreadPool& pool = ThreadPool::Instance();
+	std::vector<std::atomic<unsigned int>> cursors(numPositions);
+	pool.ParallelFor(0, numCorners, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c)
+			cursors[vertexPositions[corners[c]]].fetch_add(1, std::memory_order_relaxed);
+	}, 16384);
+	firstCorners.assign(numPositions + 1, 0);
+	for (unsigned int i = 0; i < numPositions; ++i) {
+		firstCorners[i + 1] = firstCorners[i] + cursors[i].load(std::memory_order_relaxed);
+		cursors[i].store(firstCorners[i], std::memory_order_relaxed);
+	}
+	positionCorners.resize(numCorners);
+	pool.ParallelFor(0, numCorners, [&](int begin, int end) {
+		for (int c = begin; c < end; ++c)
+			positionCorners[cursors[vertexPositions[corners[c]]].fetch_add(1, std::memory_order_relaxed)] = (unsigned int)c;
+	}, 16384);
+}
+
+void TriangleMesh::GenerateNormals(std::vector<VertexPTN>& vertices, const std::vector<unsigned int>& vertexPositions,
+									const unsigned int numPositions, const std::vector<SubMesh>& subMeshes,
+									const float creaseAngleDeg, const std::vector<unsigned char>& fileNormals)
+{
+	std::vector<unsigned int> corners, firstCorners, positionCorners;
+	GroupCornersByPosition(subMeshes, vertexPositions, numPositions, corners, firstCorners, positionCorners);
+	const int numCorners = (int)corners.size();
+	const int numFaces = numCorners / 3;
+	ThreadPool& pool = ThreadPool::Instance();
+
+	// Unit face normals, and corner weights: the face area times the angle at the corner.
+	std::vector<glm::vec3> faceNormals(numFaces);
+	std::vector<float> cornerWeights(numCorners);
+	pool.ParallelFor(0, numFaces, [&](int begin, int end) {
+		for (int f = begin; f < end; ++f) {
+			const glm::vec3 p[3] = { vertices[corners[3 * f]].position, vertices[corners[3 * f + 1]].position,
+									vertices[corners[3 * f + 2]].position };
+			const glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+			const float length = glm::length(normal);
+			faceNormals[f] = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 0.0f);
+			for (int k = 0; k < 3; ++k) {
+				const glm::vec3 e1 = p[(k + 1) % 3] - p[k];
+				const glm::vec3 e2 = p[(k + 2) % 3] - p[k];
+				const float lengths = glm::length(e1) * glm::length(e2);
+				const float angle = lengths > 0.0f ? std::acos(glm::clamp(glm::dot(e1, e2) / lengths, -1.0f, 1.0f)) : 0.0f;
+				cornerWeights[3 * f + k] = 0.5f * length * angle;
+			}
+		}
+	}, 4096);
+
+	// A vertex sums the weighted normals of the faces around its position that lie within the
+	// crease angle of its own face. Each position is one task, which alone writes its vertices.
+	// Without a crease angle every vertex at a position takes the same sum, computed once.
+	const bool creased = creaseAngleDeg < 180.0f;
+	const float minCosine = creased ? std::cos(glm::radians(creaseAngleDeg)) : -2.0f;
+	pool.ParallelFor(0, (int)numPositions, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			unsigned int* first = positionCorners.data() + firstCorners[i];
+			unsigned int* last = positionCorners.data() + firstCorners[i + 1];
+			// In corner order, so the sums do not depend on the scheduling of the scatter.
+			std::sort(first, last);
+			if (!creased) {
+				glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);
+				for (const unsigned int* c = first; c != last; ++c)
+					normal += faceNormals[*c / 3] * cornerWeights[*c];
+				const float length = glm::length(normal);
+				for (const unsigned int* c = first; c != last; ++c) {
+					const unsigned int v = corners[*c];
+					if (!fileNormals.empty() && fileNormals[v])
+						continue;
+					if (length > 0.0f)
+						vertices[v].normal = normal / length;
+					else if (faceNormals[*c / 3] != glm::vec3(0.0f, 0.0f, 0.0f))
+						vertices[v].normal = faceNormals[*c / 3];
+				}
+				continue;
+			}
+			for (const unsigned int* c = first; c != last; ++c) {
+				const unsigned int v = corners[*c];
+				if (!fileNormals.empty() && fileNormals[v])
+					continue;
+				const glm::vec3& faceNormal = faceNormals[*c / 3];
+				glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);
+				for (const unsigned int* other = first; other != last; ++other) {
+					const glm::vec3& otherNormal = faceNormals[*other / 3];
+					if (glm::dot(faceNormal, otherNormal) >= minCosine)
+						normal += otherNormal * cornerWeights[*other];
+				}
+				const float length = glm::length(normal);
+				if (length > 0.0f)
+					vertices[v].normal = normal / length;
+				else if (faceNormal != glm::vec3(0.0f, 0.0f, 0.0f))
+					vertices[v].normal = faceNormal;
+			}
+		}
+	}, 1024);
+}
+
+void TriangleMesh::GenerateTangents(const std::vector<VertexPTN>& vertices, const std::vector<unsigned int>& vertexPositions,
+									const unsigned int numPositions, const std::vector<SubMesh>& subMeshes,
+									std::vector<glm::vec4>& tangents)
+{
+	std::vector<unsigned int> corners, firstCorners, positionCorners;
+	GroupCornersByPosition(subMeshes, vertexPositions, numPositions, corners, firstCorners, positionCorners);
+	const int numCorners = (int)corners.size();
+	const int numFaces = numCorners / 3;
+	ThreadPool& pool = ThreadPool::Instance();
+
+	// Per face, as MikkTSpace: the direction of increasing u (xyz), flipped with the UVs, and
+	// whether the UVs keep (w = 1) or mirror (w = -1) the winding, 0 if they have no area.
+	// Per corner, the angle between its edges in the plane of its vertex normal.
+	std::vector<glm::vec4> faceTangents(numFaces);
+	std::vector<float> cornerAngles(numCorners);
+	pool.ParallelFor(0, numFaces, [&](int begin, int end) {
+		for (int f = begin; f < end; ++f) {
+			const VertexPTN* v[3] = { &vertices[corners[3 * f]], &vertices[corners[3 * f + 1]], &vertices[corners[3 * f + 2]] };
+			const glm::vec3 d1 = v[1]->position - v[0]->position;
+			const glm::vec3 d2 = v[2]->position - v[0]->position;
+			const glm::vec2 t1 = v[1]->texcoord - v[0]->texcoord;
+			const glm::vec2 t2 = v[2]->texcoord - v[0]->texcoord;
+			const float signedAreaUV = t1.x * t2.y - t1.y * t2.x;
+			const float orientation = signedAreaUV > 0.0f ? 1.0f : (signedAreaUV < 0.0f ? -1.0f : 0.0f);
+			faceTangents[f] = glm::vec4((t2.y * d1 - t1.y * d2) * orientation, orientation);
+			for (int k = 0; k < 3; ++k) {
+				const glm::vec3& n = v[k]->normal;
+				glm::vec3 e1 = v[(k + 1) % 3]->position - v[k]->position;
+				glm::vec3 e2 = v[(k + 2) % 3]->position - v[k]->position;
+				e1 -= n * glm::dot(n, e1);
+				e2 -= n * glm::dot(n, e2);
+				const float lengths = glm::length(e1) * glm::length(e2);
+				cornerAngles[3 * f + k] = lengths > 0.0f ? std::acos(glm::clamp(glm::dot(e1, e2) / lengths, -1.0f, 1.0f)) : 0.0f;
+			}
+		}
+	}, 4096);
+
+	// A vertex sums, weighted by corner angle, the face tangents (projected on its normal) of
+	// the corners at its position that share its normal and UV (as MikkTSpace welds) and the
+	// orientation of its own face: a mirrored UV island gets its own tangent and w = -1.
+	tangents.assign(vertices.size(), glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+	// The corners at a position are sorted by normal and UV (then corner order, so the sums do
+	// not depend on the scheduling of the scatter): each run of equal ones is summed once.
+	auto weldKey = [&vertices, &corners](const unsigned int c) {
+		const VertexPTN& vertex = vertices[corners[c]];
+		std::array<uint32_t, 6> key;
+		std::memcpy(key.data(), &vertex.normal, 3 * sizeof(uint32_t));
+		std::memcpy(key.data() + 3, &vertex.texcoord, 2 * sizeof(uint32_t));
+		for (int k = 0; k < 5; ++k)
+			key[k] = key[k] == 0x80000000u ? 0u : key[k];
+		key[5] = c;
+		return key;
+	};
+	pool.ParallelFor(0, (int)numPositions, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			unsigned int* first = positionCorners.data() + firstCorners[i];
+			unsigned int* last = positionCorners.data() + firstCorners[i + 1];
+			std::sort(first, last, [&weldKey](const unsigned int a, const unsigned int b) {
+				return weldKey(a) < weldKey(b);
+			});
+			for (unsigned int* runFirst = first; runFirst != last;) {
+				const VertexPTN& vertex = vertices[corners[*runFirst]];
+				const glm::vec3& n = vertex.normal;
+				unsigned int* runLast = runFirst + 1;
+				while (runLast != last && vertices[corners[*runLast]].normal == n &&
+					   vertices[corners[*runLast]].texcoord == vertex.texcoord)
+					++runLast;
+				// Sums of the two orientations; a face without UV area takes the orientation
+				// of the first corner of the run with one.
+				glm::vec3 sums[2] = { glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f) };
+				float firstOrientation = 0.0f;
+				for (const unsigned int* c = runFirst; c != runLast; ++c) {
+					const glm::vec4& faceTangent = faceTangents[*c / 3];
+					if (faceTangent.w == 0.0f)
+						continue;
+					if (firstOrientation == 0.0f)
+						firstOrientation = faceTangent.w;
+					const glm::vec3 projected = glm::vec3(faceTangent) - n * glm::dot(n, glm::vec3(faceTangent));
+					const float length = glm::length(projected);
+					if (length > 0.0f)
+						sums[faceTangent.w < 0.0f] += projected * (cornerAngles[*c] / length);
+				}
+				for (const unsigned int* c = runFirst; c != runLast; ++c) {
+					const float orientation = faceTangents[*c / 3].w != 0.0f ? faceTangents[*c / 3].w : firstOrientation;
+					glm::vec3 tangent = orientation != 0.0f ? sums[orientation < 0.0f] : glm::vec3(0.0f, 0.0f, 0.0f);
+					float length = glm::length(tangent);
+					if (length == 0.0f) {
+						// No UV gradient around: any direction in the tangent plane.
+						tangent = std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+						tangent -= n * glm::dot(n, tangent);
+						length = glm::length(tangent);
+					}
+					tangents[corners[*c]] = glm::vec4(length > 0.0f ? tangent / length : glm::vec3(1.0f, 0.0f, 0.0f),
+													orientation < 0.0f ? -1.0f : 1.0f);
+				}
+				runFirst = runLast;
+			}
+		}
+	}, 1024);
+}
+
+bool TriangleMesh::LoadMTLLib(const std::string& filePath, std::map<std::string, PhongMaterial*>& materials,
+							const MapKdCallback& onMapKd)
 {
 	std::ifstream mtlfileIn(filePath);
 	if (!mtlfileIn) {
@@ -193,8 +660,11 @@ bool TriangleMesh::LoadMTLLib(const std::string& filePath)
 		else if (type == "map_Kd") {
 			std::string texFileName;
 			iss >> texFileName;
+			// TextureManager is not thread-safe: AcquireTextures loads it on the GL thread.
 			std::filesystem::path mapKdPath(filePath);
-			materials[currMtlName]->SetMapKd(new ImageTexture((mapKdPath.parent_path() / texFileName).string()));
+			materials[currMtlName]->SetMapKdPath((mapKdPath.parent_path() / texFileName).string());
+			if (onMapKd)
+				onMapKd(materials[currMtlName]->GetMapKdPath());
 		}
 	}
 
@@ -203,6 +673,266 @@ bool TriangleMesh::LoadMTLLib(const std::string& filePath)
 	return true;
 }
 
+void TriangleMesh::AcquireTextures()
+{
+	for (auto&& material : materials) {
+		PhongMaterial* phongMaterial = material.second;
+		if (phongMaterial == nullptr || phongMaterial->GetMapKd() != nullptr || phongMaterial->GetMapKdPath().empty())
+			continue;
+		phongMaterial->SetMapKd(TextureManager::Instance().Acquire(
+			phongMaterial->GetMapKdPath(), true, ImageTexture::GetMaterialCompression()));
+	}
+}
+
+// Desc: Greedily group consecutive triangles of each submesh into meshlets of at
+// most Meshlet::maxVertices vertices and Meshlet::maxTriangles triangles, so every
+// meshlet is a contiguous index range, and compute the bounding sphere and normal
+// cone used by CullMeshlets().
+void TriangleMesh::BuildMeshlets()
+{
+	numMeshlets = 0;
+	// Last meshlet that referenced each vertex (to count unique vertices per meshlet).
+	std::vector<int> vertexStamp(vertices.size(), -1);
+
+	for (auto&& subMesh : subMeshes) {
+		subMesh.meshlets.clear();
+		subMesh.firstCommand = (unsigned int)numMeshlets;
+		const std::vector<unsigned int>& indices = subMesh.vertexIndices;
+		const unsigned int numIndices = (unsigned int)indices.size();
+
+		Meshlet meshlet;
+		for (unsigned int i = 0; i + 2 < numIndices; i += 3) {
+			int stamp = (int)subMesh.meshlets.size() + numMeshlets;
+			unsigned int newVertices = 0;
+			for (int k = 0; k < 3; ++k)
+				newVertices += (vertexStamp[indices[i + k]] != stamp) ? 1 : 0;
+			// Flush when the triangle does not fit.
+			if (meshlet.vertexCount + newVertices > Meshlet::maxVertices
+				|| meshlet.indexCount / 3 + 1 > Meshlet::maxTriangles) {
+				subMesh.meshlets.push_back(meshlet);
+				meshlet = Meshlet();
+				meshlet.indexOffset = i;
+				stamp++;
+			}
+			for (int k = 0; k < 3; ++k) {
+				if (vertexStamp[indices[i + k]] != stamp) {
+					vertexStamp[indices[i + k]] = stamp;
+					meshlet.vertexCount++;
+				}
+			}
+			meshlet.indexCount += 3;
+		}
+		if (meshlet.indexCount > 0)
+			subMesh.meshlets.push_back(meshlet);
+
+		// Bounds and normal cones are independent per meshlet.
+		ThreadPool::Instance().ParallelFor(0, (int)subMesh.meshlets.size(), [&](int begin, int end) {
+			for (int m = begin; m < end; ++m) {
+				Meshlet& ml = subMesh.meshlets[m];
+				const unsigned int first = ml.indexOffset;
+				const unsigned int last = ml.indexOffset + ml.indexCount;
+				// Bounding sphere around the AABB center.
+				glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+				glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+				for (unsigned int i = first; i < last; ++i) {
+					minPos = glm::min(minPos, vertices[indices[i]].position);
+					maxPos = glm::max(maxPos, vertices[indices[i]].position);
+				}
+				ml.center = 0.5f * (minPos + maxPos);
+				ml.radius = 0.0f;
+				for (unsigned int i = first; i < last; ++i)
+					ml.radius = std::max(ml.radius, glm::distance(ml.center, vertices[indices[i]].position));
+				// Normal cone from the geometric triangle normals.
+				std::vector<glm::vec3> triNormals;
+				glm::vec3 axis = glm::vec3(0.0f, 0.0f, 0.0f);
+				for (unsigned int i = first; i < last; i += 3) {
+					const glm::vec3& p0 = vertices[indices[i]].position;
+					const glm::vec3& p1 = vertices[indices[i + 1]].position;
+					const glm::vec3& p2 = vertices[indices[i + 2]].position;
+					glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+					float len = glm::length(n);
+					if (len > 0.0f) {
+						triNormals.push_back(n / len);
+						axis += n / len;
+					}
+				}
+				float axisLen = glm::length(axis);
+				ml.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+				ml.coneCutoff = 1.0f;
+				if (axisLen > 0.0f && !triNormals.empty()) {
+					ml.coneAxis = axis / axisLen;
+					float minDot = 1.0f;
+					for (auto&& n : triNormals)
+						minDot = std::min(minDot, glm::dot(ml.coneAxis, n));
+					// Cones wider than ~85 degrees almost never cull; keep them disabled.
+					if (minDot > 0.1f)
+						ml.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+				}
+			}
+		});
+		numMeshlets += (int)subMesh.meshlets.size();
+
+		// Start with everything visible.
+		subMesh.drawCounts.assign(1, (GLsizei)numIndices);
+		subMesh.drawOffsets.assign(1, (const GLvoid*)0);
+	}
+	numVisibleMeshlets = numMeshlets;
+
+	// Bounding sphere of the whole mesh, enclosing every meshlet sphere.
+	glm::vec3 minPos = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 maxPos = glm::vec3(std::numeric_limits<float>::lowest());
+	for (auto&& subMesh : subMeshes) {
+		for (auto&& ml : subMesh.meshlets) {
+			minPos = glm::min(minPos, ml.center - glm::vec3(ml.radius));
+			maxPos = glm::max(maxPos, ml.center + glm::vec3(ml.radius));
+		}
+	}
+	boundingCenter = 0.5f * (minPos + maxPos);
+	boundingRadius = 0.0f;
+	for (auto&& subMesh : subMeshes) {
+		for (auto&& ml : subMesh.meshlets)
+			boundingRadius = std::max(boundingRadius, glm::distance(boundingCenter, ml.center) + ml.radius);
+	}
+}
+
+// Desc: Keep the maxTriangles largest triangles as occluders. Large triangles
+// cover the most occlusion-buffer pixels for the rasterization cost.
+void TriangleMesh::BuildOccluders(const int maxTriangles)
+{
+	// (area, first vertex index of the triangle) for every triangle.
+	struct TriangleArea { float area; const unsigned int* indices; };
+	std::vector<TriangleArea> areas;
+	areas.reserve(numTriangles);
+	for (auto&& subMesh : subMeshes) {
+		const std::vector<unsigned int>& indices = subMesh.vertexIndices;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			const glm::vec3& p0 = vertices[indices[i]].position;
+			glm::vec3 n = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+			areas.push_back({ glm::length(n), &indices[i] });
+		}
+	}
+	const size_t count = std::min(areas.size(), (size_t)std::max(0, maxTriangles));
+	std::nth_element(areas.begin(), areas.begin() + count, areas.end(),
+		[](const TriangleArea& a, const TriangleArea& b) { return a.area > b.area; });
+
+	occluderTriangles.clear();
+	occluderTriangles.reserve(count * 3);
+	for (size_t i = 0; i < count; ++i) {
+		for (int k = 0; k < 3; ++k)
+			occluderTriangles.push_back(vertices[areas[i].indices[k]].position);
+	}
+}
+
+// Desc: Frustum and normal-cone test for every meshlet, then rebuild each
+// submesh's multi-draw list with adjacent visible meshlets merged.
+void TriangleMesh::CullMeshlets(const glm::mat4x4& worldMatrix, const glm::mat4x4& viewProjMatrix, const glm::vec3& cameraPos,
+								const SoftwareOcclusionBuffer* occlusionBuffer)
+{
+	// Test in object space: planes from the MVP, camera moved by the inverse world matrix.
+	// The cone test assumes the world matrix has no non-uniform scale.
+	const Frustum frustum(viewProjMatrix * worldMatrix);
+	const glm::vec4 objCameraPos = glm::inverse(worldMatrix) * glm::vec4(cameraPos, 1.0f);
+	const glm::vec3 eye = glm::vec3(objCameraPos) / objCameraPos.w;
+	const bool objectVisible = frustum.IsSphereVisible(boundingCenter, boundingRadius);
+	const glm::mat4x4 MVP = viewProjMatrix * worldMatrix;
+
+	numVisibleMeshlets = 0;
+	numOccludedMeshlets = 0;
+	for (auto&& subMesh : subMeshes) {
+		const int count = objectVisible ? (int)subMesh.meshlets.size() : 0;
+		std::vector<unsigned char> visible(count, 0);
+		ThreadPool::Instance().ParallelFor(0, count, [&](int begin, int end) {
+			for (int m = begin; m < end; ++m) {
+				const Meshlet& ml = subMesh.meshlets[m];
+				visible[m] = frustum.IsSphereVisible(ml.center, ml.radius)
+					&& !IsConeBackFacing(ml.center, ml.radius, ml.coneAxis, ml.coneCutoff, eye);
+				// 2: passed the frustum and cone tests but hidden behind the occluders.
+				if (visible[m] && occlusionBuffer != nullptr && occlusionBuffer->IsSphereOccluded(ml.center, ml.radius, MVP))
+					visible[m] = 2;
+			}
+		}, 64);
+
+		subMesh.drawCounts.clear();
+		subMesh.drawOffsets.clear();
+		unsigned int runEnd = 0;
+		for (int m = 0; m < count; ++m) {
+			numOccludedMeshlets += (visible[m] == 2) ? 1 : 0;
+			if (visible[m] != 1)
+				continue;
+			const Meshlet& ml = subMesh.meshlets[m];
+			numVisibleMeshlets++;
+			if (!subMesh.drawCounts.empty() && runEnd == ml.indexOffset)
+				subMesh.drawCounts.back() += (GLsizei)ml.indexCount;
+			else {
+				subMesh.drawCounts.push_back((GLsizei)ml.indexCount);
+				subMesh.drawOffsets.push_back((const GLvoid*)(ml.indexOffset * sizeof(unsigned int)));
+			}
+			runEnd = ml.indexOffset + ml.indexCount;
+		}
+	}
+}
+
+// Desc: GPU version of CullMeshlets(). The compute shader sets instanceCount of
+// each meshlet's indirect command to 0 or 1; RenderSubMesh() then issues one
+// glMultiDrawElementsIndirect per submesh.
+void TriangleMesh::CullMeshletsGPU(MeshletCullShaderProg* shader, const glm::mat4x4& worldMatrix,
+								const glm::mat4x4& viewProjMatrix, const glm::vec3& cameraPos,
+								HiZBuffer* hiZ, const int pass)
+{
+	if (cullBoundsBufferId == 0 || shader == nullptr)
+		return;
+	const bool useHiZ = hiZ != nullptr && hiZ->IsValid();
+	// Nothing to recover without a pyramid.
+	if (pass == 1 && !useHiZ)
+		return;
+
+	const Frustum frustum(viewProjMatrix * worldMatrix);
+	const glm::vec4 objCameraPos = glm::inverse(worldMatrix) * glm::vec4(cameraPos, 1.0f);
+	const glm::vec3 eye = glm::vec3(objCameraPos) / objCameraPos.w;
+	const glm::mat4x4 MVP = viewProjMatrix * worldMatrix;
+
+	// Reset the counters once per frame.
+	if (pass == 0) {
+		const MeshletCullStats zero = { 0, 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullStatsBufferId);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(MeshletCullStats), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	shader->Bind();
+	glUniform4fv(shader->GetLocFrustumPlanes(), 6, glm::value_ptr(frustum.planes[0]));
+	glUniform3fv(shader->GetLocCameraPos(), 1, glm::value_ptr(eye));
+	glUniform1ui(shader->GetLocNumChunks(), (GLuint)numMeshlets);
+	glUniformMatrix4fv(shader->GetLocMVP(), 1, GL_FALSE, glm::value_ptr(MVP));
+	glUniform1i(shader->GetLocPass(), pass);
+	glUniform1i(shader->GetLocUseHiZ(), useHiZ);
+	if (useHiZ) {
+		hiZ->Bind(GL_TEXTURE0);
+		glUniform1i(shader->GetLocHiZ(), 0);
+		glUniform1i(shader->GetLocHiZMaxLevel(), hiZ->GetNumLevels() - 1);
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cullBoundsBufferId);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, indirectBufferId);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cullStatsBufferId);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, occlusionFlagsBufferId);
+	shader->Dispatch((unsigned int)numMeshlets);
+	shader->UnBind();
+
+	// The commands are consumed by the following draws.
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+MeshletCullStats TriangleMesh::ReadGPUCullStats()
+{
+	MeshletCullStats stats = { 0, 0, 0, 0 };
+	if (cullStatsBufferId == 0)
+		return stats;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullStatsBufferId);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(MeshletCullStats), &stats);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return stats;
+}
+
 // Desc: Create vertex buffer and index buffer.
 void TriangleMesh::CreateBuffers()
 {
@@ -210,62 +940,380 @@ void TriangleMesh::CreateBuffers()
 	glGenBuffers(1, &vboId);
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(VertexPTN), vertices.data(), GL_STATIC_DRAW);
+	bufferBytes = numVertices * sizeof(VertexPTN);
+	// Tangents, a stream of their own (attribute 3).
+	if (!tangents.empty()) {
+		glGenBuffers(1, &tangentVboId);
+		glBindBuffer(GL_ARRAY_BUFFER, tangentVboId);
+		glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec4), tangents.data(), GL_STATIC_DRAW);
+		bufferBytes += tangents.size() * sizeof(glm::vec4);
+	}
 	// Create index buffer.
 	for (auto&& subMesh : subMeshes) {
+		subMesh.indexCount = (unsigned int)subMesh.vertexIndices.size();
 		glGenBuffers(1, &(subMesh.iboId));
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.iboId);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, subMesh.vertexIndices.size() * sizeof(unsigned int), subMesh.vertexIndices.data(), GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, subMesh.indexCount * sizeof(unsigned int), subMesh.vertexIndices.data(), GL_STATIC_DRAW);
+		bufferBytes += subMesh.indexCount * sizeof(unsigned int);
+	}
+
+	// Create GPU culling buffers (compute shaders and indirect draws need GL 4.3).
+	if (numMeshlets > 0 && GLEW_VERSION_4_3) {
+		// Bounds: object sphere followed by (sphere, cone) per meshlet, std430.
+		std::vector<glm::vec4> bounds;
+		std::vector<DrawElementsIndirectCommand> commands;
+		bounds.reserve(1 + 2 * numMeshlets);
+		commands.reserve(numMeshlets);
+		bounds.push_back(glm::vec4(boundingCenter, boundingRadius));
+		for (auto&& subMesh : subMeshes) {
+			for (auto&& ml : subMesh.meshlets) {
+				bounds.push_back(glm::vec4(ml.center, ml.radius));
+				bounds.push_back(glm::vec4(ml.coneAxis, ml.coneCutoff));
+				DrawElementsIndirectCommand cmd;
+				cmd.count = ml.indexCount;
+				cmd.instanceCount = 1;
+				cmd.firstIndex = ml.indexOffset;
+				cmd.baseVertex = 0;
+				cmd.baseInstance = 0;
+				commands.push_back(cmd);
+			}
+		}
+		glGenBuffers(1, &cullBoundsBufferId);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullBoundsBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &indirectBufferId);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirectBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &cullStatsBufferId);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullStatsBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MeshletCullStats), nullptr, GL_DYNAMIC_READ);
+		std::vector<GLuint> flags(numMeshlets, 0);
+		glGenBuffers(1, &occlusionFlagsBufferId);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, occlusionFlagsBufferId);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, flags.size() * sizeof(GLuint), flags.data(), GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		bufferBytes += bounds.size() * sizeof(glm::vec4) + commands.size() * sizeof(DrawElementsIndirectCommand)
+					+ sizeof(MeshletCullStats) + flags.size() * sizeof(GLuint);
 	}
 }
 
 void TriangleMesh::ReleaseBuffers()
 {
+	// Nothing was created (e.g. a mesh loaded headless for preprocessing): no GL calls.
+	if (vboId == 0 && cullBoundsBufferId == 0 && instanceBufferId == 0)
+		return;
 	// Delete index buffer.
 	glDeleteBuffers(1, &vboId);
+	vboId = 0;
+	glDeleteBuffers(1, &tangentVboId);
+	tangentVboId = 0;
 
 	for (auto&& subMesh : subMeshes) {
 		glDeleteBuffers(1, &(subMesh.iboId));
+		subMesh.iboId = 0;
 	}
+
+	glDeleteBuffers(1, &cullBoundsBufferId);
+	glDeleteBuffers(1, &indirectBufferId);
+	glDeleteBuffers(1, &cullStatsBufferId);
+	glDeleteBuffers(1, &occlusionFlagsBufferId);
+	cullBoundsBufferId = indirectBufferId = cullStatsBufferId = occlusionFlagsBufferId = 0;
+	bufferBytes = 0;
+	batchVertexCapacity = batchIndexCapacity = 0;
+	ClearInstances();
 }
 
-void TriangleMesh::Render()
+// Make room for count more elements after the used ones of a buffer (GL thread): a full buffer
+// is replaced by one twice as large and its contents copied on the GPU, so a progressive load
+// copies the data uploaded so far only a logarithmic number of times.
+static void ReserveBuffer(GLuint& buffer, size_t& capacity, const size_t used, const size_t count,
+						const size_t elementSize)
 {
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	if (used + count <= capacity)
+		return;
+	const size_t newCapacity = std::max(used + count, std::max(2 * capacity, (size_t)65536));
+	GLuint newBuffer = 0;
+	glGenBuffers(1, &newBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * elementSize, nullptr, GL_DYNAMIC_DRAW);
+	if (buffer != 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used * elementSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	buffer = newBuffer;
+	capacity = newCapacity;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, vboId);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)12);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)24);
+void TriangleMesh::AppendBatch(const MeshBatch& batch)
+{
+	if (subMeshes.empty()) {
+		// The real materials are only bound once the whole file is read.
+		PhongMaterial* material = new PhongMaterial();
+		material->SetName("(loading)");
+		material->SetKa(glm::vec3(0.1f, 0.1f, 0.1f));
+		material->SetKd(glm::vec3(0.6f, 0.6f, 0.6f));
+		material->SetKs(glm::vec3(0.2f, 0.2f, 0.2f));
+		material->SetNs(16.0f);
+		materials[material->GetName()] = material;
+		subMeshes.emplace_back();
+		subMeshes.back().material = material;
+	}
+	SubMesh& subMesh = subMeshes.back();
+	ReserveBuffer(vboId, batchVertexCapacity, numVertices, batch.vertices.size(), sizeof(VertexPTN));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vboId);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, numVertices * sizeof(VertexPTN), batch.vertices.size() * sizeof(VertexPTN),
+		batch.vertices.data());
+	ReserveBuffer(subMesh.iboId, batchIndexCapacity, subMesh.indexCount, batch.indices.size(), sizeof(unsigned int));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, subMesh.iboId);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, subMesh.indexCount * sizeof(unsigned int),
+		batch.indices.size() * sizeof(unsigned int), batch.indices.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	numVertices += (int)batch.vertices.size();
+	numTriangles += (int)batch.indices.size() / 3;
+	subMesh.indexCount += (unsigned int)batch.indices.size();
+	bufferBytes = batchVertexCapacity * sizeof(VertexPTN) + batchIndexCapacity * sizeof(unsigned int);
+}
+
+size_t TriangleMesh::GetGpuBytes() const
+{
+	return bufferBytes + (size_t)numInstances * sizeof(InstanceData);
+}
+
+size_t TriangleMesh::GetCpuBytes() const
+{
+	size_t total = vertices.capacity() * sizeof(VertexPTN) + tangents.capacity() * sizeof(glm::vec4);
+	for (auto&& subMesh : subMeshes)
+		total += subMesh.vertexIndices.capacity() * sizeof(unsigned int);
+	return total;
+}
+
+size_t TriangleMesh::ReleaseCpuCopy()
+{
+	// Meshlets (bounds and index ranges) stay for CPU culling.
+	if (vboId == 0)
+		return 0;
+	const size_t freed = GetCpuBytes();
+	std::vector<VertexPTN>().swap(vertices);
+	std::vector<glm::vec4>().swap(tangents);
+	for (auto&& subMesh : subMeshes)
+		std::vector<unsigned int>().swap(subMesh.vertexIndices);
+	return freed;
+}
+
+void TriangleMesh::SetInstances(const std::vector<glm::mat4x4>& worldMatrices)
+{
+	numInstances = (int)worldMatrices.size();
+	if (numInstances == 0) {
+		ClearInstances();
+		return;
+	}
+	std::vector<InstanceData> instances(numInstances);
+	ThreadPool::Instance().ParallelFor(0, numInstances, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			instances[i].worldMatrix = worldMatrices[i];
+			instances[i].normalMatrix = glm::transpose(glm::inverse(glm::mat3x3(worldMatrices[i])));
+		}
+	}, 256);
+
+	if (instanceBufferId == 0)
+		glGenBuffers(1, &instanceBufferId);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBufferId);
+	// Orphan the old storage so an update does not wait for the previous frame.
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), instances.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TriangleMesh::ClearInstances()
+{
+	glDeleteBuffers(1, &instanceBufferId);
+	instanceBufferId = 0;
+	numInstances = 0;
+}
+
+bool TriangleMesh::PackTextures()
+{
+	if (texturesPacked)
+		return false;
+	// Wait until every texture is resident (or has failed to load).
+	for (auto&& material : materials) {
+		const ImageTexture* texture = material.second->GetMapKd();
+		if (texture != nullptr && !texture->IsResident() && !texture->IsFailed())
+			return false;
+	}
+	texturesPacked = true;
+
+	// Group the distinct textures by packing key, in submesh order (copies of one image under
+	// several names are one texture, see ImageTexture::GetShared).
+	std::map<std::string, std::vector<ImageTexture*>> groups;
+	std::map<ImageTexture*, std::pair<int, int>> slots;
+	for (auto&& subMesh : subMeshes) {
+		ImageTexture* texture = subMesh.material != nullptr && subMesh.material->GetMapKd() != nullptr
+								? subMesh.material->GetMapKd()->GetShared() : nullptr;
+		// Textures missing their top levels (MemoryBudget) are bound alone.
+		if (texture == nullptr || !texture->IsResident() || texture->GetBaseLevel() > 0 || slots.count(texture) > 0)
+			continue;
+		groups[TextureArray::GetPackingKey(texture)].push_back(texture);
+		slots[texture] = std::make_pair(-1, -1);
+	}
+	size_t totalBytes = 0, packedBytes = 0;
+	int numPacked = 0;
+	for (auto&& slot : slots)
+		totalBytes += slot.first->GetGpuBytes();
+	for (auto&& group : groups) {
+		// A single texture gains nothing from an array.
+		if (group.second.size() < 2)
+			continue;
+		TextureArray* textureArray = new TextureArray();
+		if (!textureArray->Create(group.second)) {
+			delete textureArray;
+			continue;
+		}
+		for (int layer = 0; layer < (int)group.second.size(); ++layer) {
+			slots[group.second[layer]] = std::make_pair((int)textureArrays.size(), layer);
+			packedBytes += group.second[layer]->GetGpuBytes();
+		}
+		numPacked += (int)group.second.size();
+		textureArrays.push_back(textureArray);
+	}
+	// The arrays now hold the packed maps: free their 2D copies. The materials keep them, so
+	// a mesh that still binds one alone (sharing it through TextureManager) reloads it.
+	size_t releasedBytes = 0;
+	for (auto&& slot : slots) {
+		if (slot.second.first >= 0)
+			releasedBytes += slot.first->ReleaseGpuCopy();
+	}
+
+	// Binds of one pass over the submeshes, before and after (consecutive draws from the
+	// same array need no rebind).
+	int bindsBefore = 0, bindsAfter = 0;
+	const void* lastBound = nullptr;
+	for (auto&& subMesh : subMeshes) {
+		ImageTexture* texture = subMesh.material != nullptr && subMesh.material->GetMapKd() != nullptr
+								? subMesh.material->GetMapKd()->GetShared() : nullptr;
+		if (texture == nullptr)
+			continue;
+		++bindsBefore;
+		auto slot = slots.find(texture);
+		if (slot != slots.end() && slot->second.first >= 0) {
+			subMesh.textureArray = slot->second.first;
+			subMesh.textureLayer = slot->second.second;
+		}
+		const void* bound = subMesh.textureArray >= 0 ? (const void*)textureArrays[subMesh.textureArray] : (const void*)texture;
+		if (bound != lastBound)
+			++bindsAfter;
+		lastBound = bound;
+	}
+	if (numPacked > 0) {
+		std::cout << "Texture arrays: " << numPacked << " of " << slots.size() << " diffuse maps in "
+				  << textureArrays.size() << " arrays (" << std::fixed << std::setprecision(1)
+				  << (totalBytes > 0 ? 100.0 * packedBytes / totalBytes : 0.0) << "% of texture memory, "
+				  << releasedBytes / (1024.0 * 1024.0) << " MB of 2D copies released); "
+				  << "binds per pass " << bindsBefore << " -> " << bindsAfter << std::endl;
+		std::cout.unsetf(std::ios::fixed);
+		std::cout << std::setprecision(6);
+	}
+	return true;
+}
+
+void TriangleMesh::SetIdentityInstanceAttributes()
+{
+	for (int i = 0; i < 4; ++i)
+		glVertexAttrib4f(4 + i, i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f, i == 3 ? 1.0f : 0.0f);
+	for (int i = 0; i < 3; ++i)
+		glVertexAttrib3f(8 + i, i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f);
+}
+
+void TriangleMesh::Render()
+{
+	EnableVertexAttributes();
+	SetIdentityInstanceAttributes();
 
 	for (auto&& subMesh : subMeshes) {
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.iboId);
-		glDrawElements(GL_TRIANGLES, (GLsizei)(subMesh.vertexIndices.size()), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, (GLsizei)(subMesh.indexCount), GL_UNSIGNED_INT, 0);
 	}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
+	DisableVertexAttributes();
+}
+
+void TriangleMesh::RenderSubMesh(const SubMesh& subMesh)
+{
+	EnableVertexAttributes();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.iboId);
+	if (numInstances > 0) {
+		// Instance matrices advance once per instance; a mat4 takes 4 locations, a mat3 3.
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferId);
+		for (int i = 0; i < 4; ++i) {
+			glEnableVertexAttribArray(4 + i);
+			glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (const GLvoid*)(i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(4 + i, 1);
+		}
+		for (int i = 0; i < 3; ++i) {
+			glEnableVertexAttribArray(8 + i);
+			glVertexAttribPointer(8 + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+				(const GLvoid*)(sizeof(glm::mat4x4) + i * sizeof(glm::vec3)));
+			glVertexAttribDivisor(8 + i, 1);
+		}
+		glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)(subMesh.indexCount), GL_UNSIGNED_INT, 0, numInstances);
+		for (int i = 4; i < 11; ++i) {
+			glVertexAttribDivisor(i, 0);
+			glDisableVertexAttribArray(i);
+		}
+		DisableVertexAttributes();
+		return;
+	}
+	SetIdentityInstanceAttributes();
+
+	if (cullMode == MESHLET_CULL_CPU && !subMesh.meshlets.empty()) {
+		// Only the meshlet ranges that survived the last CullMeshlets().
+		if (!subMesh.drawCounts.empty())
+			glMultiDrawElements(GL_TRIANGLES, subMesh.drawCounts.data(), GL_UNSIGNED_INT,
+				subMesh.drawOffsets.data(), (GLsizei)subMesh.drawCounts.size());
+	}
+	else if (cullMode == MESHLET_CULL_GPU && indirectBufferId != 0 && !subMesh.meshlets.empty()) {
+		// One command per meshlet; culled ones were given zero instances.
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferId);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(const GLvoid*)(subMesh.firstCommand * sizeof(DrawElementsIndirectCommand)),
+			(GLsizei)subMesh.meshlets.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else
+		glDrawElements(GL_TRIANGLES, (GLsizei)(subMesh.indexCount), GL_UNSIGNED_INT, 0);
+
+	DisableVertexAttributes();
 }
 
-void TriangleMesh::RenderSubMesh(SubMesh subMesh)
+void TriangleMesh::EnableVertexAttributes()
 {
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
-
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), 0);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)12);
 	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPTN), (const GLvoid*)24);
+	if (tangentVboId != 0) {
+		glEnableVertexAttribArray(3);
+		glBindBuffer(GL_ARRAY_BUFFER, tangentVboId);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+	}
+	else
+		glVertexAttrib4f(3, 1.0f, 0.0f, 0.0f, 1.0f);
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.iboId);
-	glDrawElements(GL_TRIANGLES, (GLsizei)(subMesh.vertexIndices.size()), GL_UNSIGNED_INT, 0);
-
+void TriangleMesh::DisableVertexAttributes()
+{
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(2);
+	glDisableVertexAttribArray(3);
 }
 
 // Show model information.
@@ -277,8 +1325,10 @@ void TriangleMesh::ShowInfo()
 	for (unsigned int i = 0; i < subMeshes.size(); ++i) {
 		const SubMesh& g = subMeshes[i];
 		std::cout << "SubMesh " << i << " with material: " << g.material->GetName() << std::endl;
-		std::cout << "Num. triangles in the subMesh: " << g.vertexIndices.size() / 3 << std::endl;
+		std::cout << "Num. triangles in the subMesh: " << g.indexCount / 3 << std::endl;
 	}
+	if (numMeshlets > 0)
+		std::cout << "# Meshlets: " << numMeshlets << std::endl;
 	std::cout << "Model Center: " << objCenter.x << ", " << objCenter.y << ", " << objCenter.z << std::endl;
 	std::cout << "Model Extent: " << objExtent.x << " x " << objExtent.y << " x " << objExtent.z << std::endl;
 }
@@ -3,6 +3,14 @@
 
 #include "headers.h"
 #include "material.h"
+#include "culling.h"
+#include "shaderprog.h"
+#include "hizbuffer.h"
+#include "softwareocclusion.h"
+#include "texturearray.h"
+#include "memorybudget.h"
+#include <atomic>
+#include <functional>
 
 // VertexPTN Declarations.
 struct VertexPTN
@@ -22,39 +30,208 @@ struct VertexPTN
 	glm::vec2 texcoord;
 };
 
+// MeshBatch Declarations.
+// Faces parsed since the previous batch of a progressive load (TriangleMesh::LoadFromFile):
+// the vertices they add, provisionally normalized, and their triangles, indexing the vertices
+// of the whole load (all submeshes together).
+struct MeshBatch
+{
+	std::vector<VertexPTN> vertices;
+	std::vector<unsigned int> indices;
+	MeshBatch* next;
+};
+
+// Meshlet Declarations.
+// A small cluster of triangles stored as a contiguous range of its submesh's index buffer.
+struct Meshlet
+{
+	static const unsigned int maxVertices = 64;
+	static const unsigned int maxTriangles = 124;
+
+	Meshlet() {
+		center = glm::vec3(0.0f, 0.0f, 0.0f);
+		radius = 0.0f;
+		coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		coneCutoff = 1.0f;
+		indexOffset = 0;
+		indexCount = 0;
+		vertexCount = 0;
+	}
+	// Bounding sphere (object space).
+	glm::vec3 center;
+	float radius;
+	// Normal cone; coneCutoff = 1 disables the back-face test.
+	glm::vec3 coneAxis;
+	float coneCutoff;
+	// Range in SubMesh::vertexIndices.
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	unsigned int vertexCount;
+};
+
 // SubMesh Declarations.
 struct SubMesh
 {
 	SubMesh() {
 		material = nullptr;
 		iboId = 0;
+		indexCount = 0;
+		firstCommand = 0;
+		textureArray = -1;
+		textureLayer = -1;
 	}
 	PhongMaterial* material;
 	GLuint iboId;
+	// Released after CreateBuffers (MemoryBudget); indexCount stays.
 	std::vector<unsigned int> vertexIndices;
+	unsigned int indexCount;
+	// Optional meshlets and the draw list produced by the last culling pass.
+	std::vector<Meshlet> meshlets;
+	std::vector<GLsizei> drawCounts;
+	std::vector<const GLvoid*> drawOffsets;
+	// First indirect draw command of this submesh (GPU culling).
+	unsigned int firstCommand;
+	// Where map_Kd was packed (TriangleMesh::PackTextures), or -1 to bind it alone.
+	int textureArray;
+	int textureLayer;
+};
+
+// DrawElementsIndirectCommand Declarations (layout defined by glMultiDrawElementsIndirect).
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Counters written by the GPU culling passes.
+struct MeshletCullStats
+{
+	GLuint numVisible;
+	GLuint numFrustumCulled;	// Frustum or normal cone.
+	GLuint numOccluded;			// Rejected by the previous-frame Hi-Z in pass 0.
+	GLuint numRecovered;		// Of those, found visible again in pass 1.
+};
+
+// InstanceData Declarations.
+// Per-instance vertex attributes: locations 4-7 world matrix, 8-10 normal matrix.
+struct InstanceData
+{
+	glm::mat4x4 worldMatrix;
+	glm::mat3x3 normalMatrix;
+};
+
+// Which pass decides the visible meshlets.
+enum MeshletCullMode
+{
+	MESHLET_CULL_NONE = 0,
+	MESHLET_CULL_CPU,
+	MESHLET_CULL_GPU
 };
 
 
 // TriangleMesh Declarations.
-class TriangleMesh
+// Accounted by MemoryBudget: vertices and vertexIndices are released once uploaded.
+class TriangleMesh : public BudgetedResource
 {
 public:
 	// TriangleMesh Public Methods.
 	TriangleMesh();
 	~TriangleMesh();
 	
-	// Load the model from an *.OBJ file.
-	bool LoadFromFile(const std::string& filePath, const bool normalized = true);
-	bool LoadMTLLib(const std::string&);
-	// Create vertex and index buffers.
+	// Called with each map_Kd path as soon as its MTL library is parsed (on a worker).
+	typedef std::function<void(const std::string&)> MapKdCallback;
+	// Handed each batch of numBatchTriangles parsed triangles (on a worker; owns the batch).
+	typedef std::function<void(MeshBatch*)> BatchCallback;
+	static const int numBatchTriangles = 32768;
+
+	// Load the model from an *.OBJ file. CPU only, so it may run on a worker; returns false
+	// early once *cancelled is set. The MTL libraries are parsed on the thread pool alongside.
+	// With onBatch, the faces are also handed out in batches as they are parsed, normalized by
+	// the bounding box of the positions read before the first batch (in most files, all of
+	// them); the loaded mesh is normalized by the exact one.
+	bool LoadFromFile(const std::string& filePath, const bool normalized = true,
+					const std::atomic<bool>* cancelled = nullptr, const MapKdCallback& onMapKd = nullptr,
+					const BatchCallback& onBatch = nullptr);
+	static bool LoadMTLLib(const std::string& filePath, std::map<std::string, PhongMaterial*>& materials,
+						const MapKdCallback& onMapKd = nullptr);
+	// Parse a face corner, "p", "p/t", "p//n" or "p/t/n", into zero-based indices (-1 where
+	// absent). Indices are one-based, or negative: counted back from the last element read.
+	static bool ParseFaceCorner(const std::string& corner, const int numPositions, const int numTexcoords,
+								const int numNormals, int index[3]);
+	// Smooth the normals of vertices (in parallel): each takes the normals of the faces around
+	// its position (vertexPositions, below numPositions; LoadFromFile gives positions with the
+	// same coordinates one index), weighted by area and corner angle, from the faces within
+	// creaseAngleDeg of its own (180: all of them). Vertices with a nonzero fileNormals entry
+	// keep theirs; an empty fileNormals regenerates every normal.
+	static void GenerateNormals(std::vector<VertexPTN>& vertices, const std::vector<unsigned int>& vertexPositions,
+								const unsigned int numPositions, const std::vector<SubMesh>& subMeshes,
+								const float creaseAngleDeg, const std::vector<unsigned char>& fileNormals);
+	// Tangent frames for normal mapping, compatible with MikkTSpace (in parallel): xyz the
+	// tangent, w the sign of the bitangent, cross(normal, tangent) * w. One per vertex.
+	static void GenerateTangents(const std::vector<VertexPTN>& vertices, const std::vector<unsigned int>& vertexPositions,
+								const unsigned int numPositions, const std::vector<SubMesh>& subMeshes,
+								std::vector<glm::vec4>& tangents);
+	// LoadFromFile generates the normals missing from a file; with recompute, all of them.
+	static void SetNormalGeneration(const bool recompute, const float creaseAngle) {
+		recomputeNormals = recompute;
+		creaseAngleDeg = creaseAngle;
+	}
+	static bool GetRecomputeNormals() { return recomputeNormals; }
+	// LoadFromFile generates tangents for textured models (off: no shader reads them yet).
+	static void SetTangentGeneration(const bool generate) { generateTangents = generate; }
+	// Rewrite the positions to (position - center) * scale in place: SSE, split over the
+	// thread pool.
+	static void NormalizePositions(VertexPTN* vertices, const size_t count, const glm::vec3& center,
+								const float scale);
+	// Acquire the map_Kd textures named by the MTL library (GL thread, after LoadFromFile).
+	void AcquireTextures();
+	// Create vertex and index buffers (and the tangent stream, attribute 3, if tangents were made).
 	void CreateBuffers();
 	void ReleaseBuffers();
+	// Grow the buffers of a mesh being loaded progressively by a batch (GL thread). Such a mesh
+	// only draws: one submesh with a plain material, no meshlets and no CPU copy.
+	void AppendBatch(const MeshBatch& batch);
+	// Split every submesh into meshlets (call after LoadFromFile, before CreateBuffers).
+	void BuildMeshlets();
+	// Pick the largest triangles as occluders for the software occlusion buffer.
+	void BuildOccluders(const int maxTriangles);
+	// Reject off-screen and back-facing meshlets (and, given an occlusion buffer
+	// filled for the same MVP, hidden ones) and rebuild the draw lists.
+	void CullMeshlets(const glm::mat4x4& worldMatrix, const glm::mat4x4& viewProjMatrix, const glm::vec3& cameraPos,
+					const SoftwareOcclusionBuffer* occlusionBuffer = nullptr);
+	// Same test in a compute shader, writing the indirect draw commands (GL 4.3+).
+	// With a valid hiZ, pass 0 also rejects meshlets hidden in the previous frame's
+	// depth pyramid and pass 1 re-tests those against the current one.
+	void CullMeshletsGPU(MeshletCullShaderProg* shader, const glm::mat4x4& worldMatrix,
+						const glm::mat4x4& viewProjMatrix, const glm::vec3& cameraPos,
+						HiZBuffer* hiZ = nullptr, const int pass = 0);
+	// Read back the counters of the last GPU culling passes (stalls the pipeline).
+	MeshletCullStats ReadGPUCullStats();
+	// Draw every submesh once per world matrix with glDrawElementsInstanced.
+	// Meshlet culling is per object and is skipped while instances are set.
+	void SetInstances(const std::vector<glm::mat4x4>& worldMatrices);
+	void ClearInstances();
+	// Copy the map_Kd textures that share a size and format into texture arrays, once they
+	// have all finished loading, and free the packed 2D textures (reloaded if bound alone
+	// again). Returns true on the call that packs them.
+	bool PackTextures();
 	// Render.
 	void Render();
-	void RenderSubMesh(SubMesh);
+	void RenderSubMesh(const SubMesh&);
+	// Not instanced: the shader reads the constant instance attributes, set to identity.
+	static void SetIdentityInstanceAttributes();
 	// Show model information.
 	void ShowInfo();
 
+	// BudgetedResource interface.
+	const char* GetResourceType() const { return "mesh"; }
+	size_t GetGpuBytes() const;
+	size_t GetCpuBytes() const;
+	size_t ReleaseCpuCopy();
+
 	// -------------------------------------------------------
 	// Feel free to add your methods or data here.
 	// -------------------------------------------------------
@@ -62,8 +239,22 @@ public:
 	int GetNumVertices() const { return numVertices; }
 	int GetNumTriangles() const { return numTriangles; }
 	int GetNumSubMeshes() const { return (int)subMeshes.size(); }
+	int GetNumMeshlets() const { return numMeshlets; }
+	int GetNumVisibleMeshlets() const { return numVisibleMeshlets; }
+	int GetNumOccludedMeshlets() const { return numOccludedMeshlets; }
+	int GetNumInstances() const { return numInstances; }
+	const std::vector<glm::vec3>& GetOccluderTriangles() const { return occluderTriangles; }
+
+	void SetMeshletCullMode(const MeshletCullMode mode) { cullMode = mode; }
+	MeshletCullMode GetMeshletCullMode() const { return cullMode; }
+	bool HasGPUCulling() const { return cullBoundsBufferId != 0; }
 
-	std::vector<SubMesh> GetsubMeshes() const { return subMeshes; }
+	const std::vector<SubMesh>& GetsubMeshes() const { return subMeshes; }
+	// Empty once the buffers are created and MemoryBudget has released the CPU copy.
+	const std::vector<VertexPTN>& GetVertices() const { return vertices; }
+	const std::vector<glm::vec4>& GetTangents() const { return tangents; }
+	TextureArray* GetTextureArray(const int index) const { return textureArrays[index]; }
+	bool IsTexturePacked() const { return texturesPacked; }
 	glm::vec3 GetObjCenter() const { return objCenter; }
 	glm::vec3 GetObjExtent() const { return objExtent; }
 
@@ -72,20 +263,56 @@ private:
 	// Feel free to add your methods or data here.
 	// -------------------------------------------------------
 
+	// Vertex attributes 0-3 from the vertex and tangent buffers (a constant tangent without them).
+	void EnableVertexAttributes();
+	void DisableVertexAttributes();
+
 	// TriangleMesh Private Data.
 	GLuint vboId;
+	GLuint tangentVboId;
+	// GPU culling buffers: meshlet bounds (SSBO), indirect commands, visible counter.
+	GLuint cullBoundsBufferId;
+	GLuint indirectBufferId;
+	GLuint cullStatsBufferId;
+	GLuint occlusionFlagsBufferId;
+	// Per-instance attributes (InstanceData).
+	GLuint instanceBufferId;
+	// Vertex, index and culling buffers (the instance buffer is counted apart).
+	size_t bufferBytes;
+	// Allocated sizes, in elements, of the buffers grown by AppendBatch.
+	size_t batchVertexCapacity;
+	size_t batchIndexCapacity;
 	
 	std::vector<VertexPTN> vertices;
+	// Per vertex (GenerateTangents); empty without texcoords or SetTangentGeneration.
+	std::vector<glm::vec4> tangents;
 	// For supporting multiple materials per object, move to SubMesh.
 	// GLuint iboId;
 	// std::vector<unsigned int> vertexIndices;
 	std::vector<SubMesh> subMeshes;
 	std::map<std::string, PhongMaterial*> materials;
+	std::vector<TextureArray*> textureArrays;
+	bool texturesPacked;
 
 	int numVertices;
 	int numTriangles;
+	int numMeshlets;
+	int numVisibleMeshlets;
+	int numOccludedMeshlets;
+	int numInstances;
+	MeshletCullMode cullMode;
+	// Object-space occluder triangles (3 positions each).
+	std::vector<glm::vec3> occluderTriangles;
+	// Bounding sphere around all meshlets.
+	glm::vec3 boundingCenter;
+	float boundingRadius;
 	glm::vec3 objCenter;
 	glm::vec3 objExtent;
+	// Normal generation (SetNormalGeneration).
+	static bool recomputeNormals;
+	static float creaseAngleDeg;
+	// Tangent generation (SetTangentGeneration).
+	static bool generateTangents;
 };
 
 
@@ -0,0 +1,539 @@
+#include "virtualtexture.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Layout of the *.vt files: this header, then the pages of level 0, 1, ... in rows,
+// bottom row first, each (pageSize / 4)^2 BC1 blocks.
+struct VirtualTextureHeader
+{
+	char magic[4];			// "VTEX".
+	uint32_t version;
+	uint64_t sourceSize;	// The image the pages came from, to detect edits.
+	int64_t sourceTime;
+	int32_t pagesX;			// Level 0 pages across and down (powers of two).
+	int32_t pagesY;
+	int32_t pageSize;
+	int32_t pageBorder;
+	int32_t numLevels;
+	int32_t format;			// BlockFormat of the pages.
+};
+static const uint32_t virtualTextureVersion = 1;
+
+VirtualTexture::VirtualTexture()
+{
+	headerBytes = sizeof(VirtualTextureHeader);
+	pagesX = 0;
+	pagesY = 0;
+	numLevels = 0;
+	numPages = 0;
+	cacheSide = 0;
+	loaded = std::make_shared<LoadedQueue>();
+	numPagesInFlight = 0;
+	indirectionDirty = false;
+	frame = 1;
+	pageCacheTexId = 0;
+	indirectionTexId = 0;
+	feedbackFboId = 0;
+	feedbackTexId = 0;
+	feedbackPboIds[0] = feedbackPboIds[1] = 0;
+	feedbackPending[0] = feedbackPending[1] = false;
+	feedbackWidth = 0;
+	feedbackHeight = 0;
+	nextFeedbackPbo = 0;
+	for (int i = 0; i < 4; ++i)
+		savedViewport[i] = 0;
+	numPagesUploaded = 0;
+	numPagesDropped = 0;
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	// Reads still in flight finish into the queue, which they keep alive.
+	ReleaseFeedbackTargets();
+	glDeleteTextures(1, &pageCacheTexId);
+	glDeleteTextures(1, &indirectionTexId);
+}
+
+bool VirtualTexture::Tile(const std::string& imagePath)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	cv::Mat image = cv::imread(imagePath);
+	if (image.empty()) {
+		std::cerr << "[ERROR] Failed to load image to tile: " << imagePath << std::endl;
+		return false;
+	}
+	// Bottom row first, as ImageTexture uploads it.
+	cv::flip(image, image, 0);
+
+	// Page counts are rounded to the nearest power of two, so every level halves exactly
+	// and the indirection texture has a regular mip chain; the image is resampled to fit.
+	const int content = pageSize - 2 * pageBorder;
+	auto NumPages = [content](const int size) {
+		const float pages = (float)size / (float)content;
+		int numPages = 1;
+		while (numPages < maxPages && (float)(numPages * 2) <= pages * 1.41421356f)
+			numPages *= 2;
+		return numPages;
+	};
+	VirtualTextureHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic[0] = 'V'; header.magic[1] = 'T'; header.magic[2] = 'E'; header.magic[3] = 'X';
+	header.version = virtualTextureVersion;
+	std::error_code ec;
+	header.sourceSize = (uint64_t)std::filesystem::file_size(imagePath, ec);
+	header.sourceTime = (int64_t)std::filesystem::last_write_time(imagePath, ec).time_since_epoch().count();
+	header.pagesX = NumPages(image.cols);
+	header.pagesY = NumPages(image.rows);
+	header.pageSize = pageSize;
+	header.pageBorder = pageBorder;
+	header.numLevels = 1;
+	while ((std::max(header.pagesX, header.pagesY) >> header.numLevels) > 0)
+		header.numLevels++;
+	header.format = BLOCK_BC1;
+
+	const std::string tilePath = GetTilePath(imagePath);
+	std::ofstream out(tilePath, std::ios::binary);
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write virtual texture: " << tilePath << std::endl;
+		return false;
+	}
+	out.write((const char*)&header, sizeof(header));
+
+	const size_t pageBytes = (size_t)(pageSize / 4) * (pageSize / 4) * BlockCompressedImage::GetBlockBytes(BLOCK_BC1);
+	size_t totalBytes = 0;
+	cv::Mat level;
+	const cv::Size levelSize(header.pagesX * content, header.pagesY * content);
+	cv::resize(image, level, levelSize, 0, 0, levelSize.width < image.cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+	image.release();
+	for (int l = 0; l < header.numLevels; ++l) {
+		const int levelPagesX = std::max(1, header.pagesX >> l);
+		const int levelPagesY = std::max(1, header.pagesY >> l);
+		if (l > 0)
+			cv::resize(level, level, cv::Size(levelPagesX * content, levelPagesY * content), 0, 0, cv::INTER_AREA);
+		std::vector<uint8_t> data((size_t)levelPagesX * levelPagesY * pageBytes);
+		ThreadPool::Instance().ParallelFor(0, levelPagesX * levelPagesY, [&](int begin, int end) {
+			std::vector<unsigned char> texels((size_t)pageSize * pageSize * 3);
+			BlockCompressedImage page;
+			for (int i = begin; i < end; ++i) {
+				const int px = i % levelPagesX;
+				const int py = i / levelPagesX;
+				// Borders wrap around horizontally (the panorama seam) and clamp vertically.
+				for (int y = 0; y < pageSize; ++y) {
+					const int sy = std::min(std::max(py * content + y - pageBorder, 0), level.rows - 1);
+					const unsigned char* src = level.ptr<unsigned char>(sy);
+					for (int x = 0; x < pageSize; ++x) {
+						const int sx = (px * content + x - pageBorder + level.cols) % level.cols;
+						std::memcpy(&texels[((size_t)y * pageSize + x) * 3], src + (size_t)sx * 3, 3);
+					}
+				}
+				page.Encode(texels.data(), pageSize, pageSize, 3, (size_t)pageSize * 3, BLOCK_BC1, 1);
+				std::memcpy(&data[(size_t)i * pageBytes], page.GetLevel(0).data(), pageBytes);
+			}
+		}, 1);
+		out.write((const char*)data.data(), data.size());
+		totalBytes += data.size();
+	}
+	if (!out) {
+		std::cerr << "[ERROR] Cannot write virtual texture: " << tilePath << std::endl;
+		return false;
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	std::cout << "Tiled " << imagePath << ": " << levelSize.width << "x" << levelSize.height << " in "
+			  << header.pagesX << "x" << header.pagesY << " pages of " << pageSize << ", " << header.numLevels
+			  << " levels, " << totalBytes / (1024 * 1024) << " MB in "
+			  << std::chrono::duration<float, std::milli>(endTime - startTime).count() << " ms" << std::endl;
+	return true;
+}
+
+bool VirtualTexture::Open(const std::string& imagePath)
+{
+	tilePath = GetTilePath(imagePath);
+	std::ifstream in(tilePath, std::ios::binary);
+	VirtualTextureHeader header;
+	if (!in.read((char*)&header, sizeof(header)) || std::strncmp(header.magic, "VTEX", 4) != 0
+		|| header.version != virtualTextureVersion || header.pageSize != pageSize || header.pageBorder != pageBorder
+		|| header.format != BLOCK_BC1 || header.pagesX < 1 || header.pagesY < 1
+		|| header.pagesX > maxPages || header.pagesY > maxPages) {
+		std::cerr << "[ERROR] Not a virtual texture: " << tilePath << std::endl;
+		return false;
+	}
+	// The source may be gone (only the pages are needed), but must not be newer.
+	std::error_code ec;
+	if (std::filesystem::exists(imagePath, ec)) {
+		const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(imagePath, ec);
+		const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(imagePath, ec).time_since_epoch().count();
+		if (header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+			std::cerr << "[ERROR] Virtual texture is older than its image (tile it again): " << tilePath << std::endl;
+			return false;
+		}
+	}
+	if (!GLEW_EXT_texture_compression_s3tc) {
+		std::cerr << "[ERROR] Virtual textures need BC1 (S3TC) support" << std::endl;
+		return false;
+	}
+
+	pagesX = header.pagesX;
+	pagesY = header.pagesY;
+	numLevels = header.numLevels;
+	levelFirstPage.assign(numLevels, 0);
+	numPages = 0;
+	for (int level = 0; level < numLevels; ++level) {
+		levelFirstPage[level] = numPages;
+		numPages += GetLevelPagesX(level) * GetLevelPagesY(level);
+	}
+	if ((size_t)std::filesystem::file_size(tilePath, ec) < GetPageOffset(numPages)) {
+		std::cerr << "[ERROR] Truncated virtual texture: " << tilePath << std::endl;
+		return false;
+	}
+	pageSlot.assign(numPages, -1);
+	pageLoading.assign(numPages, 0);
+	pageSeenFrame.assign(numPages, 0);
+
+	// Up to 32 x 32 pages (4096^2 texels, 8 MB), fewer if the whole texture fits.
+	cacheSide = 1;
+	while (cacheSide < 32 && cacheSide * cacheSide < numPages)
+		cacheSide++;
+	slots.assign(cacheSide * cacheSide, CacheSlot{ -1, 0 });
+	const int cacheSize = cacheSide * pageSize;
+	glGenTextures(1, &pageCacheTexId);
+	glBindTexture(GL_TEXTURE_2D, pageCacheTexId);
+	glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, cacheSize, cacheSize, 0,
+						(GLsizei)((size_t)cacheSide * cacheSide * GetPageBytes()), nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	indirection.assign(numLevels, std::vector<uint32_t>());
+	glGenTextures(1, &indirectionTexId);
+	glBindTexture(GL_TEXTURE_2D, indirectionTexId);
+	for (int level = 0; level < numLevels; ++level) {
+		indirection[level].assign((size_t)GetLevelPagesX(level) * GetLevelPagesY(level), 0);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, GetLevelPagesX(level), GetLevelPagesY(level), 0,
+					GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The coarsest level (one page) is the fallback for everything else.
+	std::vector<uint8_t> blocks;
+	const int rootPage = levelFirstPage[numLevels - 1];
+	if (!ReadPage(in, rootPage, blocks) || !UploadPage(rootPage, blocks)) {
+		std::cerr << "[ERROR] Cannot read virtual texture: " << tilePath << std::endl;
+		return false;
+	}
+	UpdateIndirection();
+	std::cout << "Virtual texture " << tilePath << ": " << pagesX * (pageSize - 2 * pageBorder) << "x"
+			  << pagesY * (pageSize - 2 * pageBorder) << ", " << numPages << " pages in " << numLevels
+			  << " levels, page cache " << cacheSize << "x" << cacheSize << std::endl;
+	return true;
+}
+
+size_t VirtualTexture::GetPageBytes() const
+{
+	return (size_t)(pageSize / 4) * (pageSize / 4) * BlockCompressedImage::GetBlockBytes(BLOCK_BC1);
+}
+
+size_t VirtualTexture::GetPageOffset(const int page) const
+{
+	return headerBytes + (size_t)page * GetPageBytes();
+}
+
+bool VirtualTexture::ReadPage(std::ifstream& in, const int page, std::vector<uint8_t>& blocks) const
+{
+	blocks.resize(GetPageBytes());
+	in.clear();
+	in.seekg((std::streamoff)GetPageOffset(page));
+	return (bool)in.read((char*)blocks.data(), blocks.size());
+}
+
+void VirtualTexture::Update()
+{
+	++frame;
+
+	// The buffer written two frames ago: reading it back does not wait on the GPU.
+	if (feedbackPending[nextFeedbackPbo]) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPboIds[nextFeedbackPbo]);
+		const uint8_t* texels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			(GLsizeiptr)feedbackWidth * feedbackHeight * 4, GL_MAP_READ_BIT);
+		if (texels != nullptr) {
+			ProcessFeedback(texels, feedbackWidth * feedbackHeight);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		feedbackPending[nextFeedbackPbo] = false;
+	}
+
+	std::vector<LoadedPage> pages;
+	{
+		std::lock_guard<std::mutex> lock(loaded->mutex);
+		while (!loaded->pages.empty() && (int)pages.size() < maxUploadsPerFrame) {
+			pages.push_back(std::move(loaded->pages.front()));
+			loaded->pages.pop_front();
+		}
+	}
+	for (auto&& page : pages) {
+		--numPagesInFlight;
+		pageLoading[page.page] = 0;
+		if (page.blocks.empty()) {
+			std::cerr << "[ERROR] Cannot read virtual texture page " << page.page << ": " << tilePath << std::endl;
+			continue;
+		}
+		if (pageSlot[page.page] < 0 && !UploadPage(page.page, page.blocks))
+			++numPagesDropped;
+	}
+	if (indirectionDirty)
+		UpdateIndirection();
+}
+
+void VirtualTexture::ProcessFeedback(const uint8_t* texels, const int numTexels)
+{
+	std::vector<int> missing;
+	for (int i = 0; i < numTexels; ++i) {
+		const uint8_t* texel = texels + 4 * i;
+		// Alpha 0: no virtual texture lookup in this pixel.
+		if (texel[3] == 0)
+			continue;
+		int x = texel[0];
+		int y = texel[1];
+		// The ancestors too, so a coarser page stays to fall back on.
+		for (int level = std::min((int)texel[2], numLevels - 1); level < numLevels; ++level, x /= 2, y /= 2) {
+			x = std::min(x, GetLevelPagesX(level) - 1);
+			y = std::min(y, GetLevelPagesY(level) - 1);
+			const int page = levelFirstPage[level] + y * GetLevelPagesX(level) + x;
+			if (pageSeenFrame[page] == frame)
+				break;
+			pageSeenFrame[page] = frame;
+			if (pageSlot[page] >= 0)
+				slots[pageSlot[page]].lastUsedFrame = frame;
+			else if (!pageLoading[page])
+				missing.push_back(page);
+		}
+	}
+	// Coarse pages first (they come last in the file): each fills the holes of many.
+	std::sort(missing.begin(), missing.end(), std::greater<int>());
+	for (auto&& page : missing) {
+		if (numPagesInFlight >= maxPagesInFlight)
+			break;
+		RequestPage(page);
+	}
+}
+
+void VirtualTexture::RequestPage(const int page)
+{
+	pageLoading[page] = 1;
+	++numPagesInFlight;
+	// The task only touches its copies and the queue, never the virtual texture.
+	std::shared_ptr<LoadedQueue> queue = loaded;
+	const std::string path = tilePath;
+	const size_t offset = GetPageOffset(page);
+	const size_t numBytes = GetPageBytes();
+	ThreadPool::Instance().Async([queue, path, offset, numBytes, page]() {
+		LoadedPage loadedPage;
+		loadedPage.page = page;
+		loadedPage.blocks.resize(numBytes);
+		std::ifstream in(path, std::ios::binary);
+		in.seekg((std::streamoff)offset);
+		if (!in.read((char*)loadedPage.blocks.data(), numBytes))
+			loadedPage.blocks.clear();
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->pages.push_back(std::move(loadedPage));
+	});
+}
+
+bool VirtualTexture::UploadPage(const int page, const std::vector<uint8_t>& blocks)
+{
+	// A free slot, or else the least recently used one that was not needed this frame.
+	// The coarsest level is never replaced.
+	int slot = -1;
+	unsigned int oldestFrame = frame;
+	for (int i = 0; i < (int)slots.size(); ++i) {
+		if (slots[i].page < 0) {
+			slot = i;
+			break;
+		}
+		if (slots[i].page >= levelFirstPage[numLevels - 1])
+			continue;
+		if (slots[i].lastUsedFrame < oldestFrame) {
+			oldestFrame = slots[i].lastUsedFrame;
+			slot = i;
+		}
+	}
+	if (slot < 0)
+		return false;
+	if (slots[slot].page >= 0)
+		pageSlot[slots[slot].page] = -1;
+	slots[slot].page = page;
+	slots[slot].lastUsedFrame = frame;
+	pageSlot[page] = slot;
+
+	glBindTexture(GL_TEXTURE_2D, pageCacheTexId);
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheSide) * pageSize, (slot / cacheSide) * pageSize,
+							pageSize, pageSize, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, (GLsizei)blocks.size(), blocks.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	++numPagesUploaded;
+	indirectionDirty = true;
+	return true;
+}
+
+void VirtualTexture::UpdateIndirection()
+{
+	// Coarsest first: a page that is not resident takes its parent's entry.
+	for (int level = numLevels - 1; level >= 0; --level) {
+		const int levelPagesX = GetLevelPagesX(level);
+		const int levelPagesY = GetLevelPagesY(level);
+		std::vector<uint32_t>& entries = indirection[level];
+		for (int y = 0; y < levelPagesY; ++y) {
+			for (int x = 0; x < levelPagesX; ++x) {
+				const int slot = pageSlot[levelFirstPage[level] + y * levelPagesX + x];
+				uint32_t entry = 0;
+				if (slot >= 0)
+					entry = (uint32_t)(slot % cacheSide) | ((uint32_t)(slot / cacheSide) << 8) | ((uint32_t)level << 16) | (255u << 24);
+				else if (level + 1 < numLevels) {
+					const int parentX = std::min(x / 2, GetLevelPagesX(level + 1) - 1);
+					const int parentY = std::min(y / 2, GetLevelPagesY(level + 1) - 1);
+					entry = indirection[level + 1][(size_t)parentY * GetLevelPagesX(level + 1) + parentX];
+				}
+				entries[(size_t)y * levelPagesX + x] = entry;
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, indirectionTexId);
+	for (int level = 0; level < numLevels; ++level) {
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, GetLevelPagesX(level), GetLevelPagesY(level),
+						GL_RGBA, GL_UNSIGNED_BYTE, indirection[level].data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	indirectionDirty = false;
+}
+
+void VirtualTexture::BeginFeedback(const int screenWidth, const int screenHeight)
+{
+	const int width = std::max(1, screenWidth / feedbackScale);
+	const int height = std::max(1, screenHeight / feedbackScale);
+	if (feedbackFboId == 0 || width != feedbackWidth || height != feedbackHeight) {
+		ReleaseFeedbackTargets();
+		feedbackWidth = width;
+		feedbackHeight = height;
+		glGenTextures(1, &feedbackTexId);
+		glBindTexture(GL_TEXTURE_2D, feedbackTexId);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &feedbackFboId);
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFboId);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackTexId, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cerr << "[ERROR] Virtual texture feedback framebuffer is incomplete" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glGenBuffers(2, feedbackPboIds);
+		for (int i = 0; i < 2; ++i) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPboIds[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFboId);
+	glViewport(0, 0, feedbackWidth, feedbackHeight);
+	const GLfloat noLookup[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearBufferfv(GL_COLOR, 0, noLookup);
+}
+
+void VirtualTexture::EndFeedback()
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPboIds[nextFeedbackPbo]);
+	glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedbackPending[nextFeedbackPbo] = true;
+	nextFeedbackPbo ^= 1;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void VirtualTexture::ReleaseFeedbackTargets()
+{
+	glDeleteFramebuffers(1, &feedbackFboId);
+	glDeleteTextures(1, &feedbackTexId);
+	glDeleteBuffers(2, feedbackPboIds);
+	feedbackFboId = 0;
+	feedbackTexId = 0;
+	feedbackPboIds[0] = feedbackPboIds[1] = 0;
+	feedbackPending[0] = feedbackPending[1] = false;
+}
+
+void VirtualTexture::Bind(GLenum indirectionUnit, GLenum pageCacheUnit)
+{
+	MarkUsed();
+	glActiveTexture(indirectionUnit);
+	glBindTexture(GL_TEXTURE_2D, indirectionTexId);
+	glActiveTexture(pageCacheUnit);
+	glBindTexture(GL_TEXTURE_2D, pageCacheTexId);
+}
+
+cv::Mat VirtualTexture::ReadLevel(const int maxWidth) const
+{
+	const int content = pageSize - 2 * pageBorder;
+	int level = 0;
+	while (level + 1 < numLevels && GetLevelPagesX(level) * content > maxWidth)
+		++level;
+	const int levelPagesX = GetLevelPagesX(level);
+	const int levelPagesY = GetLevelPagesY(level);
+	cv::Mat image(levelPagesY * content, levelPagesX * content, CV_8UC4);
+
+	std::ifstream in(tilePath, std::ios::binary);
+	std::vector<uint8_t> blocks;
+	std::vector<uint32_t> texels;
+	for (int py = 0; py < levelPagesY; ++py) {
+		for (int px = 0; px < levelPagesX; ++px) {
+			if (!ReadPage(in, levelFirstPage[level] + py * levelPagesX + px, blocks)) {
+				std::cerr << "[ERROR] Cannot read virtual texture: " << tilePath << std::endl;
+				return cv::Mat();
+			}
+			BlockCompressedImage::DecodeBlocks(blocks.data(), pageSize, pageSize, BLOCK_BC1, texels);
+			for (int y = 0; y < content; ++y) {
+				std::memcpy(image.ptr<uint32_t>(py * content + y) + px * content,
+							&texels[(size_t)(y + pageBorder) * pageSize + pageBorder], content * sizeof(uint32_t));
+			}
+		}
+	}
+	return image;
+}
+
+size_t VirtualTexture::GetGpuBytes() const
+{
+	if (pageCacheTexId == 0)
+		return 0;
+	size_t total = (size_t)cacheSide * cacheSide * GetPageBytes();
+	for (auto&& entries : indirection)
+		total += entries.size() * sizeof(uint32_t);
+	return total + (size_t)feedbackWidth * feedbackHeight * 4 * 3;
+}
+
+size_t VirtualTexture::GetCpuBytes() const
+{
+	size_t total = (size_t)numPages * (sizeof(int) + sizeof(unsigned char) + sizeof(unsigned int));
+	for (auto&& entries : indirection)
+		total += entries.size() * sizeof(uint32_t);
+	return total + slots.size() * sizeof(CacheSlot);
+}
+
+void VirtualTexture::PrintStats() const
+{
+	int numUsed = 0;
+	for (auto&& slot : slots)
+		numUsed += (slot.page >= 0 && slot.lastUsedFrame + 1 >= frame) ? 1 : 0;
+	int numResident = 0;
+	for (auto&& slot : slots)
+		numResident += slot.page >= 0 ? 1 : 0;
+	std::cout << "Virtual texture: " << numResident << " of " << slots.size() << " cache pages resident ("
+			  << numUsed << " in view), " << numPagesUploaded << " uploaded, " << numPagesDropped
+			  << " dropped (cache full), " << numPagesInFlight << " loading" << std::endl;
+}
@@ -0,0 +1,137 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "headers.h"
+#include "blockcompression.h"
+#include "memorybudget.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// VirtualTexture Declarations.
+// A panorama too large to load whole, split offline (Tile) into a *.vt file of BC1 pages:
+// pageSize texels a side, of which border texels repeat the neighbours for filtering, at
+// every mip level. At run time a feedback pass renders the page each pixel needs into a
+// small framebuffer; the pages missing from it are read on the thread pool and uploaded
+// into a page cache texture (least recently used pages are replaced), and an indirection
+// texture (one texel per page and level) tells the shader where each page is, or the
+// nearest coarser page that is resident. The coarsest level stays resident.
+class VirtualTexture : public BudgetedResource
+{
+public:
+	// VirtualTexture Public Methods.
+	static const int pageSize = 128;
+	static const int pageBorder = 1;
+	// Level 0 is at most this many pages across and down (32256 x 32256 texels).
+	static const int maxPages = 256;
+	// Feedback is rendered at 1 / feedbackScale of the screen resolution.
+	static const int feedbackScale = 8;
+
+	VirtualTexture();
+	~VirtualTexture();
+
+	// Offline: resample the image to whole power-of-two page counts, build the mip chain and
+	// write the compressed pages to GetTilePath(imagePath). Runs headless.
+	static bool Tile(const std::string& imagePath);
+	static std::string GetTilePath(const std::string& imagePath) { return imagePath + ".vt"; }
+
+	// Open the tiled file of an image and load the coarsest level (GL thread).
+	bool Open(const std::string& imagePath);
+	// Read back the last feedback, upload the pages loaded since the last frame and update
+	// the indirection texture; call once per frame on the GL thread.
+	void Update();
+	// Render the feedback pass between these (the caller draws with the feedback shader).
+	void BeginFeedback(const int screenWidth, const int screenHeight);
+	void EndFeedback();
+	void Bind(GLenum indirectionUnit, GLenum pageCacheUnit);
+	// Decode the finest level at most maxWidth texels wide from the file (BGRA, bottom row
+	// first), e.g. to derive the environment lighting.
+	cv::Mat ReadLevel(const int maxWidth) const;
+	void PrintStats() const;
+
+	int GetPagesX() const { return pagesX; }
+	int GetPagesY() const { return pagesY; }
+	int GetNumLevels() const { return numLevels; }
+	int GetCacheSize() const { return cacheSide * pageSize; }
+	const std::string& GetTilePath() const { return tilePath; }
+
+	// BudgetedResource interface.
+	const char* GetResourceType() const { return "virtual texture"; }
+	size_t GetGpuBytes() const;
+	size_t GetCpuBytes() const;
+
+private:
+	// A page read by a worker, waiting for upload.
+	struct LoadedPage
+	{
+		int page;
+		std::vector<uint8_t> blocks;
+	};
+	// Filled by the workers; held by shared_ptr so a read still running at exit does not outlive it.
+	struct LoadedQueue
+	{
+		std::mutex mutex;
+		std::deque<LoadedPage> pages;
+	};
+	// A page of the page cache.
+	struct CacheSlot
+	{
+		int page;
+		unsigned int lastUsedFrame;
+	};
+	static const int maxPagesInFlight = 64;
+	static const int maxUploadsPerFrame = 16;
+
+	// VirtualTexture Private Methods.
+	int GetLevelPagesX(const int level) const { return std::max(1, pagesX >> level); }
+	int GetLevelPagesY(const int level) const { return std::max(1, pagesY >> level); }
+	size_t GetPageBytes() const;
+	size_t GetPageOffset(const int page) const;
+	bool ReadPage(std::ifstream& in, const int page, std::vector<uint8_t>& blocks) const;
+	// Mark the pages in the feedback (and their coarser ancestors) used, and request the missing ones.
+	void ProcessFeedback(const uint8_t* texels, const int numTexels);
+	void RequestPage(const int page);
+	// Put a page into the least recently used slot not needed this frame; false if none is free.
+	bool UploadPage(const int page, const std::vector<uint8_t>& blocks);
+	void UpdateIndirection();
+	void ReleaseFeedbackTargets();
+
+	// VirtualTexture Private Data.
+	std::string tilePath;
+	size_t headerBytes;
+	int pagesX;
+	int pagesY;
+	int numLevels;
+	int numPages;
+	// First page of each level in the file.
+	std::vector<int> levelFirstPage;
+	// Page -> cache slot, or -1.
+	std::vector<int> pageSlot;
+	std::vector<unsigned char> pageLoading;
+	std::vector<unsigned int> pageSeenFrame;
+	std::vector<CacheSlot> slots;
+	int cacheSide;
+	std::shared_ptr<LoadedQueue> loaded;
+	int numPagesInFlight;
+	// RGBA8 indirection entries per level: cache slot x, y and the level of the page used.
+	std::vector<std::vector<uint32_t>> indirection;
+	bool indirectionDirty;
+	unsigned int frame;
+
+	GLuint pageCacheTexId;
+	GLuint indirectionTexId;
+	// Feedback framebuffer and the two pixel pack buffers it is read into (a frame apart).
+	GLuint feedbackFboId;
+	GLuint feedbackTexId;
+	GLuint feedbackPboIds[2];
+	bool feedbackPending[2];
+	int feedbackWidth;
+	int feedbackHeight;
+	int nextFeedbackPbo;
+	GLint savedViewport[4];
+
+	int numPagesUploaded;
+	int numPagesDropped;
+};
+
+#endif